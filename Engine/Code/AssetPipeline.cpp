@@ -0,0 +1,104 @@
+#include "AssetPipeline.h"
+
+void AssetPipeline::ThreadSwitch::await_suspend(std::coroutine_handle<> handle) const
+{
+    // Once queued the coroutine may resume on another thread and end, destroying this
+    // awaiter along with its frame, so nothing of it is read after the push
+    AssetPipeline* p = pipeline;
+    if (toWorker)
+    {
+        {
+            std::lock_guard<std::mutex> lock(p->workerMutex);
+            p->workerQueue.push_back(handle);
+        }
+        p->workerCondition.notify_one();
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(p->renderThreadMutex);
+        p->renderThreadQueue.push_back(handle);
+    }
+}
+
+void AssetPipeline::Start(u32 workerCount)
+{
+    stopping = false;
+    for (u32 i = 0; i < workerCount; ++i)
+    {
+        workers.emplace_back(&AssetPipeline::WorkerLoop, this);
+    }
+}
+
+void AssetPipeline::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);
+        stopping = true;
+    }
+    workerCondition.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    workers.clear();
+
+    // Loads still in flight are dropped along their frames
+    for (std::coroutine_handle<> handle : workerQueue)
+    {
+        handle.destroy();
+    }
+    workerQueue.clear();
+
+    for (std::coroutine_handle<> handle : renderThreadQueue)
+    {
+        handle.destroy();
+    }
+    renderThreadQueue.clear();
+}
+
+void AssetPipeline::WorkerLoop()
+{
+    for (;;)
+    {
+        std::coroutine_handle<> handle;
+        {
+            std::unique_lock<std::mutex> lock(workerMutex);
+            workerCondition.wait(lock, [this]() { return stopping || !workerQueue.empty(); });
+            if (stopping)
+                return;
+
+            handle = workerQueue.front();
+            workerQueue.pop_front();
+        }
+
+        handle.resume();
+    }
+}
+
+u32 AssetPipeline::ResumeRenderThreadStages(f32 timeBudget)
+{
+    const f64 start = glfwGetTime();
+
+    u32 resumedStages = 0;
+    for (;;)
+    {
+        std::coroutine_handle<> handle;
+        {
+            std::lock_guard<std::mutex> lock(renderThreadMutex);
+            if (renderThreadQueue.empty())
+                break;
+
+            handle = renderThreadQueue.front();
+            renderThreadQueue.pop_front();
+        }
+
+        handle.resume();
+        resumedStages++;
+
+        if ((glfwGetTime() - start) * 1000.0 >= timeBudget)
+            break;
+    }
+
+    return resumedStages;
+}
\ No newline at end of file
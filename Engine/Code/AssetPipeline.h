@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Globals.h"
+#include <coroutine>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+
+// Fire and forget coroutine, it runs until its first co_await right away and
+// frees its frame once it returns
+struct AssetTask
+{
+    struct promise_type
+    {
+        AssetTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// Asset loads are coroutines that move between a pool of worker threads, for
+// file reads and decoding, and the render thread, for everything touching GL
+// or the App. Render thread stages only resume inside ResumeRenderThreadStages
+class AssetPipeline
+{
+public:
+
+    struct ThreadSwitch
+    {
+        AssetPipeline* pipeline;
+        bool toWorker;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) const;
+        void await_resume() const noexcept {}
+    };
+
+    void Start(u32 workerCount);
+
+    void Stop();
+
+    ThreadSwitch ToWorker() { return { this, true }; }
+
+    ThreadSwitch ToRenderThread() { return { this, false }; }
+
+    // Counts the loads in flight, a task begins before its first switch and ends after its last stage
+    void BeginTask() { pendingTasks++; }
+
+    void EndTask() { pendingTasks--; }
+
+    u32 GetPendingTasks() const { return pendingTasks; }
+
+    u32 GetWorkerCount() const { return workers.size(); }
+
+    // Resumes the render thread stages waiting, until timeBudget ms are spent. At least one runs per call
+    u32 ResumeRenderThreadStages(f32 timeBudget);
+
+private:
+
+    void WorkerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::coroutine_handle<>> workerQueue;
+    std::mutex workerMutex;
+    std::condition_variable workerCondition;
+    bool stopping = false;
+
+    std::deque<std::coroutine_handle<>> renderThreadQueue;
+    std::mutex renderThreadMutex;
+
+    std::atomic<u32> pendingTasks{ 0 };
+};
\ No newline at end of file
@@ -0,0 +1,487 @@
+#include "BVH.h"
+
+static f32 SurfaceArea(const AABB& aabb)
+{
+    const vec3 extent = aabb.max - aabb.min;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static bool Overlaps(const AABB& a, const AABB& b)
+{
+    return glm::all(glm::lessThanEqual(a.min, b.max)) && glm::all(glm::lessThanEqual(b.min, a.max));
+}
+
+static bool Contains(const AABB& outer, const AABB& inner)
+{
+    return glm::all(glm::lessThanEqual(outer.min, inner.min)) && glm::all(glm::lessThanEqual(inner.max, outer.max));
+}
+
+enum FrustumTest { FrustumTest_Outside, FrustumTest_Intersecting, FrustumTest_Inside };
+
+static FrustumTest TestFrustum(const Frustum& frustum, const AABB& aabb)
+{
+    const vec3 center = (aabb.min + aabb.max) * 0.5f;
+    const vec3 extent = (aabb.max - aabb.min) * 0.5f;
+
+    FrustumTest result = FrustumTest_Inside;
+    for (u32 i = 0; i < 6; ++i)
+    {
+        const vec3 normal = vec3(frustum.planes[i]);
+        const f32 distance = glm::dot(normal, center) + frustum.planes[i].w;
+        const f32 radius = glm::dot(extent, glm::abs(normal));
+
+        if (distance < -radius)
+            return FrustumTest_Outside;
+        if (distance < radius)
+            result = FrustumTest_Intersecting;
+    }
+    return result;
+}
+
+static bool RayHitsAABB(const vec3& origin, const vec3& inverseDirection, f32 maxDistance, const AABB& aabb, f32& hitDistance)
+{
+    const vec3 t0 = (aabb.min - origin) * inverseDirection;
+    const vec3 t1 = (aabb.max - origin) * inverseDirection;
+    const vec3 tNear = glm::min(t0, t1);
+    const vec3 tFar = glm::max(t0, t1);
+
+    const f32 enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+    const f32 exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, maxDistance));
+
+    hitDistance = enter;
+    return enter <= exit;
+}
+
+BVH::BVH() : root(BVH_NULL_NODE), freeList(BVH_NULL_NODE), proxyCount(0)
+{
+}
+
+u32 BVH::CreateProxy(const AABB& aabb, u32 userData)
+{
+    const u32 proxyId = AllocateNode();
+    BVHNode& node = nodes[proxyId];
+    node.tightAABB = aabb;
+    node.aabb = { aabb.min - vec3(BVH_AABB_MARGIN), aabb.max + vec3(BVH_AABB_MARGIN) };
+    node.userData = userData;
+    node.height = 0;
+
+    InsertLeaf(proxyId);
+    proxyCount++;
+
+    return proxyId;
+}
+
+void BVH::DestroyProxy(u32 proxyId)
+{
+    assert(proxyId < nodes.size() && nodes[proxyId].IsLeaf());
+
+    RemoveLeaf(proxyId);
+    FreeNode(proxyId);
+    proxyCount--;
+}
+
+bool BVH::MoveProxy(u32 proxyId, const AABB& aabb)
+{
+    assert(proxyId < nodes.size() && nodes[proxyId].IsLeaf());
+
+    nodes[proxyId].tightAABB = aabb;
+    if (Contains(nodes[proxyId].aabb, aabb))
+        return false;
+
+    RemoveLeaf(proxyId);
+    nodes[proxyId].aabb = { aabb.min - vec3(BVH_AABB_MARGIN), aabb.max + vec3(BVH_AABB_MARGIN) };
+    InsertLeaf(proxyId);
+
+    return true;
+}
+
+u32 BVH::GetUserData(u32 proxyId) const
+{
+    return nodes[proxyId].userData;
+}
+
+u32 BVH::GetProxyCount() const
+{
+    return proxyCount;
+}
+
+i32 BVH::GetHeight() const
+{
+    return root == BVH_NULL_NODE ? 0 : nodes[root].height;
+}
+
+void BVH::QueryFrustum(const Frustum& frustum, std::vector<u32>& results) const
+{
+    if (root == BVH_NULL_NODE)
+        return;
+
+    std::vector<u32> stack;
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        const u32 nodeId = stack.back();
+        stack.pop_back();
+
+        const BVHNode& node = nodes[nodeId];
+        const FrustumTest test = TestFrustum(frustum, node.IsLeaf() ? node.tightAABB : node.aabb);
+        if (test == FrustumTest_Outside)
+            continue;
+
+        // A subtree fully inside needs no more plane tests
+        if (test == FrustumTest_Inside || node.IsLeaf())
+        {
+            CollectLeaves(nodeId, results);
+            continue;
+        }
+
+        stack.push_back(node.child1);
+        stack.push_back(node.child2);
+    }
+}
+
+void BVH::QueryAABB(const AABB& aabb, std::vector<u32>& results) const
+{
+    if (root == BVH_NULL_NODE)
+        return;
+
+    std::vector<u32> stack;
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        const u32 nodeId = stack.back();
+        stack.pop_back();
+
+        const BVHNode& node = nodes[nodeId];
+        if (node.IsLeaf())
+        {
+            if (Overlaps(node.tightAABB, aabb))
+                results.push_back(node.userData);
+        }
+        else if (Overlaps(node.aabb, aabb))
+        {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
+
+void BVH::QueryAABBBatch(const AABB* aabbs, u32 count, std::vector<std::pair<u32, u32>>& results) const
+{
+    if (root == BVH_NULL_NODE || count == 0)
+        return;
+
+    // Every stack entry carries the range of queries still overlapping the node,
+    // the ranges are stored back to back in activeQueries
+    struct StackEntry
+    {
+        u32 nodeId;
+        u32 firstQuery;
+        u32 queryCount;
+    };
+
+    std::vector<u32> activeQueries(count);
+    for (u32 i = 0; i < count; ++i)
+    {
+        activeQueries[i] = i;
+    }
+
+    std::vector<StackEntry> stack;
+    stack.push_back({ root, 0, count });
+    while (!stack.empty())
+    {
+        const StackEntry entry = stack.back();
+        stack.pop_back();
+
+        const BVHNode& node = nodes[entry.nodeId];
+        const AABB& nodeAABB = node.IsLeaf() ? node.tightAABB : node.aabb;
+
+        const u32 firstQuery = activeQueries.size();
+        for (u32 i = 0; i < entry.queryCount; ++i)
+        {
+            const u32 queryIdx = activeQueries[entry.firstQuery + i];
+            if (Overlaps(nodeAABB, aabbs[queryIdx]))
+                activeQueries.push_back(queryIdx);
+        }
+
+        const u32 queryCount = activeQueries.size() - firstQuery;
+        if (queryCount == 0)
+            continue;
+
+        if (node.IsLeaf())
+        {
+            for (u32 i = 0; i < queryCount; ++i)
+            {
+                results.push_back({ activeQueries[firstQuery + i], node.userData });
+            }
+        }
+        else
+        {
+            stack.push_back({ node.child1, firstQuery, queryCount });
+            stack.push_back({ node.child2, firstQuery, queryCount });
+        }
+    }
+}
+
+u32 BVH::RayCast(const vec3& origin, const vec3& direction, f32 maxDistance, f32* hitDistance) const
+{
+    u32 closestProxy = BVH_NULL_NODE;
+    if (root == BVH_NULL_NODE)
+        return closestProxy;
+
+    const vec3 inverseDirection = 1.0f / direction;
+    f32 closestDistance = maxDistance;
+
+    std::vector<u32> stack;
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        const u32 nodeId = stack.back();
+        stack.pop_back();
+
+        const BVHNode& node = nodes[nodeId];
+        f32 distance;
+        if (!RayHitsAABB(origin, inverseDirection, closestDistance, node.IsLeaf() ? node.tightAABB : node.aabb, distance))
+            continue;
+
+        if (node.IsLeaf())
+        {
+            closestDistance = distance;
+            closestProxy = nodeId;
+        }
+        else
+        {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+
+    if (hitDistance != nullptr)
+        *hitDistance = closestDistance;
+
+    return closestProxy == BVH_NULL_NODE ? BVH_NULL_NODE : nodes[closestProxy].userData;
+}
+
+u32 BVH::AllocateNode()
+{
+    if (freeList == BVH_NULL_NODE)
+    {
+        nodes.push_back(BVHNode{});
+        nodes.back().height = -1;
+        freeList = nodes.size() - 1;
+        nodes[freeList].parent = BVH_NULL_NODE;
+    }
+
+    const u32 nodeId = freeList;
+    freeList = nodes[nodeId].parent;
+
+    BVHNode& node = nodes[nodeId];
+    node.parent = BVH_NULL_NODE;
+    node.child1 = BVH_NULL_NODE;
+    node.child2 = BVH_NULL_NODE;
+    node.height = 0;
+    node.userData = 0;
+    return nodeId;
+}
+
+void BVH::FreeNode(u32 nodeId)
+{
+    nodes[nodeId].parent = freeList;
+    nodes[nodeId].height = -1;
+    freeList = nodeId;
+}
+
+void BVH::InsertLeaf(u32 leaf)
+{
+    if (root == BVH_NULL_NODE)
+    {
+        root = leaf;
+        nodes[root].parent = BVH_NULL_NODE;
+        return;
+    }
+
+    // Walk down to the sibling that grows the total surface area the least
+    const AABB leafAABB = nodes[leaf].aabb;
+    u32 index = root;
+    while (!nodes[index].IsLeaf())
+    {
+        const BVHNode& node = nodes[index];
+        const f32 area = SurfaceArea(node.aabb);
+        const f32 combinedArea = SurfaceArea(Culling::MergeAABB(node.aabb, leafAABB));
+
+        // Cost of making a new parent here and the minimum cost pushed down to the children
+        const f32 cost = 2.0f * combinedArea;
+        const f32 inheritanceCost = 2.0f * (combinedArea - area);
+
+        f32 childCost[2];
+        const u32 children[2] = { node.child1, node.child2 };
+        for (u32 i = 0; i < 2; ++i)
+        {
+            const BVHNode& child = nodes[children[i]];
+            const f32 mergedArea = SurfaceArea(Culling::MergeAABB(child.aabb, leafAABB));
+            childCost[i] = child.IsLeaf() ? mergedArea + inheritanceCost : mergedArea - SurfaceArea(child.aabb) + inheritanceCost;
+        }
+
+        if (cost < childCost[0] && cost < childCost[1])
+            break;
+
+        index = childCost[0] < childCost[1] ? node.child1 : node.child2;
+    }
+
+    const u32 sibling = index;
+    const u32 oldParent = nodes[sibling].parent;
+    const u32 newParent = AllocateNode();
+    nodes[newParent].parent = oldParent;
+    nodes[newParent].aabb = Culling::MergeAABB(leafAABB, nodes[sibling].aabb);
+    nodes[newParent].height = nodes[sibling].height + 1;
+    nodes[newParent].child1 = sibling;
+    nodes[newParent].child2 = leaf;
+    nodes[sibling].parent = newParent;
+    nodes[leaf].parent = newParent;
+
+    if (oldParent == BVH_NULL_NODE)
+    {
+        root = newParent;
+    }
+    else if (nodes[oldParent].child1 == sibling)
+    {
+        nodes[oldParent].child1 = newParent;
+    }
+    else
+    {
+        nodes[oldParent].child2 = newParent;
+    }
+
+    RefitAncestors(newParent);
+}
+
+void BVH::RemoveLeaf(u32 leaf)
+{
+    if (leaf == root)
+    {
+        root = BVH_NULL_NODE;
+        return;
+    }
+
+    const u32 parent = nodes[leaf].parent;
+    const u32 grandParent = nodes[parent].parent;
+    const u32 sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+    if (grandParent == BVH_NULL_NODE)
+    {
+        root = sibling;
+        nodes[sibling].parent = BVH_NULL_NODE;
+        FreeNode(parent);
+        return;
+    }
+
+    // The sibling takes the place of the parent
+    if (nodes[grandParent].child1 == parent)
+    {
+        nodes[grandParent].child1 = sibling;
+    }
+    else
+    {
+        nodes[grandParent].child2 = sibling;
+    }
+    nodes[sibling].parent = grandParent;
+    FreeNode(parent);
+
+    RefitAncestors(grandParent);
+}
+
+void BVH::RefitAncestors(u32 nodeId)
+{
+    u32 index = nodeId;
+    while (index != BVH_NULL_NODE)
+    {
+        index = Balance(index);
+
+        BVHNode& node = nodes[index];
+        node.height = 1 + glm::max(nodes[node.child1].height, nodes[node.child2].height);
+        node.aabb = Culling::MergeAABB(nodes[node.child1].aabb, nodes[node.child2].aabb);
+
+        index = node.parent;
+    }
+}
+
+u32 BVH::Balance(u32 nodeId)
+{
+    // Rotates the taller child up when the subtree heights differ by more than one,
+    // returns the node that now sits at the place of nodeId
+    const u32 a = nodeId;
+    if (nodes[a].IsLeaf() || nodes[a].height < 2)
+        return a;
+
+    const u32 b = nodes[a].child1;
+    const u32 c = nodes[a].child2;
+    const i32 balance = nodes[c].height - nodes[b].height;
+    if (balance >= -1 && balance <= 1)
+        return a;
+
+    // Promote the taller child (up) and hand one of its children (f or g) down to a
+    const u32 up = balance > 1 ? c : b;
+    const u32 down = balance > 1 ? b : c;
+    const u32 f = nodes[up].child1;
+    const u32 g = nodes[up].child2;
+
+    nodes[up].child1 = a;
+    nodes[up].parent = nodes[a].parent;
+    nodes[a].parent = up;
+
+    if (nodes[up].parent == BVH_NULL_NODE)
+    {
+        root = up;
+    }
+    else if (nodes[nodes[up].parent].child1 == a)
+    {
+        nodes[nodes[up].parent].child1 = up;
+    }
+    else
+    {
+        nodes[nodes[up].parent].child2 = up;
+    }
+
+    // The taller grandchild stays with up, the other one replaces up under a
+    const bool keepF = nodes[f].height > nodes[g].height;
+    const u32 kept = keepF ? f : g;
+    const u32 moved = keepF ? g : f;
+
+    nodes[up].child2 = kept;
+    if (balance > 1)
+    {
+        nodes[a].child2 = moved;
+    }
+    else
+    {
+        nodes[a].child1 = moved;
+    }
+    nodes[moved].parent = a;
+
+    nodes[a].aabb = Culling::MergeAABB(nodes[down].aabb, nodes[moved].aabb);
+    nodes[a].height = 1 + glm::max(nodes[down].height, nodes[moved].height);
+    nodes[up].aabb = Culling::MergeAABB(nodes[a].aabb, nodes[kept].aabb);
+    nodes[up].height = 1 + glm::max(nodes[a].height, nodes[kept].height);
+
+    return up;
+}
+
+void BVH::CollectLeaves(u32 nodeId, std::vector<u32>& results) const
+{
+    std::vector<u32> stack;
+    stack.push_back(nodeId);
+    while (!stack.empty())
+    {
+        const BVHNode& node = nodes[stack.back()];
+        stack.pop_back();
+
+        if (node.IsLeaf())
+        {
+            results.push_back(node.userData);
+        }
+        else
+        {
+            stack.push_back(node.child1);
+            stack.push_back(node.child2);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Globals.h"
+#include "CullingFunctions.h"
+
+#define BVH_NULL_NODE UINT32_MAX
+
+// Leaves are stored fattened by this margin so small moves don't touch the tree
+#define BVH_AABB_MARGIN 0.1f
+
+struct BVHNode
+{
+    AABB aabb;
+    AABB tightAABB;
+    u32 parent;     // next free node while the node is in the free list
+    u32 child1;
+    u32 child2;
+    i32 height;     // 0 for leaves, -1 for free nodes
+    u32 userData;
+
+    bool IsLeaf() const { return child1 == BVH_NULL_NODE; }
+};
+
+// Dynamic AABB tree, every proxy is a leaf and internal nodes are kept
+// balanced with AVL style rotations on insertion and removal
+class BVH
+{
+public:
+
+    BVH();
+
+    u32 CreateProxy(const AABB& aabb, u32 userData);
+
+    void DestroyProxy(u32 proxyId);
+
+    // Refits the proxy, returns true when it left its fat AABB and had to be reinserted
+    bool MoveProxy(u32 proxyId, const AABB& aabb);
+
+    u32 GetUserData(u32 proxyId) const;
+
+    u32 GetProxyCount() const;
+
+    i32 GetHeight() const;
+
+    void QueryFrustum(const Frustum& frustum, std::vector<u32>& results) const;
+
+    void QueryAABB(const AABB& aabb, std::vector<u32>& results) const;
+
+    // Single traversal for many boxes, results are (query index, user data) pairs
+    void QueryAABBBatch(const AABB* aabbs, u32 count, std::vector<std::pair<u32, u32>>& results) const;
+
+    // Closest proxy whose tight AABB is hit by the ray, BVH_NULL_NODE if none
+    u32 RayCast(const vec3& origin, const vec3& direction, f32 maxDistance, f32* hitDistance = nullptr) const;
+
+private:
+
+    u32 AllocateNode();
+
+    void FreeNode(u32 nodeId);
+
+    void InsertLeaf(u32 leaf);
+
+    void RemoveLeaf(u32 leaf);
+
+    u32 Balance(u32 nodeId);
+
+    void RefitAncestors(u32 nodeId);
+
+    void CollectLeaves(u32 nodeId, std::vector<u32>& results) const;
+
+    std::vector<BVHNode> nodes;
+    u32 root;
+    u32 freeList;
+    u32 proxyCount;
+};
\ No newline at end of file
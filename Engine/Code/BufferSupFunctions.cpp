@@ -1,4 +1,11 @@
 #include "BufferSupFunctions.h"
+#include "platform.h"
+
+// glBufferStorage is GL 4.4 / ARB_buffer_storage, the loader only covers 4.3
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+static PFNGLBUFFERSTORAGEPROC glBufferStorage = NULL;
 
 namespace BufferManager
 {
@@ -37,6 +44,7 @@ namespace BufferManager
         glBindBuffer(buffer.type, buffer.handle);
         buffer.data = (u8*)glMapBuffer(buffer.type, access);
         buffer.head = 0;
+        buffer.overflowed = false;
     }
 
     void UnmapBuffer(Buffer& buffer)
@@ -45,17 +53,96 @@ namespace BufferManager
         glBindBuffer(buffer.type, 0);
     }
 
+    bool LoadBufferStorage()
+    {
+        bool supported = (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4)) || glfwExtensionSupported("GL_ARB_buffer_storage");
+        if (supported)
+        {
+            glBufferStorage = (PFNGLBUFFERSTORAGEPROC)glfwGetProcAddress("glBufferStorage");
+        }
+
+        return glBufferStorage != NULL;
+    }
+
+    Buffer CreateRingBuffer(u32 regionSize, GLenum type, u32 regionAlignment)
+    {
+        Buffer buffer = {};
+        buffer.regionSize = Align(regionSize, regionAlignment);
+        buffer.size = buffer.regionSize * RING_BUFFER_FRAMES;
+        buffer.type = type;
+        buffer.isPersistent = glBufferStorage != NULL;
+
+        glGenBuffers(1, &buffer.handle);
+        glBindBuffer(type, buffer.handle);
+        if (buffer.isPersistent)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(type, buffer.size, NULL, flags);
+            buffer.data = (u8*)glMapBufferRange(type, 0, buffer.size, flags);
+        }
+        else
+        {
+            glBufferData(type, buffer.size, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(type, 0);
+
+        return buffer;
+    }
+
+    void BeginRingRegion(Buffer& buffer, u32 regionIdx)
+    {
+        buffer.regionStart = regionIdx * buffer.regionSize;
+        buffer.head = buffer.regionStart;
+        buffer.overflowed = false;
+
+        // Without persistent mapping the fences still make an unsynchronized map safe
+        if (!buffer.isPersistent)
+        {
+            glBindBuffer(buffer.type, buffer.handle);
+            buffer.data = (u8*)glMapBufferRange(buffer.type, 0, buffer.size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        }
+    }
+
+    void EndRingRegion(Buffer& buffer)
+    {
+        if (!buffer.isPersistent)
+        {
+            glBindBuffer(buffer.type, buffer.handle);
+            UnmapBuffer(buffer);
+            buffer.data = NULL;
+        }
+    }
+
+    void BindRingRegion(const Buffer& buffer, GLuint binding)
+    {
+        glBindBufferRange(buffer.type, binding, buffer.handle, buffer.regionStart, buffer.regionSize);
+    }
+
     void AlignHead(Buffer& buffer, u32 alignment)
     {
         ASSERT(IsPowerOf2(alignment), "The alignment must be a power of 2");
         buffer.head = Align(buffer.head, alignment);
     }
 
-    void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment)
+    bool PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment)
     {
         ASSERT(buffer.data != NULL, "The buffer must be mapped first");
-        AlignHead(buffer, alignment);
+
+        // Past the region the GPU may still be reading another frame, so nothing is written there.
+        // Once a push failed the later ones are dropped too, the offsets after it would be wrong
+        const u32 end = buffer.regionSize ? buffer.regionStart + buffer.regionSize : (u32)buffer.size;
+        const u32 alignedHead = Align(buffer.head, alignment);
+        if (buffer.overflowed || alignedHead > end || size > end - alignedHead)
+        {
+            if (!buffer.overflowed)
+                ELOG("Buffer %u overflows, %u bytes don't fit in the %u left", buffer.handle, size, end - glm::min(alignedHead, end));
+            buffer.overflowed = true;
+            return false;
+        }
+
+        buffer.head = alignedHead;
         memcpy((u8*)buffer.data + buffer.head, data, size);
         buffer.head += size;
+        return true;
     }
 }
\ No newline at end of file
@@ -8,9 +8,12 @@ namespace BufferManager
 #define CreateConstantBuffer(size) BufferManager::CreateBuffer(size, GL_UNIFORM_BUFFER, GL_STREAM_DRAW)
 #define CreateStaticVertexBuffer(size) BufferManager::CreateBuffer(size, GL_ARRAY_BUFFER, GL_STATIC_DRAW)
 #define CreateStaticIndexBuffer(size) BufferManager::CreateBuffer(size, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW)
+#define CreateStorageBuffer(size) BufferManager::CreateBuffer(size, GL_SHADER_STORAGE_BUFFER, GL_STREAM_DRAW)
 
 #define PushData(buffer, data, size) BufferManager::PushAlignedData(buffer, data, size, 1)
 #define PushUInt(buffer, value) { u32 v = value; BufferManager::PushAlignedData(buffer, &v, sizeof(v), 4); }
+#define PushFloat(buffer, value) { f32 v = value; BufferManager::PushAlignedData(buffer, &v, sizeof(v), 4); }
+#define PushVec2(buffer, value) BufferManager::PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec2))
 #define PushVec3(buffer, value) BufferManager::PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
 #define PushVec4(buffer, value) BufferManager::PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
 #define PushMat3(buffer, value) BufferManager::PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
@@ -30,7 +33,20 @@ namespace BufferManager
 
     void UnmapBuffer(Buffer& buffer);
 
+    // Ring buffers, persistently mapped with glBufferStorage when available and
+    // written one region per frame, the caller fences the regions in use
+    bool LoadBufferStorage();
+
+    Buffer CreateRingBuffer(u32 regionSize, GLenum type, u32 regionAlignment);
+
+    void BeginRingRegion(Buffer& buffer, u32 regionIdx);
+
+    void EndRingRegion(Buffer& buffer);
+
+    void BindRingRegion(const Buffer& buffer, GLuint binding);
+
     void AlignHead(Buffer& buffer, u32 alignment);
 
-    void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
+    // Fails without writing when the data doesn't fit in the buffer, or in the region of a ring
+    bool PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
 }
\ No newline at end of file
@@ -9,6 +9,9 @@ void Camera::SetCamera(int width, int height, vec3 position)
 
 void Camera::Matrix(float FOVdeg, float nearPlane, float farPlane)
 {
+    this->nearPlane = nearPlane;
+    this->farPlane = farPlane;
+
     view = glm::lookAt(position, position + direction, up);
     projection = glm::perspective(glm::radians(FOVdeg), (float)(width / height), nearPlane, farPlane);
 }
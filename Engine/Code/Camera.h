@@ -17,6 +17,9 @@ public:
 
     float speed = 0.1f;
 
+    float nearPlane;
+    float farPlane;
+
     glm::mat4 view;
     glm::mat4 projection;
 
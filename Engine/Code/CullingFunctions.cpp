@@ -0,0 +1,145 @@
+#include "CullingFunctions.h"
+#include <emmintrin.h>
+#include <cfloat>
+
+static_assert(sizeof(BoundingSphere) == 4 * sizeof(f32), "CullSpheres loads a sphere as a single __m128");
+
+namespace Culling
+{
+    AABB ComputeAABB(const float* vertices, u32 vertexCount, u32 floatStride)
+    {
+        AABB aabb = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+        for (u32 i = 0; i < vertexCount; ++i)
+        {
+            const vec3 position = glm::make_vec3(vertices + i * floatStride);
+            aabb.min = glm::min(aabb.min, position);
+            aabb.max = glm::max(aabb.max, position);
+        }
+
+        if (vertexCount == 0)
+        {
+            aabb.min = aabb.max = vec3(0.0f);
+        }
+
+        return aabb;
+    }
+
+    BoundingSphere ComputeBoundingSphere(const float* vertices, u32 vertexCount, u32 floatStride, const AABB& aabb)
+    {
+        // Centered on the box, but the radius only reaches the farthest vertex
+        // which is tighter than half the box diagonal
+        BoundingSphere sphere = { (aabb.min + aabb.max) * 0.5f, 0.0f };
+        f32 radiusSq = 0.0f;
+        for (u32 i = 0; i < vertexCount; ++i)
+        {
+            const vec3 offset = glm::make_vec3(vertices + i * floatStride) - sphere.center;
+            radiusSq = glm::max(radiusSq, glm::dot(offset, offset));
+        }
+        sphere.radius = glm::sqrt(radiusSq);
+
+        return sphere;
+    }
+
+    AABB MergeAABB(const AABB& a, const AABB& b)
+    {
+        return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+    }
+
+    AABB TransformAABB(const AABB& aabb, const glm::mat4& worldMatrix)
+    {
+        // Arvo, every axis of the matrix extends the box along its own direction
+        const vec3 center = (aabb.min + aabb.max) * 0.5f;
+        const vec3 extent = (aabb.max - aabb.min) * 0.5f;
+
+        const vec3 worldCenter = vec3(worldMatrix * vec4(center, 1.0f));
+        const vec3 worldExtent = glm::abs(vec3(worldMatrix[0])) * extent.x +
+            glm::abs(vec3(worldMatrix[1])) * extent.y +
+            glm::abs(vec3(worldMatrix[2])) * extent.z;
+
+        return { worldCenter - worldExtent, worldCenter + worldExtent };
+    }
+
+    BoundingSphere TransformSphere(const BoundingSphere& sphere, const glm::mat4& worldMatrix)
+    {
+        // The largest axis scale keeps the sphere conservative under non uniform scaling
+        const f32 scaleSq = glm::max(glm::max(glm::dot(vec3(worldMatrix[0]), vec3(worldMatrix[0])),
+            glm::dot(vec3(worldMatrix[1]), vec3(worldMatrix[1]))),
+            glm::dot(vec3(worldMatrix[2]), vec3(worldMatrix[2])));
+
+        BoundingSphere worldSphere;
+        worldSphere.center = vec3(worldMatrix * vec4(sphere.center, 1.0f));
+        worldSphere.radius = sphere.radius * glm::sqrt(scaleSq);
+        return worldSphere;
+    }
+
+    Frustum ExtractFrustum(const glm::mat4& viewProjection)
+    {
+        // Gribb-Hartmann, the rows of the matrix combined, glm is column major
+        const glm::mat4 m = glm::transpose(viewProjection);
+
+        Frustum frustum;
+        frustum.planes[0] = m[3] + m[0]; // left
+        frustum.planes[1] = m[3] - m[0]; // right
+        frustum.planes[2] = m[3] + m[1]; // bottom
+        frustum.planes[3] = m[3] - m[1]; // top
+        frustum.planes[4] = m[3] + m[2]; // near
+        frustum.planes[5] = m[3] - m[2]; // far
+
+        for (u32 i = 0; i < 6; ++i)
+        {
+            frustum.planes[i] /= glm::length(vec3(frustum.planes[i]));
+        }
+
+        return frustum;
+    }
+
+    void CullSpheres(const Frustum& frustum, const BoundingSphere* spheres, u32 count, u8* visible)
+    {
+        __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+        for (u32 p = 0; p < 6; ++p)
+        {
+            planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+            planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+            planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+            planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+        }
+
+        u32 i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            // Transpose four spheres into x, y, z and radius lanes
+            __m128 x = _mm_loadu_ps(&spheres[i + 0].center.x);
+            __m128 y = _mm_loadu_ps(&spheres[i + 1].center.x);
+            __m128 z = _mm_loadu_ps(&spheres[i + 2].center.x);
+            __m128 r = _mm_loadu_ps(&spheres[i + 3].center.x);
+            _MM_TRANSPOSE4_PS(x, y, z, r);
+
+            const __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), r);
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (u32 p = 0; p < 6; ++p)
+            {
+                __m128 distance = _mm_add_ps(_mm_mul_ps(x, planeX[p]), planeW[p]);
+                distance = _mm_add_ps(distance, _mm_mul_ps(y, planeY[p]));
+                distance = _mm_add_ps(distance, _mm_mul_ps(z, planeZ[p]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+            }
+
+            const int mask = _mm_movemask_ps(inside);
+            visible[i + 0] = (mask >> 0) & 1;
+            visible[i + 1] = (mask >> 1) & 1;
+            visible[i + 2] = (mask >> 2) & 1;
+            visible[i + 3] = (mask >> 3) & 1;
+        }
+
+        for (; i < count; ++i)
+        {
+            u8 inside = 1;
+            for (u32 p = 0; p < 6 && inside; ++p)
+            {
+                const f32 distance = glm::dot(vec3(frustum.planes[p]), spheres[i].center) + frustum.planes[p].w;
+                inside = distance >= -spheres[i].radius;
+            }
+            visible[i] = inside;
+        }
+    }
+}
\ No newline at end of file
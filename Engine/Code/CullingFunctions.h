@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Globals.h"
+
+struct Frustum
+{
+    // Normalized planes with the normals pointing inside, dot(plane.xyz, p) + plane.w >= 0 is inside
+    vec4 planes[6];
+};
+
+namespace Culling
+{
+    AABB ComputeAABB(const float* vertices, u32 vertexCount, u32 floatStride);
+
+    BoundingSphere ComputeBoundingSphere(const float* vertices, u32 vertexCount, u32 floatStride, const AABB& aabb);
+
+    AABB MergeAABB(const AABB& a, const AABB& b);
+
+    AABB TransformAABB(const AABB& aabb, const glm::mat4& worldMatrix);
+
+    BoundingSphere TransformSphere(const BoundingSphere& sphere, const glm::mat4& worldMatrix);
+
+    Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+    // Tests the spheres four at a time with SSE, visible[i] is set to 1 or 0
+    void CullSpheres(const Frustum& frustum, const BoundingSphere* spheres, u32 count, u8* visible);
+}
\ No newline at end of file
@@ -0,0 +1,367 @@
+#include "FrameGraph.h"
+#include "platform.h"
+#include <algorithm>
+
+static u32 GetTexelBytes(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+    case GL_RG16:
+    case GL_RGBA8:
+    case GL_R32F:
+    case GL_DEPTH24_STENCIL8:
+        return 4;
+    case GL_RGBA16F:
+        return 8;
+    case GL_RGBA32F:
+        return 16;
+    default:
+        ELOG("Frame graph texture format 0x%X has no known size", internalFormat);
+        return 4;
+    }
+}
+
+void FrameGraph::Begin(ivec2 frameSize)
+{
+    // Every pooled texture was sized after the old frame, none would be taken again
+    if (frameSize != size)
+    {
+        Release();
+        size = frameSize;
+    }
+
+    resources.clear();
+    passes.clear();
+    frameIndex++;
+}
+
+FrameGraphResource FrameGraph::AddResource(const char* name, FrameGraphResourceType type, GLenum internalFormat, ivec2 textureSize, GLuint handle)
+{
+    FrameGraphResourceNode resource = {};
+    resource.name = name;
+    resource.type = type;
+    resource.internalFormat = internalFormat;
+    resource.size = textureSize;
+    resource.imported = internalFormat == GL_NONE;
+    resource.handle = handle;
+    resource.firstPass = FRAME_GRAPH_NONE;
+    resources.push_back(resource);
+    return resources.size() - 1;
+}
+
+FrameGraphResource FrameGraph::CreateTexture(const char* name, GLenum internalFormat)
+{
+    return AddResource(name, FrameGraphResource_Texture, internalFormat, size, 0);
+}
+
+FrameGraphResource FrameGraph::CreateTexture(const char* name, GLenum internalFormat, ivec2 textureSize)
+{
+    return AddResource(name, FrameGraphResource_Texture, internalFormat, textureSize, 0);
+}
+
+FrameGraphResource FrameGraph::ImportTexture(const char* name, GLuint handle)
+{
+    return AddResource(name, FrameGraphResource_Texture, GL_NONE, size, handle);
+}
+
+FrameGraphResource FrameGraph::ImportBuffer(const char* name, GLuint handle)
+{
+    return AddResource(name, FrameGraphResource_Buffer, GL_NONE, ivec2(0), handle);
+}
+
+FrameGraphResource FrameGraph::ImportBackBuffer()
+{
+    return AddResource("Back buffer", FrameGraphResource_BackBuffer, GL_NONE, size, 0);
+}
+
+u32 FrameGraph::AddPass(const char* name, FrameGraphExecute execute)
+{
+    FrameGraphPass pass = {};
+    pass.name = name;
+    pass.execute = execute;
+    pass.depthAttachment = FRAME_GRAPH_NONE;
+    passes.push_back(pass);
+    return passes.size() - 1;
+}
+
+void FrameGraph::Read(u32 pass, FrameGraphResource resource)
+{
+    passes[pass].reads.push_back(resource);
+}
+
+void FrameGraph::Write(u32 pass, FrameGraphResource resource)
+{
+    passes[pass].writes.push_back(resource);
+
+    // Whatever reaches the screen is the reason the frame is rendered
+    if (resources[resource].type == FrameGraphResource_BackBuffer)
+        passes[pass].sideEffect = true;
+}
+
+void FrameGraph::AddColorAttachment(u32 pass, FrameGraphResource texture)
+{
+    passes[pass].colorAttachments.push_back(texture);
+    Write(pass, texture);
+}
+
+void FrameGraph::SetDepthAttachment(u32 pass, FrameGraphResource texture)
+{
+    // Depth and stencil tests read what earlier passes left in it
+    passes[pass].depthAttachment = texture;
+    Read(pass, texture);
+    Write(pass, texture);
+}
+
+void FrameGraph::SetSideEffect(u32 pass)
+{
+    passes[pass].sideEffect = true;
+}
+
+void FrameGraph::CullPasses()
+{
+    // Reference counts as readers of a resource and written resources of a pass. Resources
+    // nobody reads release their writers, which release what they read in turn
+    for (FrameGraphPass& pass : passes)
+    {
+        pass.culled = false;
+        pass.refCount = pass.writes.size();
+        for (FrameGraphResource resource : pass.reads)
+            resources[resource].readerCount++;
+    }
+
+    std::vector<FrameGraphResource> unread;
+    for (u32 i = 0; i < resources.size(); ++i)
+    {
+        if (resources[i].readerCount == 0)
+            unread.push_back(i);
+    }
+
+    while (!unread.empty())
+    {
+        const FrameGraphResource resource = unread.back();
+        unread.pop_back();
+
+        for (FrameGraphPass& pass : passes)
+        {
+            if (pass.culled || pass.sideEffect || std::find(pass.writes.begin(), pass.writes.end(), resource) == pass.writes.end())
+                continue;
+
+            if (--pass.refCount > 0)
+                continue;
+
+            pass.culled = true;
+            for (FrameGraphResource read : pass.reads)
+            {
+                if (--resources[read].readerCount == 0)
+                    unread.push_back(read);
+            }
+        }
+    }
+}
+
+void FrameGraph::AssignTextures()
+{
+    for (u32 i = 0; i < passes.size(); ++i)
+    {
+        if (passes[i].culled)
+            continue;
+
+        auto extend = [&](FrameGraphResource resource)
+        {
+            FrameGraphResourceNode& node = resources[resource];
+            node.firstPass = glm::min(node.firstPass, i);
+            node.lastPass = i;
+        };
+        for (FrameGraphResource resource : passes[i].reads)
+            extend(resource);
+        for (FrameGraphResource resource : passes[i].writes)
+            extend(resource);
+    }
+
+    // In order of first use, each transient takes the first pooled texture of its format and size already
+    // released by the resources before it, which is what keeps the pool at the peak of live targets
+    std::vector<FrameGraphResource> transients;
+    for (u32 i = 0; i < resources.size(); ++i)
+    {
+        if (!resources[i].imported && resources[i].firstPass != FRAME_GRAPH_NONE)
+            transients.push_back(i);
+    }
+    std::stable_sort(transients.begin(), transients.end(), [&](FrameGraphResource a, FrameGraphResource b) { return resources[a].firstPass < resources[b].firstPass; });
+
+    for (FrameGraphTexture& texture : pool)
+        texture.busyUntilPass = -1;
+
+    requestedBytes = 0;
+    for (FrameGraphResource resource : transients)
+    {
+        FrameGraphResourceNode& node = resources[resource];
+        requestedBytes += (u64)node.size.x * node.size.y * GetTexelBytes(node.internalFormat);
+
+        FrameGraphTexture* texture = nullptr;
+        for (FrameGraphTexture& candidate : pool)
+        {
+            if (candidate.internalFormat == node.internalFormat && candidate.size == node.size && candidate.busyUntilPass < (i32)node.firstPass)
+            {
+                texture = &candidate;
+                break;
+            }
+        }
+
+        if (texture == nullptr)
+        {
+            FrameGraphTexture created = {};
+            created.size = node.size;
+            created.internalFormat = node.internalFormat;
+            created.bytes = node.size.x * node.size.y * GetTexelBytes(node.internalFormat);
+
+            glGenTextures(1, &created.handle);
+            glBindTexture(GL_TEXTURE_2D, created.handle);
+            glTexStorage2D(GL_TEXTURE_2D, 1, node.internalFormat, node.size.x, node.size.y);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            pool.push_back(created);
+            texture = &pool.back();
+        }
+
+        texture->busyUntilPass = node.lastPass;
+        texture->lastUsedFrame = frameIndex;
+        node.handle = texture->handle;
+    }
+
+    // Textures left over by targets that went away, after a mode switch or a new size for instance
+    bool deleted = false;
+    for (u32 i = 0; i < pool.size();)
+    {
+        if (frameIndex - pool[i].lastUsedFrame > FRAME_GRAPH_MAX_IDLE_FRAMES)
+        {
+            glDeleteTextures(1, &pool[i].handle);
+            pool[i] = pool.back();
+            pool.pop_back();
+            deleted = true;
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    // GL hands the names of deleted textures out again, a cached framebuffer could match a new one
+    if (deleted)
+    {
+        for (const auto& framebuffer : framebuffers)
+            glDeleteFramebuffers(1, &framebuffer.second);
+        framebuffers.clear();
+    }
+}
+
+GLuint FrameGraph::FindFramebuffer(const FrameGraphPass& pass)
+{
+    std::vector<GLuint> attachments;
+    for (FrameGraphResource texture : pass.colorAttachments)
+        attachments.push_back(resources[texture].handle);
+    attachments.push_back(pass.depthAttachment != FRAME_GRAPH_NONE ? resources[pass.depthAttachment].handle : 0);
+
+    auto found = framebuffers.find(attachments);
+    if (found != framebuffers.end())
+        return found->second;
+
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    std::vector<GLenum> drawBuffers;
+    for (u32 i = 0; i < pass.colorAttachments.size(); ++i)
+    {
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, attachments[i], 0);
+        drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+    }
+    if (attachments.back() != 0)
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, attachments.back(), 0);
+
+    // The draw buffers are part of the framebuffer state, set once here
+    glDrawBuffers(drawBuffers.size(), drawBuffers.data());
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        ELOG("Framebuffer of pass %s is incomplete", pass.name);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    framebuffers[attachments] = framebuffer;
+    return framebuffer;
+}
+
+bool FrameGraph::WritesBackBuffer(const FrameGraphPass& pass) const
+{
+    for (FrameGraphResource resource : pass.writes)
+    {
+        if (resources[resource].type == FrameGraphResource_BackBuffer)
+            return true;
+    }
+    return false;
+}
+
+void FrameGraph::Compile()
+{
+    CullPasses();
+    AssignTextures();
+
+    for (FrameGraphPass& pass : passes)
+    {
+        const bool hasAttachments = !pass.colorAttachments.empty() || pass.depthAttachment != FRAME_GRAPH_NONE;
+        pass.framebuffer = (!pass.culled && hasAttachments) ? FindFramebuffer(pass) : 0;
+
+        pass.viewport = size;
+        if (!pass.colorAttachments.empty())
+            pass.viewport = resources[pass.colorAttachments[0]].size;
+        else if (pass.depthAttachment != FRAME_GRAPH_NONE)
+            pass.viewport = resources[pass.depthAttachment].size;
+    }
+}
+
+void FrameGraph::Execute(GpuProfiler* profiler)
+{
+    for (u32 i = 0; i < passes.size(); ++i)
+    {
+        const FrameGraphPass& pass = passes[i];
+        if (pass.culled)
+            continue;
+
+        // Compute only passes keep whatever is bound
+        if (pass.framebuffer != 0 || WritesBackBuffer(pass))
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+            glViewport(0, 0, pass.viewport.x, pass.viewport.y);
+        }
+
+        const u32 scope = profiler ? profiler->BeginScope(pass.name) : 0;
+        pass.execute(*this, i);
+        if (profiler)
+            profiler->EndScope(scope);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void FrameGraph::Release()
+{
+    for (const auto& framebuffer : framebuffers)
+        glDeleteFramebuffers(1, &framebuffer.second);
+    framebuffers.clear();
+
+    for (const FrameGraphTexture& texture : pool)
+        glDeleteTextures(1, &texture.handle);
+    pool.clear();
+}
+
+u64 FrameGraph::GetPooledBytes() const
+{
+    u64 bytes = 0;
+    for (const FrameGraphTexture& texture : pool)
+        bytes += texture.bytes;
+    return bytes;
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Globals.h"
+#include "GpuProfiler.h"
+#include <functional>
+#include <map>
+
+// Frames pooled textures stay around unused before they are deleted
+#define FRAME_GRAPH_MAX_IDLE_FRAMES 8
+
+#define FRAME_GRAPH_NONE UINT32_MAX
+
+typedef u32 FrameGraphResource;
+
+enum FrameGraphResourceType
+{
+    FrameGraphResource_Texture,
+    FrameGraphResource_Buffer,
+    FrameGraphResource_BackBuffer
+};
+
+struct FrameGraphResourceNode
+{
+    const char* name;
+    FrameGraphResourceType type;
+    GLenum internalFormat; // Transient textures
+    ivec2 size;
+    bool imported;
+    GLuint handle;         // Given when imported, taken from the pool once compiled otherwise
+    u32 readerCount;
+    u32 firstPass;         // Lifetime among the passes left after culling
+    u32 lastPass;
+};
+
+class FrameGraph;
+
+// Runs with the attachments of the pass bound, or the back buffer when it writes it
+typedef std::function<void(const FrameGraph& graph, u32 pass)> FrameGraphExecute;
+
+struct FrameGraphPass
+{
+    const char* name;
+    FrameGraphExecute execute;
+    std::vector<FrameGraphResource> reads;
+    std::vector<FrameGraphResource> writes;
+    std::vector<FrameGraphResource> colorAttachments;
+    FrameGraphResource depthAttachment;
+    bool sideEffect; // Kept even when nothing in the frame reads what it writes
+    bool culled;
+    u32 refCount;
+    GLuint framebuffer;
+    ivec2 viewport; // Of its attachments, the frame size without any
+};
+
+struct FrameGraphTexture
+{
+    GLuint handle;
+    ivec2 size;
+    GLenum internalFormat;
+    u32 bytes;
+    i32 busyUntilPass; // Last pass of the resource it holds in the frame being compiled
+    u64 lastUsedFrame;
+};
+
+// Render passes declared every frame along the resources they read and write. Compiling
+// culls the passes nobody depends on, then gives every transient texture a pooled one of
+// the same format and size, shared with the resources whose lifetimes don't overlap with its own.
+// GL has no placement of textures in memory, so textures alias as a whole. The pool is
+// dropped when the frame size changes, and textures idle for a few frames are deleted
+class FrameGraph
+{
+public:
+
+    void Begin(ivec2 size);
+
+    FrameGraphResource CreateTexture(const char* name, GLenum internalFormat);
+    FrameGraphResource CreateTexture(const char* name, GLenum internalFormat, ivec2 size);
+    FrameGraphResource ImportTexture(const char* name, GLuint handle);
+    FrameGraphResource ImportBuffer(const char* name, GLuint handle);
+    FrameGraphResource ImportBackBuffer();
+
+    u32 AddPass(const char* name, FrameGraphExecute execute);
+    void Read(u32 pass, FrameGraphResource resource);
+    void Write(u32 pass, FrameGraphResource resource);
+    void AddColorAttachment(u32 pass, FrameGraphResource texture);
+    void SetDepthAttachment(u32 pass, FrameGraphResource texture);
+    void SetSideEffect(u32 pass);
+
+    void Compile();
+
+    // Each pass is timed in a scope of its name when given a profiler
+    void Execute(GpuProfiler* profiler = nullptr);
+
+    // Deletes every pooled texture and framebuffer
+    void Release();
+
+    GLuint GetTexture(FrameGraphResource resource) const { return resources[resource].handle; }
+    GLuint GetFramebuffer(u32 pass) const { return passes[pass].framebuffer; }
+    ivec2 GetSize() const { return size; }
+
+    const std::vector<FrameGraphPass>& GetPasses() const { return passes; }
+    u32 GetPooledTextureCount() const { return pool.size(); }
+
+    // Bytes of the pooled textures, and of the transient textures of the frame if none were shared
+    u64 GetPooledBytes() const;
+    u64 GetRequestedBytes() const { return requestedBytes; }
+
+private:
+
+    FrameGraphResource AddResource(const char* name, FrameGraphResourceType type, GLenum internalFormat, ivec2 size, GLuint handle);
+    void CullPasses();
+    void AssignTextures();
+    GLuint FindFramebuffer(const FrameGraphPass& pass);
+    bool WritesBackBuffer(const FrameGraphPass& pass) const;
+
+    ivec2 size = ivec2(0);
+    u64 frameIndex = 0;
+    std::vector<FrameGraphResourceNode> resources;
+    std::vector<FrameGraphPass> passes;
+    std::vector<FrameGraphTexture> pool;
+    std::map<std::vector<GLuint>, GLuint> framebuffers; // By attachments, the depth one last
+    u64 requestedBytes = 0;
+};
\ No newline at end of file
@@ -56,11 +56,23 @@ struct Input {
     glm::vec2   mouseDelta;
     ButtonState mouseButtons[MOUSE_BUTTON_COUNT];
     ButtonState keys[KEY_COUNT];
-}; struct VertexBufferAttribute
+};
+
+// Storage type of a vertex attribute, the shaders always see floats
+enum VertexFormat : u8
+{
+    VertexFormat_Float,
+    VertexFormat_Half,
+    VertexFormat_SNorm16,
+    VertexFormat_SNorm10_10_10_2, // Always 4 components, w has 2 bits
+};
+
+struct VertexBufferAttribute
 {
     u8 location;
     u8 componentCount;
     u8 offset;
+    VertexFormat format;
 };
 
 struct VertexBufferLayout
@@ -80,6 +92,53 @@ struct VertexShaderLayout
     std::vector<VertexShaderAttribute> attributes;
 };
 
+// Uniforms the render code sets, resolved once per program at link time
+enum ProgramUniform
+{
+    Uniform_Texture,
+    Uniform_Albedo,
+    Uniform_Normals,
+    Uniform_Position,
+    Uniform_ViewDir,
+    Uniform_Depth,
+    Uniform_VolumeScale,
+    Uniform_Dequantization,
+    Uniform_Source,
+    Uniform_SourceLevel,
+    Uniform_FromDepth,
+    Uniform_Phase,
+    Uniform_InstanceCount,
+    Uniform_CommandCount,
+    Uniform_CullViewProjection,
+    Uniform_PyramidValid,
+    Uniform_PyramidLevels,
+    Uniform_DepthPyramid,
+    Uniform_Count
+};
+
+struct ShaderUniform
+{
+    std::string name;
+    GLint       location;
+    GLenum      type;
+    GLint       arraySize;
+    i32         textureUnit; // -1 unless it is a sampler
+};
+
+struct ShaderBlock
+{
+    std::string name;
+    GLint       binding;
+    GLint       dataSize;
+};
+
+struct ShaderReflection
+{
+    std::vector<ShaderUniform> uniforms;
+    std::vector<ShaderBlock>   uniformBlocks;
+    std::vector<ShaderBlock>   storageBlocks;
+};
+
 struct VAO
 {
     GLuint handle;
@@ -92,6 +151,14 @@ struct String
     u32   len;
 };
 
+struct MappedFile
+{
+    const u8* data;
+    u64       size;
+    void*     fileHandle;    // Only used by the Windows mapping
+    void*     mappingHandle;
+};
+
 struct Image
 {
     void* pixels;
@@ -111,8 +178,25 @@ struct Program
     GLuint             handle;
     std::string        filepath;
     std::string        programName;
-    u64                lastWriteTimestamp; // What is this for?
+    std::string        defines;
+    u64                lastWriteTimestamp; // Hot reload
     VertexShaderLayout shaderLayout;
+    ShaderReflection   reflection;
+    GLint              uniformLocations[Uniform_Count]; // -1 when the program does not use it
+    i32                textureUnits[Uniform_Count];     // Sampler units, set once at link time
+    bool               isCompute;
+    bool               ready;             // handle holds a linked program
+    GLuint             pendingHandle;     // Still compiling, replaces handle once linked
+    GLuint             pendingShaders[2];
+    u64                binaryHash;        // Program cache key
+    f32                compileTime;       // Main thread ms, stored along the cached binary
+};
+
+struct ProgramCacheStats
+{
+    u32 hits;
+    u32 misses;
+    f32 timeSaved; // ms
 };
 
 struct Model
@@ -121,22 +205,123 @@ struct Model
     std::vector<u32> materialIdx;
 };
 
+struct AABB
+{
+    vec3 min;
+    vec3 max;
+};
+
+struct BoundingSphere
+{
+    vec3 center;
+    f32 radius;
+};
+
+// Simplified versions of a submesh, all indexing its vertices
+#define MAX_MESH_LODS 8
+
+struct MeshLod
+{
+    u32 firstIndex; // Relative to the submesh indices
+    u32 indexCount;
+    f32 error;      // Object space distance to the full mesh surface
+};
+
+// Small pieces of LOD 0 culled on their own by the meshlet culling pass,
+// sized so a meshlet fits the on chip budget mesh shaders would give it
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// std430 layout, baked with the bounds in the quantized space of the mesh vertices
+struct Meshlet
+{
+    vec3 center;
+    f32 radius;
+    vec3 coneAxis;   // Average normal
+    f32 coneCutoff;  // Back facing when dot(center - eye, axis) >= cutoff * |center - eye| + radius
+    u32 firstIndex;  // Relative to the submesh indices
+    u32 triangleCount;
+    u32 padding[2];
+};
+
+// Efficiency of a triangle list, see MeshOptimizer::AnalyzeMesh
+struct MeshStats
+{
+    f32 acmr;      // Vertex shader invocations per triangle
+    f32 atvr;      // Vertex shader invocations per vertex
+    f32 overdraw;  // Fragments shaded per covered pixel
+    f32 overfetch; // Bytes fetched per byte of vertex buffer
+};
+
 struct SubMesh
 {
     VertexBufferLayout vertexBufferLayout;
-    std::vector<float> vertices;
-    std::vector<u32> indices;
-    u32 vertexOffset;
-    u32 indexOffset;
 
-    std::vector<VAO> vaos;
+    // Interleaved vertices and their indices, inside the mapped baked file of the mesh.
+    // Indices are u16 when the submesh has few enough vertices
+    const u8* vertexData;
+    const void* indexData;
+    u32 vertexCount;
+    u32 indexCount;
+    u32 indexSize;
+
+    // Location inside the geometry pool of its vertex format
+    u32 poolIdx;
+    u32 baseVertex;
+    u32 firstIndex;
+
+    // Object space bounds
+    AABB aabb;
+    BoundingSphere sphere;
+
+    // As imported and as baked by the mesh optimizer
+    MeshStats importStats;
+    MeshStats bakeStats;
+
+    // LOD 0 is the full mesh, the indices hold every LOD one after the other
+    MeshLod lods[MAX_MESH_LODS];
+    u32 lodCount;
+
+    // Meshlets of LOD 0, firstMeshlet locates them inside the meshlet buffer
+    const Meshlet* meshletData;
+    u32 meshletCount;
+    u32 firstMeshlet;
 };
 
 struct Mesh
 {
+    std::string name;
     std::vector<SubMesh> subMeshes;
+
+    // Stays mapped, the submeshes point into it
+    MappedFile bakedFile;
+
+    // Positions are stored as snorm16, object space position = xyz + position * w
+    vec4 dequantization;
+
+    // Largest error of every LOD among the submeshes, submeshes with fewer LODs use their last one
+    f32 lodErrors[MAX_MESH_LODS];
+    u32 lodCount;
+
+    // Object space bounds enclosing every submesh
+    AABB aabb;
+    BoundingSphere sphere;
+};
+
+// Every submesh with the same vertex format packed into a single vertex and index
+// buffer, so one VAO and one indirect draw can reach all of them
+struct GeometryPool
+{
+    VertexBufferLayout vertexBufferLayout;
+    u32 indexSize;
     GLuint vertexBufferHandle;
     GLuint indexBufferHandle;
+    u32 vertexCount;
+    u32 indexCount;
+    u32 vertexCapacity;
+    u32 indexCapacity;
+
+    std::vector<VAO> vaos;
 };
 
 struct Material
@@ -159,12 +344,22 @@ enum Mode
     Mode_Count
 };
 
+enum GBufferLayout
+{
+    GBufferLayout_Full,     // Albedo, Normals, Position, ViewDir and Depth targets
+    GBufferLayout_Compact,  // Albedo and octahedral Normals, the rest comes from depth
+    GBufferLayout_Count
+};
+
 struct VertexV3V2
 {
     glm::vec3 pos;
     glm::vec2 uv;
 };
 
+// Frames the CPU may run ahead of the GPU when writing ring buffers
+#define RING_BUFFER_FRAMES 3
+
 struct Buffer
 {
     GLsizei size;
@@ -172,14 +367,69 @@ struct Buffer
     GLuint handle;
     u8* data;
     u32 head;
+
+    // Ring buffers only, one region per frame in flight
+    bool isPersistent;
+    u32 regionSize;
+    u32 regionStart;
+    bool overflowed; // A push didn't fit, the rest of the region is dropped
 };
 
 struct Entity
 {
     glm::mat4 worldMatrix;
     u32 modelIndex;
-    u32 localParamsOffset;
-    u32 localParamSize;
+    u32 bvhProxy;
+    u32 lod;
+};
+
+// Entities sharing a model and LOD, stored contiguously in the instance buffer
+struct InstanceGroup
+{
+    u32 modelIndex;
+    u32 lod;
+    u32 baseInstance;
+    u32 instanceCount;
+};
+
+// World bounds of an instance for the occlusion culling pass, std430 layout
+struct InstanceBounds
+{
+    vec3 min;
+    u32 baseInstance;   // first instance of its group
+    vec3 max;
+    u32 padding;
+};
+
+// Work of one meshlet culling group, up to MESHLET_CULL_GROUP_SIZE meshlets of an instance, std430 layout
+struct MeshletJob
+{
+    u32 instanceIdx;
+    u32 firstMeshlet;  // Inside the meshlet buffer
+    u32 meshletCount;
+    u32 firstCommand;  // One command per meshlet
+    u32 firstIndex;    // Of the submesh inside its geometry pool
+    i32 baseVertex;
+    u32 padding[2];
+};
+
+// Command layout read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    i32 baseVertex;
+    u32 baseInstance;
+};
+
+// Consecutive indirect commands sharing a geometry pool and an albedo texture
+struct IndirectBatch
+{
+    u32 poolIdx;
+    u32 albedoTextureIdx;
+    u32 firstCommand;
+    u32 commandCount;
 };
 
 enum LightType
@@ -194,6 +444,8 @@ struct Light
     vec3 color;
     vec3 direction;
     vec3 position;
+    f32 radius;
+    u32 bvhProxy;
 };
 
 struct FrameBuffer
@@ -0,0 +1,160 @@
+#include "GpuProfiler.h"
+#include "platform.h"
+#include <stdio.h>
+
+void GpuProfiler::Init()
+{
+    for (GpuProfilerFrame& frame : frames)
+    {
+        glGenQueries(GPU_PROFILER_MAX_SCOPES * 2, frame.queries);
+        frame.scopeCount = 0;
+        frame.pending = false;
+    }
+}
+
+void GpuProfiler::BeginFrame()
+{
+    currentFrame = (currentFrame + 1) % GPU_PROFILER_FRAMES;
+
+    // Oldest first, the slot about to be recorded again is the oldest. The GPU runs the
+    // frames in order, so none after a frame still running can be done
+    for (u32 i = 0; i < GPU_PROFILER_FRAMES; ++i)
+    {
+        GpuProfilerFrame& frame = frames[(currentFrame + i) % GPU_PROFILER_FRAMES];
+        if (!frame.pending)
+            continue;
+
+        // The end of the frame scope is the last query of the frame
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        Resolve(frame);
+    }
+
+    GpuProfilerFrame& frame = frames[currentFrame];
+    if (frame.pending)
+    {
+        frame.pending = false;
+        droppedFrames++;
+    }
+
+    frame.scopeCount = 0;
+    frame.frameIndex = frameCount++;
+    openDepth = 0;
+    frameScope = BeginScope("Frame");
+}
+
+void GpuProfiler::EndFrame()
+{
+    EndScope(frameScope);
+    frames[currentFrame].pending = true;
+}
+
+u32 GpuProfiler::BeginScope(const char* name)
+{
+    GpuProfilerFrame& frame = frames[currentFrame];
+    if (frame.scopeCount == GPU_PROFILER_MAX_SCOPES)
+        return GPU_PROFILER_MAX_SCOPES;
+
+    const u32 scope = frame.scopeCount++;
+    frame.names[scope] = name;
+    frame.depths[scope] = openDepth++;
+    glQueryCounter(frame.queries[scope * 2], GL_TIMESTAMP);
+    return scope;
+}
+
+void GpuProfiler::EndScope(u32 scope)
+{
+    // Scopes past the limit are not timed
+    if (scope == GPU_PROFILER_MAX_SCOPES)
+        return;
+
+    glQueryCounter(frames[currentFrame].queries[scope * 2 + 1], GL_TIMESTAMP);
+    openDepth--;
+}
+
+void GpuProfiler::Resolve(GpuProfilerFrame& frame)
+{
+    const u32 slot = resolvedFrames % GPU_PROFILER_HISTORY;
+    for (GpuProfilerTrack& track : tracks)
+        track.times[slot] = 0.0f;
+
+    for (u32 scope = 0; scope < frame.scopeCount; ++scope)
+    {
+        GLuint64 begin = 0;
+        GLuint64 end = 0;
+        glGetQueryObjectui64v(frame.queries[scope * 2], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame.queries[scope * 2 + 1], GL_QUERY_RESULT, &end);
+
+        // Names are compared by content, a literal may have an address per translation unit
+        GpuProfilerTrack* track = nullptr;
+        for (GpuProfilerTrack& candidate : tracks)
+        {
+            if (strcmp(candidate.name, frame.names[scope]) == 0)
+            {
+                track = &candidate;
+                break;
+            }
+        }
+        if (track == nullptr)
+        {
+            tracks.push_back({});
+            track = &tracks.back();
+            track->name = frame.names[scope];
+            track->depth = frame.depths[scope];
+        }
+
+        // A scope run twice in a frame adds up
+        track->times[slot] += (f32)((end - begin) / 1000000.0);
+    }
+
+    frame.pending = false;
+    lastResolvedFrame = frame.frameIndex;
+    resolvedFrames++;
+
+    const u32 historyCount = (u32)glm::min(resolvedFrames, (u64)GPU_PROFILER_HISTORY);
+    for (GpuProfilerTrack& track : tracks)
+    {
+        f32 sum = 0.0f;
+        for (u32 i = 0; i < historyCount; ++i)
+            sum += track.times[i];
+        track.average = sum / historyCount;
+    }
+}
+
+f32 GpuProfiler::GetFrameTime() const
+{
+    if (resolvedFrames == 0)
+        return 0.0f;
+
+    return tracks[0].times[(resolvedFrames - 1) % GPU_PROFILER_HISTORY];
+}
+
+bool GpuProfiler::ExportCsv(const char* filename) const
+{
+    FILE* file = fopen(filename, "w");
+    if (file == NULL)
+    {
+        ELOG("fopen() failed writing GPU profile %s", filename);
+        return false;
+    }
+
+    fprintf(file, "frame");
+    for (const GpuProfilerTrack& track : tracks)
+        fprintf(file, ",%s", track.name);
+    fprintf(file, "\n");
+
+    const u64 firstFrame = resolvedFrames - glm::min(resolvedFrames, (u64)GPU_PROFILER_HISTORY);
+    for (u64 frame = firstFrame; frame < resolvedFrames; ++frame)
+    {
+        fprintf(file, "%llu", (unsigned long long)frame);
+        for (const GpuProfilerTrack& track : tracks)
+            fprintf(file, ",%.4f", track.times[frame % GPU_PROFILER_HISTORY]);
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Globals.h"
+
+#define GPU_PROFILER_FRAMES 4       // Frames in flight before the queries of one are issued again
+#define GPU_PROFILER_MAX_SCOPES 32  // Per frame, the frame scope included
+#define GPU_PROFILER_HISTORY 128    // Resolved frames kept per scope for the graph and the export
+
+// Timestamps of the scopes of one frame, two queries per scope
+struct GpuProfilerFrame
+{
+    GLuint queries[GPU_PROFILER_MAX_SCOPES * 2];
+    const char* names[GPU_PROFILER_MAX_SCOPES];
+    u32 depths[GPU_PROFILER_MAX_SCOPES];
+    u32 scopeCount;
+    u64 frameIndex; // Of the frame recorded in it, counting every BeginFrame
+    bool pending;   // Issued and not read back yet
+};
+
+// Milliseconds of a scope over the resolved frames, 0 in the frames it didn't run
+struct GpuProfilerTrack
+{
+    const char* name;
+    u32 depth;
+    f32 times[GPU_PROFILER_HISTORY];
+    f32 average;
+};
+
+// GL_TIMESTAMP queries around named scopes, in a ring of GPU_PROFILER_FRAMES frames. A frame
+// is read back once its last query is available, never waited on; when its queries come
+// round again still pending, it is dropped. The first scope of every frame is the frame itself
+class GpuProfiler
+{
+public:
+
+    void Init();
+
+    // Reads back the frames whose queries are done, then opens the frame scope
+    void BeginFrame();
+    void EndFrame();
+
+    u32 BeginScope(const char* name);
+    void EndScope(u32 scope);
+
+    // Every track, one column each, for the resolved frames still in the history
+    bool ExportCsv(const char* filename) const;
+
+    const std::vector<GpuProfilerTrack>& GetTracks() const { return tracks; }
+    u64 GetResolvedFrames() const { return resolvedFrames; }
+
+    // Index of the frame being recorded, and of the last one read back, dropped frames are skipped
+    u64 GetFrameIndex() const { return frameCount - 1; }
+    u64 GetLastResolvedFrameIndex() const { return lastResolvedFrame; }
+    u32 GetDroppedFrames() const { return droppedFrames; }
+
+    // Of the last resolved frame
+    f32 GetFrameTime() const;
+
+private:
+
+    void Resolve(GpuProfilerFrame& frame);
+
+    GpuProfilerFrame frames[GPU_PROFILER_FRAMES];
+    u32 currentFrame = 0;
+    u32 openDepth = 0;
+    u32 frameScope = 0;
+    std::vector<GpuProfilerTrack> tracks; // In the order scopes were first seen
+    u64 resolvedFrames = 0;
+    u64 frameCount = 0;
+    u64 lastResolvedFrame = 0;
+    u32 droppedFrames = 0;
+};
\ No newline at end of file
@@ -0,0 +1,574 @@
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cfloat>
+
+#define VERTEX_CACHE_SIZE 32           // Modelled by the Forsyth scores
+#define ANALYZER_CACHE_SIZE 16         // FIFO the analyzer and the cluster split simulate
+#define OVERDRAW_VIEWPORT 256
+#define FETCH_CACHE_LINE 64
+#define FETCH_CACHE_LINES 256
+
+static f32 ScoreVertex(i32 cachePosition, u32 remainingTriangles)
+{
+    // No triangles left, the vertex must not attract any
+    if (remainingTriangles == 0)
+        return -1.0f;
+
+    f32 score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // The vertices of the last triangle score the same whatever their order
+        if (cachePosition < 3)
+            score = 0.75f;
+        else
+            score = powf(1.0f - (cachePosition - 3) / (f32)(VERTEX_CACHE_SIZE - 3), 1.5f);
+    }
+
+    // Vertices with few triangles left are finished first, so they leave the cache for good
+    return score + 2.0f * powf((f32)remainingTriangles, -0.5f);
+}
+
+// Simulates a FIFO of ANALYZER_CACHE_SIZE entries, misses[t] gets the misses of triangle t when given
+static u32 CountCacheMisses(const u32* indices, u32 indexCount, u32 vertexCount, u8* misses)
+{
+    std::vector<u32> timestamps(vertexCount, 0);
+    u32 time = ANALYZER_CACHE_SIZE + 1;
+    u32 totalMisses = 0;
+
+    for (u32 i = 0; i < indexCount; i += 3)
+    {
+        u32 triangleMisses = 0;
+        for (u32 k = 0; k < 3; ++k)
+        {
+            const u32 v = indices[i + k];
+            if (time - timestamps[v] > ANALYZER_CACHE_SIZE)
+            {
+                timestamps[v] = time++;
+                triangleMisses++;
+            }
+        }
+
+        if (misses)
+            misses[i / 3] = triangleMisses;
+        totalMisses += triangleMisses;
+    }
+
+    return totalMisses;
+}
+
+static vec3 GetVertexPosition(const f32* positions, u32 positionStride, u32 v)
+{
+    return glm::make_vec3(positions + v * positionStride);
+}
+
+// Half space rasterization with a depth test, every fragment that passes counts as shaded
+static void RasterizeTriangle(vec3 v0, vec3 v1, vec3 v2, std::vector<f32>& depth, u32& shaded)
+{
+    auto edge = [](vec3 a, vec3 b, vec2 p) { return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x); };
+
+    const f32 area = edge(v0, v1, vec2(v2));
+    if (area <= 0.0f)
+        return;
+
+    const i32 minX = glm::max((i32)floorf(glm::min(glm::min(v0.x, v1.x), v2.x)), 0);
+    const i32 minY = glm::max((i32)floorf(glm::min(glm::min(v0.y, v1.y), v2.y)), 0);
+    const i32 maxX = glm::min((i32)ceilf(glm::max(glm::max(v0.x, v1.x), v2.x)), OVERDRAW_VIEWPORT - 1);
+    const i32 maxY = glm::min((i32)ceilf(glm::max(glm::max(v0.y, v1.y), v2.y)), OVERDRAW_VIEWPORT - 1);
+
+    for (i32 y = minY; y <= maxY; ++y)
+    {
+        for (i32 x = minX; x <= maxX; ++x)
+        {
+            const vec2 p = vec2(x + 0.5f, y + 0.5f);
+            const f32 w0 = edge(v1, v2, p);
+            const f32 w1 = edge(v2, v0, p);
+            const f32 w2 = edge(v0, v1, p);
+            if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                continue;
+
+            const f32 z = (w0 * v0.z + w1 * v1.z + w2 * v2.z) / area;
+            f32& pixelDepth = depth[y * OVERDRAW_VIEWPORT + x];
+            if (z < pixelDepth)
+            {
+                pixelDepth = z;
+                shaded++;
+            }
+        }
+    }
+}
+
+namespace MeshOptimizer
+{
+    void OptimizeVertexCache(u32* indices, u32 indexCount, u32 vertexCount)
+    {
+        const u32 triangleCount = indexCount / 3;
+        if (triangleCount == 0)
+            return;
+
+        // Triangles of every vertex, one range per vertex in a single array. The range
+        // shrinks as triangles are emitted so it only holds the remaining ones
+        std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+        for (u32 i = 0; i < indexCount; ++i)
+            adjacencyOffsets[indices[i] + 1]++;
+        for (u32 v = 0; v < vertexCount; ++v)
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+
+        std::vector<u32> adjacency(indexCount);
+        std::vector<u32> remaining(vertexCount, 0);
+        for (u32 i = 0; i < indexCount; ++i)
+        {
+            const u32 v = indices[i];
+            adjacency[adjacencyOffsets[v] + remaining[v]++] = i / 3;
+        }
+
+        std::vector<i32> cachePositions(vertexCount, -1);
+        std::vector<f32> vertexScores(vertexCount);
+        for (u32 v = 0; v < vertexCount; ++v)
+            vertexScores[v] = ScoreVertex(-1, remaining[v]);
+
+        std::vector<f32> triangleScores(triangleCount);
+        for (u32 t = 0; t < triangleCount; ++t)
+            triangleScores[t] = vertexScores[indices[t * 3 + 0]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+        std::vector<u8> emitted(triangleCount, 0);
+        std::vector<u32> result;
+        result.reserve(indexCount);
+
+        u32 cache[VERTEX_CACHE_SIZE + 3];
+        u32 cacheCount = 0;
+        u32 cursor = 0;
+        i32 best = (i32)(std::max_element(triangleScores.begin(), triangleScores.end()) - triangleScores.begin());
+
+        for (u32 emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+        {
+            // Nothing in the cache has triangles left, go on with the next one in the original order
+            if (best < 0)
+            {
+                while (emitted[cursor])
+                    cursor++;
+                best = cursor;
+            }
+
+            const u32* triangle = indices + best * 3;
+            emitted[best] = 1;
+            result.insert(result.end(), triangle, triangle + 3);
+
+            for (u32 k = 0; k < 3; ++k)
+            {
+                const u32 v = triangle[k];
+                u32* triangles = adjacency.data() + adjacencyOffsets[v];
+                for (u32 j = 0; j < remaining[v]; ++j)
+                {
+                    if (triangles[j] == (u32)best)
+                    {
+                        triangles[j] = triangles[remaining[v] - 1];
+                        break;
+                    }
+                }
+                remaining[v]--;
+            }
+
+            // The triangle goes to the front of the LRU cache, the entries past its size are evicted
+            u32 newCache[VERTEX_CACHE_SIZE + 3];
+            u32 newCacheCount = 3;
+            newCache[0] = triangle[0];
+            newCache[1] = triangle[1];
+            newCache[2] = triangle[2];
+            for (u32 i = 0; i < cacheCount; ++i)
+            {
+                const u32 v = cache[i];
+                if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                    newCache[newCacheCount++] = v;
+            }
+
+            // Rescoring the vertices that moved updates every triangle they still have
+            for (u32 i = 0; i < newCacheCount; ++i)
+            {
+                const u32 v = newCache[i];
+                cachePositions[v] = i < VERTEX_CACHE_SIZE ? (i32)i : -1;
+
+                const f32 score = ScoreVertex(cachePositions[v], remaining[v]);
+                const f32 delta = score - vertexScores[v];
+                vertexScores[v] = score;
+
+                const u32* triangles = adjacency.data() + adjacencyOffsets[v];
+                for (u32 j = 0; j < remaining[v]; ++j)
+                    triangleScores[triangles[j]] += delta;
+            }
+
+            cacheCount = glm::min(newCacheCount, (u32)VERTEX_CACHE_SIZE);
+            memcpy(cache, newCache, cacheCount * sizeof(u32));
+
+            // The next triangle is the best one reachable from the cache
+            best = -1;
+            f32 bestScore = -FLT_MAX;
+            for (u32 i = 0; i < cacheCount; ++i)
+            {
+                const u32 v = cache[i];
+                const u32* triangles = adjacency.data() + adjacencyOffsets[v];
+                for (u32 j = 0; j < remaining[v]; ++j)
+                {
+                    if (triangleScores[triangles[j]] > bestScore)
+                    {
+                        bestScore = triangleScores[triangles[j]];
+                        best = triangles[j];
+                    }
+                }
+            }
+        }
+
+        memcpy(indices, result.data(), indexCount * sizeof(u32));
+    }
+
+    void OptimizeOverdraw(u32* indices, u32 indexCount, const f32* positions, u32 vertexCount, u32 positionStride, f32 threshold)
+    {
+        const u32 triangleCount = indexCount / 3;
+        if (triangleCount < 2)
+            return;
+
+        std::vector<u8> misses(triangleCount);
+        const u32 totalMisses = CountCacheMisses(indices, indexCount, vertexCount, misses.data());
+
+        // Hard boundaries where the cache restarts, then soft ones inside them wherever
+        // the cluster so far is already as cache efficient as the threshold allows
+        std::vector<u32> clusterStarts;
+        for (u32 t = 0; t < triangleCount; ++t)
+        {
+            if (t == 0 || misses[t] == 3)
+                clusterStarts.push_back(t);
+        }
+        clusterStarts.push_back(triangleCount);
+
+        std::vector<u32> softStarts;
+        for (u32 c = 0; c + 1 < clusterStarts.size(); ++c)
+        {
+            const u32 start = clusterStarts[c];
+            const u32 end = clusterStarts[c + 1];
+            u32 clusterMisses = 0;
+            for (u32 t = start; t < end; ++t)
+                clusterMisses += misses[t];
+            const f32 clusterACMR = clusterMisses / (f32)(end - start);
+
+            u32 softStart = start;
+            u32 softMisses = 0;
+            softStarts.push_back(start);
+            for (u32 t = start; t + 1 < end; ++t)
+            {
+                softMisses += misses[t];
+                const u32 softTriangles = t - softStart + 1;
+                if (softTriangles >= 16 && softMisses / (f32)softTriangles <= clusterACMR * threshold)
+                {
+                    softStart = t + 1;
+                    softMisses = 0;
+                    softStarts.push_back(softStart);
+                }
+            }
+        }
+        softStarts.push_back(triangleCount);
+
+        // Area weighted centroid and normal of every cluster and of the whole mesh
+        const u32 clusterCount = softStarts.size() - 1;
+        std::vector<vec3> clusterCentroids(clusterCount, vec3(0.0f));
+        std::vector<vec3> clusterNormals(clusterCount, vec3(0.0f));
+        vec3 meshCentroid = vec3(0.0f);
+        f32 meshArea = 0.0f;
+        for (u32 c = 0; c < clusterCount; ++c)
+        {
+            f32 clusterArea = 0.0f;
+            for (u32 t = softStarts[c]; t < softStarts[c + 1]; ++t)
+            {
+                const vec3 p0 = GetVertexPosition(positions, positionStride, indices[t * 3 + 0]);
+                const vec3 p1 = GetVertexPosition(positions, positionStride, indices[t * 3 + 1]);
+                const vec3 p2 = GetVertexPosition(positions, positionStride, indices[t * 3 + 2]);
+                const vec3 normal = glm::cross(p1 - p0, p2 - p0);
+                const f32 area = glm::length(normal);
+
+                clusterCentroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+                clusterNormals[c] += normal;
+                clusterArea += area;
+            }
+
+            meshCentroid += clusterCentroids[c];
+            meshArea += clusterArea;
+            clusterCentroids[c] = clusterArea > 0.0f ? clusterCentroids[c] / clusterArea : clusterCentroids[c];
+        }
+        meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : meshCentroid;
+
+        // Clusters on the outside of the mesh, facing away from its center, occlude the rest
+        std::vector<f32> sortKeys(clusterCount);
+        std::vector<u32> clusterOrder(clusterCount);
+        for (u32 c = 0; c < clusterCount; ++c)
+        {
+            const f32 normalLength = glm::length(clusterNormals[c]);
+            const vec3 normal = normalLength > 0.0f ? clusterNormals[c] / normalLength : vec3(0.0f);
+            sortKeys[c] = glm::dot(clusterCentroids[c] - meshCentroid, normal);
+            clusterOrder[c] = c;
+        }
+        std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&](u32 a, u32 b) { return sortKeys[a] > sortKeys[b]; });
+
+        std::vector<u32> result;
+        result.reserve(indexCount);
+        for (u32 c : clusterOrder)
+            result.insert(result.end(), indices + softStarts[c] * 3, indices + softStarts[c + 1] * 3);
+
+        if (CountCacheMisses(result.data(), indexCount, vertexCount, nullptr) <= totalMisses * threshold)
+            memcpy(indices, result.data(), indexCount * sizeof(u32));
+    }
+
+    u32 OptimizeVertexFetch(f32* vertices, u32* indices, u32 indexCount, u32 vertexCount, u32 vertexStride)
+    {
+        std::vector<u32> remap(vertexCount, UINT32_MAX);
+        u32 usedVertexCount = 0;
+        for (u32 i = 0; i < indexCount; ++i)
+        {
+            u32& newIndex = remap[indices[i]];
+            if (newIndex == UINT32_MAX)
+                newIndex = usedVertexCount++;
+            indices[i] = newIndex;
+        }
+
+        std::vector<f32> reordered(usedVertexCount * vertexStride);
+        for (u32 v = 0; v < vertexCount; ++v)
+        {
+            if (remap[v] != UINT32_MAX)
+                memcpy(reordered.data() + remap[v] * vertexStride, vertices + v * vertexStride, vertexStride * sizeof(f32));
+        }
+
+        memcpy(vertices, reordered.data(), reordered.size() * sizeof(f32));
+        return usedVertexCount;
+    }
+
+    static void ComputeMeshletBounds(Meshlet& meshlet, const u32* indices, const f32* positions, u32 positionStride)
+    {
+        AABB aabb = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+        vec3 normalSum = vec3(0.0f);
+        std::vector<vec3> normals;
+        for (u32 t = 0; t < meshlet.triangleCount; ++t)
+        {
+            const u32* triangle = indices + meshlet.firstIndex + t * 3;
+            const vec3 p0 = GetVertexPosition(positions, positionStride, triangle[0]);
+            const vec3 p1 = GetVertexPosition(positions, positionStride, triangle[1]);
+            const vec3 p2 = GetVertexPosition(positions, positionStride, triangle[2]);
+            aabb.min = glm::min(glm::min(aabb.min, p0), glm::min(p1, p2));
+            aabb.max = glm::max(glm::max(aabb.max, p0), glm::max(p1, p2));
+
+            // Degenerate triangles can't be seen from any side, they don't narrow the cone
+            const vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            const f32 length = glm::length(normal);
+            if (length > 0.0f)
+            {
+                normals.push_back(normal / length);
+                normalSum += normal / length;
+            }
+        }
+
+        meshlet.center = (aabb.min + aabb.max) * 0.5f;
+        meshlet.radius = 0.0f;
+        for (u32 i = 0; i < meshlet.triangleCount * 3; ++i)
+        {
+            const vec3 position = GetVertexPosition(positions, positionStride, indices[meshlet.firstIndex + i]);
+            meshlet.radius = glm::max(meshlet.radius, glm::distance(meshlet.center, position));
+        }
+
+        // The cone holds every normal, a cutoff of 1 never culls
+        meshlet.coneAxis = glm::length(normalSum) > 0.0f ? glm::normalize(normalSum) : vec3(0.0f, 0.0f, 1.0f);
+        f32 minDot = normals.empty() ? -1.0f : 1.0f;
+        for (const vec3& normal : normals)
+            minDot = glm::min(minDot, glm::dot(normal, meshlet.coneAxis));
+        meshlet.coneCutoff = minDot <= 0.1f ? 1.0f : sqrtf(1.0f - minDot * minDot);
+    }
+
+    void BuildMeshlets(u32* indices, u32 indexCount, const f32* positions, u32 vertexCount, u32 positionStride, u32 maxVertices, u32 maxTriangles, std::vector<Meshlet>& meshlets)
+    {
+        const u32 triangleCount = indexCount / 3;
+        meshlets.clear();
+        if (triangleCount == 0)
+            return;
+
+        std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+        for (u32 i = 0; i < indexCount; ++i)
+            adjacencyOffsets[indices[i] + 1]++;
+        for (u32 v = 0; v < vertexCount; ++v)
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+
+        std::vector<u32> adjacency(indexCount);
+        std::vector<u32> filled(vertexCount, 0);
+        for (u32 i = 0; i < indexCount; ++i)
+        {
+            const u32 v = indices[i];
+            adjacency[adjacencyOffsets[v] + filled[v]++] = i / 3;
+        }
+
+        // Meshlet a vertex was last added to, so the new vertices of a triangle are counted without a set
+        std::vector<u32> vertexMeshlet(vertexCount, UINT32_MAX);
+        std::vector<u8> emitted(triangleCount, 0);
+        std::vector<u32> result;
+        result.reserve(indexCount);
+        std::vector<u32> meshletVertices;
+        meshletVertices.reserve(maxVertices);
+
+        u32 cursor = 0;
+        while (true)
+        {
+            // Seeds follow the optimized order, so the meshlets keep its locality
+            while (cursor < triangleCount && emitted[cursor])
+                ++cursor;
+            if (cursor == triangleCount)
+                break;
+
+            const u32 meshletIdx = meshlets.size();
+            Meshlet meshlet = {};
+            meshlet.firstIndex = result.size();
+            meshletVertices.clear();
+            vec3 centroidSum = vec3(0.0f);
+
+            auto newVertices = [&](u32 t)
+            {
+                u32 count = 0;
+                for (u32 k = 0; k < 3; ++k)
+                    count += vertexMeshlet[indices[t * 3 + k]] != meshletIdx;
+                return count;
+            };
+            auto centroid = [&](u32 t)
+            {
+                return (GetVertexPosition(positions, positionStride, indices[t * 3 + 0]) +
+                        GetVertexPosition(positions, positionStride, indices[t * 3 + 1]) +
+                        GetVertexPosition(positions, positionStride, indices[t * 3 + 2])) / 3.0f;
+            };
+
+            u32 candidate = cursor;
+            while (candidate != UINT32_MAX)
+            {
+                emitted[candidate] = 1;
+                for (u32 k = 0; k < 3; ++k)
+                {
+                    const u32 v = indices[candidate * 3 + k];
+                    if (vertexMeshlet[v] != meshletIdx)
+                    {
+                        vertexMeshlet[v] = meshletIdx;
+                        meshletVertices.push_back(v);
+                    }
+                    result.push_back(v);
+                }
+                centroidSum += centroid(candidate);
+                meshlet.triangleCount++;
+                if (meshlet.triangleCount == maxTriangles)
+                    break;
+
+                // Next the neighbour adding the fewest vertices, the nearest one on a tie
+                const vec3 center = centroidSum / (f32)meshlet.triangleCount;
+                candidate = UINT32_MAX;
+                u32 bestNewVertices = 4;
+                f32 bestDistance = FLT_MAX;
+                for (u32 v : meshletVertices)
+                {
+                    for (u32 a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; ++a)
+                    {
+                        const u32 t = adjacency[a];
+                        if (emitted[t])
+                            continue;
+
+                        const u32 added = newVertices(t);
+                        if (meshletVertices.size() + added > maxVertices || added > bestNewVertices)
+                            continue;
+
+                        const f32 distance = glm::distance(center, centroid(t));
+                        if (added < bestNewVertices || distance < bestDistance)
+                        {
+                            candidate = t;
+                            bestNewVertices = added;
+                            bestDistance = distance;
+                        }
+                    }
+                }
+            }
+
+            meshlets.push_back(meshlet);
+        }
+
+        memcpy(indices, result.data(), indexCount * sizeof(u32));
+        for (Meshlet& meshlet : meshlets)
+            ComputeMeshletBounds(meshlet, indices, positions, positionStride);
+    }
+
+    MeshStats AnalyzeMesh(const u32* indices, u32 indexCount, const f32* positions, u32 vertexCount, u32 positionStride, u32 vertexSize)
+    {
+        MeshStats stats = {};
+        const u32 triangleCount = indexCount / 3;
+        if (triangleCount == 0 || vertexCount == 0)
+            return stats;
+
+        // Post transform cache, and the vertex fetches of every miss
+        std::vector<u32> timestamps(vertexCount, 0);
+        std::vector<u64> cacheLines(FETCH_CACHE_LINES, UINT64_MAX);
+        u32 time = ANALYZER_CACHE_SIZE + 1;
+        u32 misses = 0;
+        u64 bytesFetched = 0;
+        for (u32 i = 0; i < indexCount; ++i)
+        {
+            const u32 v = indices[i];
+            if (time - timestamps[v] <= ANALYZER_CACHE_SIZE)
+                continue;
+
+            timestamps[v] = time++;
+            misses++;
+
+            const u64 firstLine = (u64)v * vertexSize / FETCH_CACHE_LINE;
+            const u64 lastLine = ((u64)v * vertexSize + vertexSize - 1) / FETCH_CACHE_LINE;
+            for (u64 line = firstLine; line <= lastLine; ++line)
+            {
+                u64& cachedLine = cacheLines[line % FETCH_CACHE_LINES];
+                if (cachedLine != line)
+                {
+                    cachedLine = line;
+                    bytesFetched += FETCH_CACHE_LINE;
+                }
+            }
+        }
+
+        stats.acmr = misses / (f32)triangleCount;
+        stats.atvr = misses / (f32)vertexCount;
+        stats.overfetch = bytesFetched / (f32)((u64)vertexCount * vertexSize);
+
+        // Overdraw from the 6 axis directions, positions scaled into the viewport
+        vec3 boundsMin = vec3(FLT_MAX);
+        vec3 boundsMax = vec3(-FLT_MAX);
+        for (u32 v = 0; v < vertexCount; ++v)
+        {
+            boundsMin = glm::min(boundsMin, GetVertexPosition(positions, positionStride, v));
+            boundsMax = glm::max(boundsMax, GetVertexPosition(positions, positionStride, v));
+        }
+        const f32 extent = glm::max(glm::max(boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y), boundsMax.z - boundsMin.z);
+        const f32 scale = extent > 0.0f ? (OVERDRAW_VIEWPORT - 1) / extent : 0.0f;
+
+        std::vector<f32> depth(OVERDRAW_VIEWPORT * OVERDRAW_VIEWPORT);
+        u32 shaded = 0;
+        u32 covered = 0;
+        for (u32 view = 0; view < 6; ++view)
+        {
+            // Looking down -axis keeps the winding, looking down +axis mirrors u
+            const u32 axis = view / 2;
+            const bool mirrored = view % 2 == 1;
+            std::fill(depth.begin(), depth.end(), FLT_MAX);
+
+            for (u32 t = 0; t < triangleCount; ++t)
+            {
+                vec3 screen[3];
+                for (u32 k = 0; k < 3; ++k)
+                {
+                    const vec3 p = (GetVertexPosition(positions, positionStride, indices[t * 3 + k]) - boundsMin) * scale;
+                    const f32 u = p[(axis + 1) % 3];
+                    const f32 w = p[(axis + 2) % 3];
+                    screen[k] = mirrored ? vec3(OVERDRAW_VIEWPORT - 1 - u, w, p[axis]) : vec3(u, w, -p[axis]);
+                }
+                RasterizeTriangle(screen[0], screen[1], screen[2], depth, shaded);
+            }
+
+            for (f32 pixelDepth : depth)
+                covered += pixelDepth != FLT_MAX;
+        }
+
+        stats.overdraw = covered > 0 ? shaded / (f32)covered : 0.0f;
+        return stats;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Globals.h"
+
+// Bake time reordering of a triangle list for the GPU: indices for the post transform
+// cache, triangle clusters front to back for less overdraw, and vertices in first use
+// order for the pre transform fetch. Positions are floats with a stride in floats
+namespace MeshOptimizer
+{
+    // Forsyth's linear speed vertex cache optimization
+    void OptimizeVertexCache(u32* indices, u32 indexCount, u32 vertexCount);
+
+    // Splits the cache optimized list where the cache restarts and sorts the clusters so the
+    // ones facing away from the mesh center draw first. Kept only if the ACMR stays within threshold
+    void OptimizeOverdraw(u32* indices, u32 indexCount, const f32* positions, u32 vertexCount, u32 positionStride, f32 threshold);
+
+    // Reorders the vertices by first use and rewrites the indices, returns the vertex count with unused ones dropped
+    u32 OptimizeVertexFetch(f32* vertices, u32* indices, u32 indexCount, u32 vertexCount, u32 vertexStride);
+
+    // Groups the triangles in meshlets of at most maxVertices and maxTriangles, each grown through the
+    // triangles sharing its vertices. The indices are reordered so every meshlet is a contiguous range
+    void BuildMeshlets(u32* indices, u32 indexCount, const f32* positions, u32 vertexCount, u32 positionStride, u32 maxVertices, u32 maxTriangles, std::vector<Meshlet>& meshlets);
+
+    // ACMR and ATVR through a 16 entry FIFO, overdraw rasterized from the 6 axis directions and
+    // overfetch through a 16KB direct mapped cache of 64 byte lines, for vertices of vertexSize bytes
+    MeshStats AnalyzeMesh(const u32* indices, u32 indexCount, const f32* positions, u32 vertexCount, u32 positionStride, u32 vertexSize);
+}
\ No newline at end of file
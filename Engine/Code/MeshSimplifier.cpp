@@ -0,0 +1,238 @@
+#include "MeshSimplifier.h"
+#include <algorithm>
+#include <unordered_map>
+
+// Sum of the squared distances to a set of planes, each weighted by the area of its triangle
+struct Quadric
+{
+    f64 a00, a01, a02, a11, a12, a22;
+    f64 b0, b1, b2;
+    f64 c;
+    f64 area;
+
+    void AddPlane(vec3 normal, f32 distance, f32 weight)
+    {
+        a00 += weight * normal.x * normal.x;
+        a01 += weight * normal.x * normal.y;
+        a02 += weight * normal.x * normal.z;
+        a11 += weight * normal.y * normal.y;
+        a12 += weight * normal.y * normal.z;
+        a22 += weight * normal.z * normal.z;
+        b0 += weight * normal.x * distance;
+        b1 += weight * normal.y * distance;
+        b2 += weight * normal.z * distance;
+        c += weight * distance * distance;
+        area += weight;
+    }
+
+    void Add(const Quadric& other)
+    {
+        a00 += other.a00; a01 += other.a01; a02 += other.a02;
+        a11 += other.a11; a12 += other.a12; a22 += other.a22;
+        b0 += other.b0; b1 += other.b1; b2 += other.b2;
+        c += other.c;
+        area += other.area;
+    }
+
+    f64 Evaluate(vec3 p) const
+    {
+        const f64 x = p.x, y = p.y, z = p.z;
+        const f64 result = a00 * x * x + 2.0 * a01 * x * y + 2.0 * a02 * x * z + a11 * y * y + 2.0 * a12 * y * z + a22 * z * z +
+                           2.0 * (b0 * x + b1 * y + b2 * z) + c;
+        return glm::max(result, 0.0);
+    }
+};
+
+struct Collapse
+{
+    u32 from;
+    u32 to;
+    f64 cost;
+    f32 error;
+};
+
+static vec3 GetVertexPosition(const f32* vertices, u32 vertexStride, u32 v)
+{
+    return glm::make_vec3(vertices + v * vertexStride);
+}
+
+namespace MeshSimplifier
+{
+    u32 Simplify(u32* destination, const u32* indices, u32 indexCount, const f32* vertices, u32 vertexCount, u32 vertexStride,
+                 const f32* attributeWeights, u32 targetIndexCount, f32 maxError, f32* resultError)
+    {
+        std::vector<u32> result(indices, indices + indexCount);
+        f32 error = 0.0f;
+
+        // Edges used by a single triangle are borders, more than two makes them non manifold
+        std::unordered_map<u64, u32> edgeUses;
+        for (u32 i = 0; i < indexCount; i += 3)
+        {
+            for (u32 k = 0; k < 3; ++k)
+            {
+                const u32 a = indices[i + k];
+                const u32 b = indices[i + (k + 1) % 3];
+                edgeUses[((u64)glm::min(a, b) << 32) | glm::max(a, b)]++;
+            }
+        }
+
+        std::vector<u8> locked(vertexCount, 0);
+        for (const auto& edge : edgeUses)
+        {
+            if (edge.second != 2)
+            {
+                locked[edge.first >> 32] = 1;
+                locked[edge.first & 0xFFFFFFFF] = 1;
+            }
+        }
+
+        std::vector<Quadric> quadrics(vertexCount, Quadric{});
+        for (u32 i = 0; i < indexCount; i += 3)
+        {
+            const vec3 p0 = GetVertexPosition(vertices, vertexStride, indices[i + 0]);
+            const vec3 p1 = GetVertexPosition(vertices, vertexStride, indices[i + 1]);
+            const vec3 p2 = GetVertexPosition(vertices, vertexStride, indices[i + 2]);
+            const vec3 cross = glm::cross(p1 - p0, p2 - p0);
+            const f32 length = glm::length(cross);
+            if (length <= 0.0f)
+                continue;
+
+            const vec3 normal = cross / length;
+            const f32 area = length * 0.5f;
+            for (u32 k = 0; k < 3; ++k)
+                quadrics[indices[i + k]].AddPlane(normal, -glm::dot(normal, p0), area);
+        }
+
+        std::vector<u32> triangleOffsets(vertexCount + 1);
+        std::vector<u32> vertexTriangles;
+        std::vector<Collapse> collapses;
+        std::vector<u8> touched(vertexCount);
+        std::vector<u32> remap(vertexCount);
+
+        // Passes of independent collapses, cheapest first, until the target or the error limit is reached
+        while (result.size() > targetIndexCount)
+        {
+            const u32 triangleCount = result.size() / 3;
+
+            std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+            for (u32 v : result)
+                triangleOffsets[v + 1]++;
+            for (u32 v = 0; v < vertexCount; ++v)
+                triangleOffsets[v + 1] += triangleOffsets[v];
+            vertexTriangles.resize(result.size());
+            std::vector<u32> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+            for (u32 i = 0; i < result.size(); ++i)
+                vertexTriangles[fill[result[i]]++] = i / 3;
+
+            collapses.clear();
+            for (u32 i = 0; i < result.size(); i += 3)
+            {
+                for (u32 k = 0; k < 3; ++k)
+                {
+                    const u32 from = result[i + k];
+                    const u32 to = result[i + (k + 1) % 3];
+                    for (u32 direction = 0; direction < 2; ++direction)
+                    {
+                        const u32 u = direction ? to : from;
+                        const u32 v = direction ? from : to;
+                        if (locked[u])
+                            continue;
+
+                        const Quadric& quadric = quadrics[u];
+                        const f64 distanceCost = quadric.Evaluate(GetVertexPosition(vertices, vertexStride, v));
+                        f64 attributeCost = 0.0;
+                        for (u32 a = 3; a < vertexStride; ++a)
+                        {
+                            const f64 difference = vertices[u * vertexStride + a] - vertices[v * vertexStride + a];
+                            attributeCost += attributeWeights[a - 3] * difference * difference;
+                        }
+
+                        const f32 collapseError = quadric.area > 0.0 ? (f32)sqrt(distanceCost / quadric.area) : 0.0f;
+                        collapses.push_back({ u, v, distanceCost + attributeCost * quadric.area, collapseError });
+                    }
+                }
+            }
+
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+            for (u32 v = 0; v < vertexCount; ++v)
+                remap[v] = v;
+            std::fill(touched.begin(), touched.end(), 0);
+
+            u32 removedTriangles = 0;
+            const u32 trianglesToRemove = triangleCount - targetIndexCount / 3;
+            for (const Collapse& collapse : collapses)
+            {
+                if (removedTriangles >= trianglesToRemove)
+                    break;
+                if (collapse.error > maxError)
+                    break;
+                if (touched[collapse.from] || touched[collapse.to])
+                    continue;
+
+                // The triangles that stay must not flip nor degenerate once the vertex moves
+                const vec3 target = GetVertexPosition(vertices, vertexStride, collapse.to);
+                bool valid = true;
+                u32 sharedTriangles = 0;
+                for (u32 j = triangleOffsets[collapse.from]; valid && j < triangleOffsets[collapse.from + 1]; ++j)
+                {
+                    const u32* triangle = result.data() + vertexTriangles[j] * 3;
+                    if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+                    {
+                        sharedTriangles++;
+                        continue;
+                    }
+
+                    vec3 p[3];
+                    vec3 moved[3];
+                    for (u32 k = 0; k < 3; ++k)
+                    {
+                        p[k] = GetVertexPosition(vertices, vertexStride, triangle[k]);
+                        moved[k] = triangle[k] == collapse.from ? target : p[k];
+                    }
+
+                    const vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+                    const vec3 movedNormal = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                    valid = glm::dot(normal, movedNormal) > 0.25f * glm::length(normal) * glm::length(movedNormal);
+                }
+                if (!valid || sharedTriangles == 0)
+                    continue;
+
+                // Everything around the collapse waits for the next pass, the costs around it changed
+                for (u32 j = triangleOffsets[collapse.from]; j < triangleOffsets[collapse.from + 1]; ++j)
+                {
+                    const u32* triangle = result.data() + vertexTriangles[j] * 3;
+                    touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+                }
+
+                remap[collapse.from] = collapse.to;
+                quadrics[collapse.to].Add(quadrics[collapse.from]);
+                removedTriangles += sharedTriangles;
+                error = glm::max(error, collapse.error);
+            }
+
+            if (removedTriangles == 0)
+                break;
+
+            u32 writeIdx = 0;
+            for (u32 i = 0; i < result.size(); i += 3)
+            {
+                const u32 a = remap[result[i + 0]];
+                const u32 b = remap[result[i + 1]];
+                const u32 c = remap[result[i + 2]];
+                if (a == b || b == c || a == c)
+                    continue;
+
+                result[writeIdx++] = a;
+                result[writeIdx++] = b;
+                result[writeIdx++] = c;
+            }
+            result.resize(writeIdx);
+        }
+
+        memcpy(destination, result.data(), result.size() * sizeof(u32));
+        if (resultError)
+            *resultError = error;
+        return result.size();
+    }
+}
\ No newline at end of file
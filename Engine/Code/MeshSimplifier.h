@@ -0,0 +1,16 @@
+#pragma once
+
+#include "Globals.h"
+
+// Quadric error metric simplification by half edge collapses: a vertex is only ever
+// merged into one of its neighbours, so every LOD indexes the vertex buffer of the
+// full mesh. Vertices on open borders, attribute seams included, never move
+namespace MeshSimplifier
+{
+    // Vertices are floats with the position first, the attributes after it get their squared
+    // difference times the weight added to the collapse cost, a weight of 0 ignores one.
+    // Writes at most indexCount indices and returns how many, resultError gets the RMS
+    // distance of the removed vertices to the surface, in object units
+    u32 Simplify(u32* destination, const u32* indices, u32 indexCount, const f32* vertices, u32 vertexCount, u32 vertexStride,
+                 const f32* attributeWeights, u32 targetIndexCount, f32 maxError, f32* resultError);
+}
\ No newline at end of file
@@ -1,16 +1,21 @@
 #pragma once
 
 #include "ModelLoadingFunctions.h"
+#include "CullingFunctions.h"
+#include "TextureCompression.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
 #include "engine.h"
 #include <stb_image.h>
 #include <stb_image_write.h>
+#include <glm/gtc/packing.hpp>
 
 namespace ModelLoader
 {
     Image LoadImage(const char* filename)
     {
         Image img = {};
-        stbi_set_flip_vertically_on_load(true);
+        stbi_set_flip_vertically_on_load_thread(true);
         img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
         if (img.pixels)
         {
@@ -56,21 +61,178 @@ namespace ModelLoader
         return texHandle;
     }
 
-    u32 LoadTexture2D(App* app, const char* filepath)
+    void BuildMipChain(const Image& image, std::vector<TextureMip>& mips)
+    {
+        const u32 channels = image.nchannels;
+        mips.clear();
+        mips.push_back({ std::vector<u8>((u8*)image.pixels, (u8*)image.pixels + image.stride * image.size.y), image.size });
+
+        // Box filter, odd sizes clamp the last texel
+        while (mips.back().size.x > 1 || mips.back().size.y > 1)
+        {
+            const TextureMip& src = mips.back();
+            TextureMip dst;
+            dst.size = glm::max(src.size / 2, ivec2(1));
+            dst.pixels.resize(dst.size.x * dst.size.y * channels);
+
+            for (i32 y = 0; y < dst.size.y; ++y)
+            {
+                const i32 y0 = glm::min(y * 2, src.size.y - 1);
+                const i32 y1 = glm::min(y * 2 + 1, src.size.y - 1);
+                for (i32 x = 0; x < dst.size.x; ++x)
+                {
+                    const i32 x0 = glm::min(x * 2, src.size.x - 1);
+                    const i32 x1 = glm::min(x * 2 + 1, src.size.x - 1);
+                    for (u32 c = 0; c < channels; ++c)
+                    {
+                        const u32 sum = src.pixels[(y0 * src.size.x + x0) * channels + c] +
+                                        src.pixels[(y0 * src.size.x + x1) * channels + c] +
+                                        src.pixels[(y1 * src.size.x + x0) * channels + c] +
+                                        src.pixels[(y1 * src.size.x + x1) * channels + c];
+                        dst.pixels[(y * dst.size.x + x) * channels + c] = (u8)((sum + 2) / 4);
+                    }
+                }
+            }
+
+            mips.push_back(std::move(dst));
+        }
+    }
+
+    bool BakeTexture(const char* filename, const char* bakedFilename, bool normalMap)
+    {
+        Image image = LoadImage(filename);
+        if (!image.pixels)
+            return false;
+
+        if (image.nchannels != 3 && image.nchannels != 4)
+        {
+            ELOG("BakeTexture() - Unsupported number of channels in %s", filename);
+            FreeImage(image);
+            return false;
+        }
+
+        std::vector<TextureMip> mips;
+        BuildMipChain(image, mips);
+        const BlockFormat format = TextureCompression::ChooseFormat(image, normalMap);
+        const u32 channels = image.nchannels;
+        FreeImage(image);
+
+        std::vector<TextureMip> levels(mips.size());
+        for (u32 i = 0; i < mips.size(); ++i)
+        {
+            TextureCompression::CompressLevel(mips[i], channels, format, levels[i]);
+        }
+
+        return TextureCompression::WriteCompressedTexture(bakedFilename, filename, format, levels);
+    }
+
+    static AssetTask StreamTexture(App* app, u32 texIdx, bool normalMap)
+    {
+        AssetPipeline& pipeline = app->assetPipeline;
+        const std::string filepath = app->textures[texIdx].filepath;
+        const bool blockCompression = app->blockCompression;
+        pipeline.BeginTask();
+
+        co_await pipeline.ToWorker();
+        TextureUpload upload = {};
+        upload.textureIdx = texIdx;
+
+        // Compressed levels are read as they were baked, the image is only decoded when the bake is stale
+        if (blockCompression)
+        {
+            const std::string bakedFilepath = filepath + ".dds";
+            bool baked = TextureCompression::IsCompressedTextureUpToDate(bakedFilepath.c_str(), filepath.c_str());
+            if (!baked)
+            {
+                ILOG("Baking %s", bakedFilepath.c_str());
+                baked = BakeTexture(filepath.c_str(), bakedFilepath.c_str(), normalMap);
+            }
+
+            BlockFormat format;
+            if (baked && TextureCompression::ReadCompressedTexture(bakedFilepath.c_str(), format, upload.mips))
+            {
+                upload.dataFormat = TextureCompression::GetInternalFormat(format);
+                upload.blockBytes = TextureCompression::GetBlockBytes(format);
+            }
+            else
+            {
+                upload.mips.clear();
+            }
+        }
+
+        // File read, decode and mip chain
+        if (upload.mips.empty())
+        {
+            Image image = LoadImage(filepath.c_str());
+            if (image.pixels)
+            {
+                if (image.nchannels == 3 || image.nchannels == 4)
+                {
+                    upload.channels = image.nchannels;
+                    upload.dataFormat = image.nchannels == 4 ? GL_RGBA : GL_RGB;
+                    BuildMipChain(image, upload.mips);
+                }
+                else
+                {
+                    ELOG("LoadTexture2D() - Unsupported number of channels in %s", filepath.c_str());
+                }
+                FreeImage(image);
+            }
+        }
+
+        // Storage for every level, the levels themselves go through the texture streamer
+        co_await pipeline.ToRenderThread();
+        if (!upload.mips.empty())
+        {
+            GLenum internalFormat = upload.dataFormat;
+            if (!upload.blockBytes)
+                internalFormat = upload.channels == 4 ? GL_RGBA8 : GL_RGB8;
+
+            glGenTextures(1, &upload.handle);
+            glBindTexture(GL_TEXTURE_2D, upload.handle);
+            glTexStorage2D(GL_TEXTURE_2D, upload.mips.size(), internalFormat, upload.mips[0].size.x, upload.mips[0].size.y);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, upload.mips.size() - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            app->textureStreamer.Enqueue(upload);
+        }
+        else
+        {
+            app->textures[texIdx].handle = app->textures[app->magentaTexIdx].handle;
+        }
+
+        pipeline.EndTask();
+    }
+
+    u32 LoadTexture2D(App* app, const char* filepath, bool streamed, bool normalMap)
     {
         for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
             if (app->textures[texIdx].filepath == filepath)
                 return texIdx;
 
+        Texture tex = {};
+        tex.filepath = filepath;
+        u32 texIdx = app->textures.size();
+
+        if (streamed)
+        {
+            // Usable right away, it is white until the real texture is resident
+            tex.handle = app->textures[app->whiteTexIdx].handle;
+            app->textures.push_back(tex);
+            StreamTexture(app, texIdx, normalMap);
+            return texIdx;
+        }
+
         Image image = LoadImage(filepath);
 
         if (image.pixels)
         {
-            Texture tex = {};
             tex.handle = CreateTexture2DFromImage(image);
-            tex.filepath = filepath;
-
-            u32 texIdx = app->textures.size();
             app->textures.push_back(tex);
 
             FreeImage(image);
@@ -82,7 +244,7 @@ namespace ModelLoader
         }
     }
 
-    void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+    void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, ImportedModel& model)
     {
         std::vector<float> vertices;
         std::vector<u32> indices;
@@ -138,37 +300,47 @@ namespace ModelLoader
             }
         }
 
-        // store the proper (previously proceessed) material for this mesh
-        submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
-
         // create the vertex format
         VertexBufferLayout vertexBufferLayout = {};
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) });
+        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0, VertexFormat_Float });
+        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float), VertexFormat_Float });
         vertexBufferLayout.stride = 6 * sizeof(float);
         if (hasTexCoords)
         {
-            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride });
+            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride, VertexFormat_Float });
             vertexBufferLayout.stride += 2 * sizeof(float);
         }
         if (hasTangentSpace)
         {
-            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride });
+            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride, VertexFormat_Float });
             vertexBufferLayout.stride += 3 * sizeof(float);
 
-            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride });
+            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride, VertexFormat_Float });
             vertexBufferLayout.stride += 3 * sizeof(float);
         }
 
-        // add the submesh into the mesh
-        SubMesh submesh = {};
+        // add the submesh into the model, with the proper (previously processed) material
+        ImportedSubMesh submesh = {};
         submesh.vertexBufferLayout = vertexBufferLayout;
+        submesh.materialIdx = mesh->mMaterialIndex;
+
+        const u32 floatStride = vertexBufferLayout.stride / sizeof(float);
+        submesh.aabb = Culling::ComputeAABB(vertices.data(), mesh->mNumVertices, floatStride);
+        submesh.sphere = Culling::ComputeBoundingSphere(vertices.data(), mesh->mNumVertices, floatStride, submesh.aabb);
+
         submesh.vertices.swap(vertices);
         submesh.indices.swap(indices);
-        myMesh->subMeshes.push_back(submesh);
+        model.subMeshes.push_back(submesh);
     }
 
-    void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory)
+    // Imports run on worker threads, so paths are built without the frame arena
+    static std::string GetDirectory(const std::string& filepath)
+    {
+        const size_t separator = filepath.find_last_of("/\\");
+        return separator == std::string::npos ? std::string() : filepath.substr(0, separator);
+    }
+
+    void ProcessAssimpMaterial(aiMaterial* material, ImportedMaterial& myMaterial, const std::string& directory)
     {
         aiString name;
         aiColor3D diffuseColor;
@@ -186,63 +358,66 @@ namespace ModelLoader
         myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
         myMaterial.smoothness = shininess / 256.0f;
 
+        // Only the paths are baked, the textures are loaded along the baked mesh
+        const aiTextureType textureTypes[MaterialTexture_Count] = {
+            aiTextureType_DIFFUSE,
+            aiTextureType_EMISSIVE,
+            aiTextureType_SPECULAR,
+            aiTextureType_NORMALS,
+            aiTextureType_HEIGHT
+        };
+
         aiString aiFilename;
-        if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
-        {
-            material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
+        for (u32 i = 0; i < MaterialTexture_Count; ++i)
         {
-            material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.emissiveTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
-        {
-            material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.specularTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
-        {
-            material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
-        {
-            material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
+            if (material->GetTextureCount(textureTypes[i]) > 0)
+            {
+                material->GetTexture(textureTypes[i], 0, &aiFilename);
+                myMaterial.texturePaths[i] = directory + "/" + aiFilename.C_Str();
+            }
         }
 
         //myMaterial.createNormalFromBump();
     }
 
-    void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+    void ProcessAssimpNode(const aiScene* scene, aiNode* node, ImportedModel& model)
     {
         // process all the node's meshes (if any)
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+            ProcessAssimpMesh(scene, mesh, model);
         }
 
         // then do the same for each of its children
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+            ProcessAssimpNode(scene, node->mChildren[i], model);
         }
     }
 
-    u32 LoadModel(App* app, const char* filename)
+    // The material libraries an OBJ pulls in, so editing one of them re-bakes the model
+    static void CollectObjDependencies(const char* filename, const std::string& directory, std::vector<std::string>& dependencies)
+    {
+        FILE* file = fopen(filename, "rb");
+        if (!file)
+            return;
+
+        char line[512];
+        while (fgets(line, sizeof(line), file))
+        {
+            if (strncmp(line, "mtllib ", 7) != 0)
+                continue;
+
+            char* libraryName = line + 7;
+            libraryName[strcspn(libraryName, "\r\n")] = '\0';
+            dependencies.push_back(directory + "/" + libraryName);
+        }
+
+        fclose(file);
+    }
+
+    bool ImportModel(const char* filename, ImportedModel& model)
     {
         const aiScene* scene = aiImportFile(filename,
             aiProcess_Triangulate |
@@ -250,18 +425,688 @@ namespace ModelLoader
             aiProcess_CalcTangentSpace |
             aiProcess_JoinIdenticalVertices |
             aiProcess_PreTransformVertices |
-            aiProcess_ImproveCacheLocality |
             aiProcess_OptimizeMeshes |
             aiProcess_SortByPType);
 
         if (!scene)
         {
             ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-            return UINT32_MAX;
+            return false;
         }
 
+        const std::string directory = GetDirectory(filename);
+
+        // Create a list of materials
+        model.materials.resize(scene->mNumMaterials);
+        for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+        {
+            ProcessAssimpMaterial(scene->mMaterials[i], model.materials[i], directory);
+        }
+
+        ProcessAssimpNode(scene, scene->mRootNode, model);
+
+        aiReleaseImport(scene);
+
+        model.dependencies.push_back(filename);
+        CollectObjDependencies(filename, directory, model.dependencies);
+
+        return true;
+    }
+
+    // Baked mesh file: header, dependencies, materials, submeshes and then the
+    // vertex and index blobs, each submesh exactly as its geometry pool holds it
+    #define BAKED_MESH_MAGIC 0x4853454D // "MESH"
+    #define BAKED_MESH_VERSION 5
+    #define BAKED_MAX_PATH 256
+    #define BAKED_MAX_ATTRIBUTES 8
+    #define BAKED_BLOB_ALIGNMENT 16
+
+    struct BakedMeshHeader
+    {
+        u32 magic;
+        u32 version;
+        u32 dependencyCount;
+        u32 materialCount;
+        u32 subMeshCount;
+        u32 padding;
+        u64 vertexBlobOffset;
+        u64 vertexBlobSize;
+        u64 indexBlobOffset;
+        u64 indexBlobSize;
+        u64 meshletBlobOffset;
+        u64 meshletBlobSize;
+        AABB aabb;
+        BoundingSphere sphere;
+        vec4 dequantization;
+    };
+
+    struct BakedDependency
+    {
+        char path[BAKED_MAX_PATH];
+        u64  timestamp;
+    };
+
+    struct BakedMaterial
+    {
+        char name[BAKED_MAX_PATH];
+        vec3 albedo;
+        vec3 emissive;
+        f32  smoothness;
+        char texturePaths[MaterialTexture_Count][BAKED_MAX_PATH]; // Empty when the material has none
+    };
+
+    struct BakedSubMesh
+    {
+        u8 attributeCount;
+        u8 stride;
+        u8 indexSize;
+        u8 padding;
+        VertexBufferAttribute attributes[BAKED_MAX_ATTRIBUTES];
+        u32 materialIdx;
+        u32 vertexOffset; // Bytes into the vertex blob
+        u32 vertexCount;
+        u32 indexOffset;  // Bytes into the index blob
+        u32 indexCount;
+        AABB aabb;
+        BoundingSphere sphere;
+        MeshStats importStats;
+        MeshStats bakeStats;
+        u32 lodCount;
+        MeshLod lods[MAX_MESH_LODS]; // First index relative to the submesh
+        u32 meshletOffset;           // Meshlets into the meshlet blob
+        u32 meshletCount;
+    };
+
+    static bool CopyBakedString(char* destination, const std::string& source)
+    {
+        if (source.size() >= BAKED_MAX_PATH)
+        {
+            ELOG("Baked mesh string too long: %s", source.c_str());
+            return false;
+        }
+
+        strcpy(destination, source.c_str());
+        return true;
+    }
+
+    static void WritePadding(FILE* file, u64& offset)
+    {
+        static const u8 zeros[BAKED_BLOB_ALIGNMENT] = {};
+        const u64 alignedOffset = (offset + BAKED_BLOB_ALIGNMENT - 1) & ~(u64)(BAKED_BLOB_ALIGNMENT - 1);
+        fwrite(zeros, 1, alignedOffset - offset, file);
+        offset = alignedOffset;
+    }
+
+    static u32 PackSNorm10_10_10_2(vec3 v, f32 w)
+    {
+        const glm::ivec3 q = glm::ivec3(glm::round(glm::clamp(v, vec3(-1.0f), vec3(1.0f)) * 511.0f));
+        return (u32)(q.x & 0x3FF) | ((u32)(q.y & 0x3FF) << 10) | ((u32)(q.z & 0x3FF) << 20) | ((u32)((i32)w & 0x3) << 30);
+    }
+
+    // Positions to snorm16 inside the mesh bounds, normals and tangents to 10_10_10_2 and
+    // texture coordinates to halves. The bitangent is dropped, its sign goes into the tangent w
+    static void QuantizeSubMesh(const ImportedSubMesh& imported, vec4 dequantization, VertexBufferLayout& layout, std::vector<u8>& vertices)
+    {
+        const VertexBufferAttribute* importedAttributes[5] = {};
+        for (const VertexBufferAttribute& attribute : imported.vertexBufferLayout.attributes)
+        {
+            if (attribute.location < ARRAY_COUNT(importedAttributes))
+                importedAttributes[attribute.location] = &attribute;
+        }
+
+        layout = {};
+        layout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0, VertexFormat_SNorm16 });
+        layout.attributes.push_back(VertexBufferAttribute{ 1, 4, 8, VertexFormat_SNorm10_10_10_2 });
+        layout.stride = 12;
+        if (importedAttributes[2])
+        {
+            layout.attributes.push_back(VertexBufferAttribute{ 2, 2, layout.stride, VertexFormat_Half });
+            layout.stride += 4;
+        }
+        const bool hasTangentSpace = importedAttributes[3] && importedAttributes[4];
+        if (hasTangentSpace)
+        {
+            layout.attributes.push_back(VertexBufferAttribute{ 3, 4, layout.stride, VertexFormat_SNorm10_10_10_2 });
+            layout.stride += 4;
+        }
+
+        const u32 importedStride = imported.vertexBufferLayout.stride / sizeof(float);
+        const u32 vertexCount = imported.vertices.size() / importedStride;
+        vertices.assign(vertexCount * layout.stride, 0);
+
+        for (u32 i = 0; i < vertexCount; ++i)
+        {
+            const f32* src = imported.vertices.data() + i * importedStride;
+            auto attribute = [&](u32 location) { return glm::make_vec3(src + importedAttributes[location]->offset / sizeof(float)); };
+            u8* dst = vertices.data() + i * layout.stride;
+
+            const vec3 position = (attribute(0) - vec3(dequantization)) / dequantization.w;
+            const glm::i16vec3 quantizedPosition = glm::i16vec3(glm::round(glm::clamp(position, vec3(-1.0f), vec3(1.0f)) * 32767.0f));
+            memcpy(dst, &quantizedPosition, sizeof(quantizedPosition));
+
+            const vec3 normal = attribute(1);
+            const u32 packedNormal = PackSNorm10_10_10_2(normal, 0.0f);
+            memcpy(dst + 8, &packedNormal, sizeof(packedNormal));
+
+            u32 offset = 12;
+            if (importedAttributes[2])
+            {
+                const u32 texCoord = glm::packHalf2x16(glm::make_vec2(src + importedAttributes[2]->offset / sizeof(float)));
+                memcpy(dst + offset, &texCoord, sizeof(texCoord));
+                offset += 4;
+            }
+            if (hasTangentSpace)
+            {
+                const vec3 tangent = attribute(3);
+                const f32 handedness = glm::dot(glm::cross(normal, tangent), attribute(4)) < 0.0f ? -1.0f : 1.0f;
+                const u32 packedTangent = PackSNorm10_10_10_2(tangent, handedness);
+                memcpy(dst + offset, &packedTangent, sizeof(packedTangent));
+            }
+        }
+    }
+
+    // 16 bit indices when they fit, padded so the next submesh starts 4 byte aligned
+    static u32 PackIndices(const ImportedSubMesh& imported, u32 vertexCount, std::vector<u8>& indices)
+    {
+        const u32 indexSize = vertexCount <= UINT16_MAX + 1 ? sizeof(u16) : sizeof(u32);
+        indices.assign((imported.indices.size() * indexSize + 3) & ~3u, 0);
+
+        for (u32 i = 0; i < imported.indices.size(); ++i)
+        {
+            if (indexSize == sizeof(u16))
+                ((u16*)indices.data())[i] = (u16)imported.indices[i];
+            else
+                ((u32*)indices.data())[i] = imported.indices[i];
+        }
+
+        return indexSize;
+    }
+
+    // Positions are always the first attribute of an imported submesh
+    static MeshStats AnalyzeImportedSubMesh(const ImportedSubMesh& subMesh, u32 vertexSize)
+    {
+        const u32 floatStride = subMesh.vertexBufferLayout.stride / sizeof(float);
+        return MeshOptimizer::AnalyzeMesh(subMesh.indices.data(), subMesh.indices.size(), subMesh.vertices.data(), subMesh.vertices.size() / floatStride, floatStride, vertexSize);
+    }
+
+    static void OptimizeImportedSubMesh(ImportedSubMesh& subMesh)
+    {
+        const u32 floatStride = subMesh.vertexBufferLayout.stride / sizeof(float);
+        const u32 vertexCount = subMesh.vertices.size() / floatStride;
+
+        MeshOptimizer::OptimizeVertexCache(subMesh.indices.data(), subMesh.indices.size(), vertexCount);
+        MeshOptimizer::OptimizeOverdraw(subMesh.indices.data(), subMesh.indices.size(), subMesh.vertices.data(), vertexCount, floatStride, 1.05f);
+
+        // Meshlets reorder the triangles into their clusters. Seeded in the cache and overdraw order they keep
+        // most of its locality, but not the whole overdraw order, the bake stats measure the order that is kept
+        MeshOptimizer::BuildMeshlets(subMesh.indices.data(), subMesh.indices.size(), subMesh.vertices.data(), vertexCount, floatStride,
+                                     MESHLET_MAX_VERTICES, MESHLET_MAX_TRIANGLES, subMesh.meshlets);
+
+        // Fetch order last, from the final triangle order. Meshlets locate their triangles by index position, so the remap keeps them valid
+        const u32 usedVertexCount = MeshOptimizer::OptimizeVertexFetch(subMesh.vertices.data(), subMesh.indices.data(), subMesh.indices.size(), vertexCount, floatStride);
+        subMesh.vertices.resize(usedVertexCount * floatStride);
+    }
+
+    // Each LOD simplifies the previous one to half its triangles, until it stalls or gets small enough.
+    // The LODs are appended after LOD 0 and index the same vertices, their error adds up along the chain
+    static void BuildLods(ImportedSubMesh& subMesh)
+    {
+        const u32 floatStride = subMesh.vertexBufferLayout.stride / sizeof(float);
+        const u32 vertexCount = subMesh.vertices.size() / floatStride;
+        const f32 radius = subMesh.sphere.radius > 0.0f ? subMesh.sphere.radius : 1.0f;
+
+        // Normals and texture coordinates keep seams from sliding, tangents follow them anyway
+        f32 attributeWeights[16] = {};
+        assert(floatStride - 3 <= ARRAY_COUNT(attributeWeights));
+        for (const VertexBufferAttribute& attribute : subMesh.vertexBufferLayout.attributes)
+        {
+            const f32 weight = attribute.location == 1 ? 0.05f : attribute.location == 2 ? 1.0f : 0.0f;
+            for (u32 i = 0; i < attribute.componentCount; ++i)
+            {
+                if (attribute.location != 0)
+                    attributeWeights[attribute.offset / sizeof(float) - 3 + i] = weight * radius * radius;
+            }
+        }
+
+        subMesh.lods[0] = { 0, (u32)subMesh.indices.size(), 0.0f };
+        subMesh.lodCount = 1;
+
+        std::vector<u32> lodIndices(subMesh.indices.size());
+        while (subMesh.lodCount < MAX_MESH_LODS)
+        {
+            const MeshLod& previous = subMesh.lods[subMesh.lodCount - 1];
+            if (previous.indexCount / 3 <= 128)
+                break;
+
+            const u32 targetIndexCount = previous.indexCount / 6 * 3;
+            f32 error = 0.0f;
+            const u32 indexCount = MeshSimplifier::Simplify(lodIndices.data(), subMesh.indices.data() + previous.firstIndex, previous.indexCount,
+                                                            subMesh.vertices.data(), vertexCount, floatStride, attributeWeights, targetIndexCount, radius * 0.5f, &error);
+            if (indexCount == 0 || indexCount > previous.indexCount * 9 / 10)
+                break;
+
+            MeshOptimizer::OptimizeVertexCache(lodIndices.data(), indexCount, vertexCount);
+
+            const MeshLod lod = { (u32)subMesh.indices.size(), indexCount, previous.error + error };
+            subMesh.indices.insert(subMesh.indices.end(), lodIndices.begin(), lodIndices.begin() + indexCount);
+            subMesh.lods[subMesh.lodCount++] = lod;
+        }
+    }
+
+    bool AnalyzeModel(const char* filename)
+    {
+        ImportedModel model;
+        if (!ImportModel(filename, model))
+            return false;
+
+        printf("%s\n", filename);
+        printf("%8s %10s %16s %16s %16s %16s\n", "submesh", "triangles", "ACMR", "ATVR", "overdraw", "overfetch");
+        for (u32 i = 0; i < model.subMeshes.size(); ++i)
+        {
+            ImportedSubMesh& subMesh = model.subMeshes[i];
+            const MeshStats before = AnalyzeImportedSubMesh(subMesh, subMesh.vertexBufferLayout.stride);
+            OptimizeImportedSubMesh(subMesh);
+
+            VertexBufferLayout layout;
+            std::vector<u8> vertices;
+            QuantizeSubMesh(subMesh, vec4(0.0f, 0.0f, 0.0f, 1.0f), layout, vertices);
+            const MeshStats after = AnalyzeImportedSubMesh(subMesh, layout.stride);
+
+            printf("%8u %10u %7.3f->%7.3f %7.3f->%7.3f %7.3f->%7.3f %7.3f->%7.3f\n", i, (u32)subMesh.indices.size() / 3,
+                before.acmr, after.acmr, before.atvr, after.atvr, before.overdraw, after.overdraw, before.overfetch, after.overfetch);
+            printf("%8s %10u meshlets\n", "", (u32)subMesh.meshlets.size());
+
+            BuildLods(subMesh);
+            for (u32 lod = 1; lod < subMesh.lodCount; ++lod)
+            {
+                printf("%8s %10u LOD %u error %g\n", "", subMesh.lods[lod].indexCount / 3, lod, subMesh.lods[lod].error);
+            }
+        }
+
+        return true;
+    }
+
+    bool BakeModel(const char* filename, const char* bakedFilename)
+    {
+        ImportedModel model;
+        if (!ImportModel(filename, model))
+            return false;
+
+        BakedMeshHeader header = {};
+        header.magic = BAKED_MESH_MAGIC;
+        header.version = BAKED_MESH_VERSION;
+        header.dependencyCount = model.dependencies.size();
+        header.materialCount = model.materials.size();
+        header.subMeshCount = model.subMeshes.size();
+
+        std::vector<BakedDependency> dependencies(model.dependencies.size());
+        for (u32 i = 0; i < model.dependencies.size(); ++i)
+        {
+            if (!CopyBakedString(dependencies[i].path, model.dependencies[i]))
+                return false;
+            dependencies[i].timestamp = GetFileLastWriteTimestamp(model.dependencies[i].c_str());
+        }
+
+        std::vector<BakedMaterial> materials(model.materials.size());
+        for (u32 i = 0; i < model.materials.size(); ++i)
+        {
+            const ImportedMaterial& material = model.materials[i];
+            if (!CopyBakedString(materials[i].name, material.name))
+                return false;
+            materials[i].albedo = material.albedo;
+            materials[i].emissive = material.emissive;
+            materials[i].smoothness = material.smoothness;
+            for (u32 j = 0; j < MaterialTexture_Count; ++j)
+            {
+                if (!CopyBakedString(materials[i].texturePaths[j], material.texturePaths[j]))
+                    return false;
+            }
+        }
+
+        // Mesh bounds, the sphere is centered on the merged box and grown to hold every submesh sphere
+        header.aabb = model.subMeshes.empty() ? AABB{ vec3(0.0f), vec3(0.0f) } : model.subMeshes[0].aabb;
+        for (u32 i = 1; i < model.subMeshes.size(); ++i)
+        {
+            header.aabb = Culling::MergeAABB(header.aabb, model.subMeshes[i].aabb);
+        }
+
+        header.sphere = { (header.aabb.min + header.aabb.max) * 0.5f, 0.0f };
+        for (u32 i = 0; i < model.subMeshes.size(); ++i)
+        {
+            const BoundingSphere& subMeshSphere = model.subMeshes[i].sphere;
+            header.sphere.radius = glm::max(header.sphere.radius, glm::distance(header.sphere.center, subMeshSphere.center) + subMeshSphere.radius);
+        }
+
+        // One uniform scale for the whole mesh, so the instance matrices can carry it without skewing normals
+        const vec3 halfExtent = (header.aabb.max - header.aabb.min) * 0.5f;
+        const f32 quantizationScale = glm::max(glm::max(halfExtent.x, halfExtent.y), halfExtent.z);
+        header.dequantization = vec4(header.sphere.center, quantizationScale > 0.0f ? quantizationScale : 1.0f);
+
+        std::vector<BakedSubMesh> subMeshes(model.subMeshes.size());
+        std::vector<std::vector<u8>> vertexBlobs(model.subMeshes.size());
+        std::vector<std::vector<u8>> indexBlobs(model.subMeshes.size());
+        std::vector<Meshlet> meshletBlob;
+        for (u32 i = 0; i < model.subMeshes.size(); ++i)
+        {
+            ImportedSubMesh& imported = model.subMeshes[i];
+            BakedSubMesh& subMesh = subMeshes[i];
+
+            subMesh.importStats = AnalyzeImportedSubMesh(imported, imported.vertexBufferLayout.stride);
+            OptimizeImportedSubMesh(imported);
+
+            VertexBufferLayout layout;
+            QuantizeSubMesh(imported, header.dequantization, layout, vertexBlobs[i]);
+            subMesh.bakeStats = AnalyzeImportedSubMesh(imported, layout.stride);
+            BuildLods(imported);
+            assert(layout.attributes.size() <= BAKED_MAX_ATTRIBUTES);
+
+            subMesh.attributeCount = layout.attributes.size();
+            subMesh.stride = layout.stride;
+            for (u32 j = 0; j < subMesh.attributeCount; ++j)
+            {
+                subMesh.attributes[j] = layout.attributes[j];
+            }
+            subMesh.materialIdx = imported.materialIdx;
+            subMesh.vertexOffset = header.vertexBlobSize;
+            subMesh.vertexCount = vertexBlobs[i].size() / subMesh.stride;
+            subMesh.indexSize = PackIndices(imported, subMesh.vertexCount, indexBlobs[i]);
+            subMesh.indexOffset = header.indexBlobSize;
+            subMesh.indexCount = imported.indices.size();
+            subMesh.aabb = imported.aabb;
+            subMesh.sphere = imported.sphere;
+            subMesh.lodCount = imported.lodCount;
+            memcpy(subMesh.lods, imported.lods, sizeof(subMesh.lods));
+
+            // Meshlet bounds go to the quantized space, where the instance matrices start from
+            subMesh.meshletOffset = meshletBlob.size();
+            subMesh.meshletCount = imported.meshlets.size();
+            for (Meshlet meshlet : imported.meshlets)
+            {
+                meshlet.center = (meshlet.center - vec3(header.dequantization)) / header.dequantization.w;
+                meshlet.radius /= header.dequantization.w;
+                meshletBlob.push_back(meshlet);
+            }
+
+            header.vertexBlobSize += vertexBlobs[i].size();
+            header.indexBlobSize += indexBlobs[i].size();
+        }
+
+        FILE* file = fopen(bakedFilename, "wb");
+        if (!file)
+        {
+            ELOG("fopen() failed writing baked mesh %s", bakedFilename);
+            return false;
+        }
+
+        // The header goes last, a bake interrupted halfway is never taken as valid
+        BakedMeshHeader pendingHeader = {};
+        fwrite(&pendingHeader, sizeof(pendingHeader), 1, file);
+        fwrite(dependencies.data(), sizeof(BakedDependency), dependencies.size(), file);
+        fwrite(materials.data(), sizeof(BakedMaterial), materials.size(), file);
+        fwrite(subMeshes.data(), sizeof(BakedSubMesh), subMeshes.size(), file);
+
+        u64 offset = sizeof(BakedMeshHeader) + dependencies.size() * sizeof(BakedDependency) + materials.size() * sizeof(BakedMaterial) + subMeshes.size() * sizeof(BakedSubMesh);
+        WritePadding(file, offset);
+        header.vertexBlobOffset = offset;
+        for (const std::vector<u8>& vertices : vertexBlobs)
+        {
+            fwrite(vertices.data(), 1, vertices.size(), file);
+        }
+        offset += header.vertexBlobSize;
+
+        WritePadding(file, offset);
+        header.indexBlobOffset = offset;
+        for (const std::vector<u8>& indices : indexBlobs)
+        {
+            fwrite(indices.data(), 1, indices.size(), file);
+        }
+        offset += header.indexBlobSize;
+
+        WritePadding(file, offset);
+        header.meshletBlobOffset = offset;
+        header.meshletBlobSize = meshletBlob.size() * sizeof(Meshlet);
+        fwrite(meshletBlob.data(), sizeof(Meshlet), meshletBlob.size(), file);
+
+        fseek(file, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, file);
+        const bool written = ferror(file) == 0;
+        fclose(file);
+
+        if (!written)
+        {
+            ELOG("Failed writing baked mesh %s", bakedFilename);
+            remove(bakedFilename);
+        }
+
+        return written;
+    }
+
+    bool IsBakeUpToDate(const char* bakedFilename)
+    {
+        FILE* file = fopen(bakedFilename, "rb");
+        if (!file)
+            return false;
+
+        BakedMeshHeader header = {};
+        bool upToDate = fread(&header, sizeof(header), 1, file) == 1 && header.magic == BAKED_MESH_MAGIC && header.version == BAKED_MESH_VERSION;
+
+        // Any source that changed or went missing since the bake invalidates it
+        for (u32 i = 0; upToDate && i < header.dependencyCount; ++i)
+        {
+            BakedDependency dependency;
+            upToDate = fread(&dependency, sizeof(dependency), 1, file) == 1 && GetFileLastWriteTimestamp(dependency.path) == dependency.timestamp;
+        }
+
+        fclose(file);
+        return upToDate;
+    }
+
+    // Touches every page on the worker, so the upload on the render thread never waits on the disk
+    static void PrefetchMappedFile(const MappedFile& file)
+    {
+        u8 sum = 0;
+        for (u64 offset = 0; offset < file.size; offset += KB(4))
+        {
+            sum += file.data[offset];
+        }
+
+        // Stored once, so the reads can't be optimized away
+        volatile u8 sink = sum;
+        (void)sink;
+    }
+
+    // Everything the upload reads through the file, so a truncated or corrupt bake is rejected instead of read out of bounds
+    static bool IsBakedModelValid(const MappedFile& file)
+    {
+        // A blob lies within [begin, end) when it fits in what is left after its offset, so corrupt sizes can't wrap
+        auto fitsIn = [](u64 offset, u64 size, u64 begin, u64 end) { return offset >= begin && offset <= end && size <= end - offset; };
+
+        // The header is only read once the file is known to hold it
+        const BakedMeshHeader* header = (const BakedMeshHeader*)file.data;
+        if (file.size < sizeof(BakedMeshHeader) || header->magic != BAKED_MESH_MAGIC || header->version != BAKED_MESH_VERSION)
+            return false;
+
+        const u64 tablesSize = (u64)header->dependencyCount * sizeof(BakedDependency) + (u64)header->materialCount * sizeof(BakedMaterial) +
+                               (u64)header->subMeshCount * sizeof(BakedSubMesh);
+        if (!fitsIn(sizeof(BakedMeshHeader), tablesSize, sizeof(BakedMeshHeader), header->vertexBlobOffset) ||
+            !fitsIn(header->vertexBlobOffset, header->vertexBlobSize, header->vertexBlobOffset, header->indexBlobOffset) ||
+            !fitsIn(header->indexBlobOffset, header->indexBlobSize, header->indexBlobOffset, header->meshletBlobOffset) ||
+            !fitsIn(header->meshletBlobOffset, header->meshletBlobSize, header->meshletBlobOffset, file.size))
+            return false;
+
+        const BakedDependency* dependencies = (const BakedDependency*)(header + 1);
+        const BakedMaterial* bakedMaterials = (const BakedMaterial*)(dependencies + header->dependencyCount);
+        const BakedSubMesh* bakedSubMeshes = (const BakedSubMesh*)(bakedMaterials + header->materialCount);
+        const Meshlet* meshletBlob = (const Meshlet*)(file.data + header->meshletBlobOffset);
+        const u64 meshletBlobCount = header->meshletBlobSize / sizeof(Meshlet);
+
+        for (u32 i = 0; i < header->subMeshCount; ++i)
+        {
+            const BakedSubMesh& bakedSubMesh = bakedSubMeshes[i];
+            if (bakedSubMesh.attributeCount > BAKED_MAX_ATTRIBUTES ||
+                (bakedSubMesh.indexSize != sizeof(u16) && bakedSubMesh.indexSize != sizeof(u32)) ||
+                bakedSubMesh.lodCount == 0 || bakedSubMesh.lodCount > MAX_MESH_LODS ||
+                bakedSubMesh.materialIdx >= header->materialCount ||
+                !fitsIn(bakedSubMesh.vertexOffset, (u64)bakedSubMesh.vertexCount * bakedSubMesh.stride, 0, header->vertexBlobSize) ||
+                !fitsIn(bakedSubMesh.indexOffset, (u64)bakedSubMesh.indexCount * bakedSubMesh.indexSize, 0, header->indexBlobSize) ||
+                !fitsIn(bakedSubMesh.meshletOffset, bakedSubMesh.meshletCount, 0, meshletBlobCount))
+                return false;
+
+            for (u32 lod = 0; lod < bakedSubMesh.lodCount; ++lod)
+            {
+                if (!fitsIn(bakedSubMesh.lods[lod].firstIndex, bakedSubMesh.lods[lod].indexCount, 0, bakedSubMesh.indexCount))
+                    return false;
+            }
+
+            // Each meshlet is drawn as its own command
+            for (u32 j = 0; j < bakedSubMesh.meshletCount; ++j)
+            {
+                const Meshlet& meshlet = meshletBlob[bakedSubMesh.meshletOffset + j];
+                if (!fitsIn(meshlet.firstIndex, (u64)meshlet.triangleCount * 3, 0, bakedSubMesh.indexCount))
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    // The file must have passed IsBakedModelValid, it stays mapped as long as the mesh reads it
+    void UploadBakedModel(App* app, u32 modelIdx, MappedFile file)
+    {
+        const BakedMeshHeader* header = (const BakedMeshHeader*)file.data;
+        const BakedDependency* dependencies = (const BakedDependency*)(header + 1);
+        const BakedMaterial* bakedMaterials = (const BakedMaterial*)(dependencies + header->dependencyCount);
+        const BakedSubMesh* bakedSubMeshes = (const BakedSubMesh*)(bakedMaterials + header->materialCount);
+        const u8* vertexBlob = file.data + header->vertexBlobOffset;
+        const u8* indexBlob = file.data + header->indexBlobOffset;
+        const Meshlet* meshletBlob = (const Meshlet*)(file.data + header->meshletBlobOffset);
+
+        Model& model = app->models[modelIdx];
+        Mesh& mesh = app->meshes[model.meshIdx];
+
+        u32 baseMeshMaterialIndex = (u32)app->materials.size();
+        for (u32 i = 0; i < header->materialCount; ++i)
+        {
+            const BakedMaterial& bakedMaterial = bakedMaterials[i];
+
+            Material material = {};
+            material.name = bakedMaterial.name;
+            material.albedo = bakedMaterial.albedo;
+            material.emissive = bakedMaterial.emissive;
+            material.smoothness = bakedMaterial.smoothness;
+
+            u32* textureIndices[MaterialTexture_Count] = {
+                &material.albedoTextureIdx,
+                &material.emissiveTextureIdx,
+                &material.specularTextureIdx,
+                &material.normalsTextureIdx,
+                &material.bumpTextureIdx
+            };
+            for (u32 j = 0; j < MaterialTexture_Count; ++j)
+            {
+                if (bakedMaterial.texturePaths[j][0] != '\0')
+                    *textureIndices[j] = LoadTexture2D(app, bakedMaterial.texturePaths[j], true, j == MaterialTexture_Normals);
+            }
+
+            app->materials.push_back(material);
+        }
+
+        for (u32 i = 0; i < header->subMeshCount; ++i)
+        {
+            const BakedSubMesh& bakedSubMesh = bakedSubMeshes[i];
+
+            SubMesh subMesh = {};
+            subMesh.vertexBufferLayout.attributes.assign(bakedSubMesh.attributes, bakedSubMesh.attributes + bakedSubMesh.attributeCount);
+            subMesh.vertexBufferLayout.stride = bakedSubMesh.stride;
+            subMesh.vertexData = vertexBlob + bakedSubMesh.vertexOffset;
+            subMesh.indexData = indexBlob + bakedSubMesh.indexOffset;
+            subMesh.vertexCount = bakedSubMesh.vertexCount;
+            subMesh.indexCount = bakedSubMesh.indexCount;
+            subMesh.indexSize = bakedSubMesh.indexSize;
+            subMesh.aabb = bakedSubMesh.aabb;
+            subMesh.sphere = bakedSubMesh.sphere;
+            subMesh.importStats = bakedSubMesh.importStats;
+            subMesh.bakeStats = bakedSubMesh.bakeStats;
+            subMesh.lodCount = bakedSubMesh.lodCount;
+            memcpy(subMesh.lods, bakedSubMesh.lods, sizeof(subMesh.lods));
+            subMesh.meshletData = meshletBlob + bakedSubMesh.meshletOffset;
+            subMesh.meshletCount = bakedSubMesh.meshletCount;
+
+            // A mesh has as many LODs as its most detailed submesh, the others stay at their last one
+            mesh.lodCount = glm::max(mesh.lodCount, subMesh.lodCount);
+            for (u32 lod = 0; lod < MAX_MESH_LODS; ++lod)
+            {
+                mesh.lodErrors[lod] = glm::max(mesh.lodErrors[lod], subMesh.lods[glm::min(lod, subMesh.lodCount - 1)].error);
+            }
+
+            mesh.subMeshes.push_back(subMesh);
+            model.materialIdx.push_back(baseMeshMaterialIndex + bakedSubMesh.materialIdx);
+        }
+
+        mesh.aabb = header->aabb;
+        mesh.sphere = header->sphere;
+        mesh.dequantization = header->dequantization;
+        mesh.bakedFile = file;
+
+        // The pools hold the only GPU copy, every draw reaches the submesh through baseVertex and firstIndex
+        AddToGeometryPools(app, mesh);
+    }
+
+    static AssetTask StreamModel(App* app, u32 modelIdx, std::string filename)
+    {
+        AssetPipeline& pipeline = app->assetPipeline;
+        pipeline.BeginTask();
+
+        // Import and bake when needed, then map and read the baked file
+        co_await pipeline.ToWorker();
+        const std::string bakedFilename = filename + ".mesh";
+        MappedFile file = {};
+        bool baked = IsBakeUpToDate(bakedFilename.c_str());
+        if (!baked)
+        {
+            ILOG("Baking %s into %s", filename.c_str(), bakedFilename.c_str());
+            baked = BakeModel(filename.c_str(), bakedFilename.c_str());
+        }
+        if (baked)
+        {
+            file = MapFile(bakedFilename.c_str());
+        }
+
+        // A corrupt bake of the current version is imported and baked again, like an outdated one
+        if (file.data != NULL && !IsBakedModelValid(file))
+        {
+            ELOG("Baked mesh %s is corrupt, baking it again", bakedFilename.c_str());
+            UnmapFile(file);
+            if (BakeModel(filename.c_str(), bakedFilename.c_str()))
+            {
+                file = MapFile(bakedFilename.c_str());
+                if (file.data != NULL && !IsBakedModelValid(file))
+                    UnmapFile(file);
+            }
+        }
+        PrefetchMappedFile(file);
+
+        // GL upload
+        co_await pipeline.ToRenderThread();
+        if (file.data == NULL)
+        {
+            ELOG("Could not load model %s", filename.c_str());
+        }
+        else
+        {
+            UploadBakedModel(app, modelIdx, file);
+            app->OnModelResident(modelIdx);
+        }
+
+        pipeline.EndTask();
+    }
+
+    u32 LoadModel(App* app, const char* filename)
+    {
+        // Usable right away with no submeshes, so nothing is drawn until the real data is resident
         app->meshes.push_back(Mesh{});
-        Mesh& mesh = app->meshes.back();
+        app->meshes.back().name = filename;
+        app->meshes.back().dequantization = vec4(0.0f, 0.0f, 0.0f, 1.0f);
         u32 meshIdx = (u32)app->meshes.size() - 1u;
 
         app->models.push_back(Model{});
@@ -269,59 +1114,137 @@ namespace ModelLoader
         model.meshIdx = meshIdx;
         u32 modelIdx = (u32)app->models.size() - 1u;
 
-        String directory = GetDirectoryPart(MakeString(filename));
+        StreamModel(app, modelIdx, filename);
+        return modelIdx;
+    }
 
-        // Create a list of materials
-        u32 baseMeshMaterialIndex = (u32)app->materials.size();
-        for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+    u32 GetIndex(const SubMesh& subMesh, u32 i)
+    {
+        return subMesh.indexSize == sizeof(u16) ? ((const u16*)subMesh.indexData)[i] : ((const u32*)subMesh.indexData)[i];
+    }
+
+    vec3 GetPosition(const Mesh& mesh, const SubMesh& subMesh, u32 vertex)
+    {
+        const glm::i16vec3* position = (const glm::i16vec3*)(subMesh.vertexData + vertex * subMesh.vertexBufferLayout.stride);
+        return vec3(mesh.dequantization) + glm::max(vec3(*position) / 32767.0f, vec3(-1.0f)) * mesh.dequantization.w;
+    }
+
+    bool SameVertexFormat(const VertexBufferLayout& a, const VertexBufferLayout& b)
+    {
+        if (a.stride != b.stride || a.attributes.size() != b.attributes.size())
+            return false;
+
+        for (u32 i = 0; i < a.attributes.size(); ++i)
         {
-            app->materials.push_back(Material{});
-            Material& material = app->materials.back();
-            ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+            const VertexBufferAttribute& attributeA = a.attributes[i];
+            const VertexBufferAttribute& attributeB = b.attributes[i];
+            if (attributeA.location != attributeB.location ||
+                attributeA.componentCount != attributeB.componentCount ||
+                attributeA.offset != attributeB.offset ||
+                attributeA.format != attributeB.format)
+                return false;
         }
 
-        ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
-
-        aiReleaseImport(scene);
+        return true;
+    }
 
-        u32 vertexBufferSize = 0;
-        u32 indexBufferSize = 0;
+    static void GrowPoolBuffer(GLuint& bufferHandle, u32 usedSize, u32 newSize)
+    {
+        GLuint newBufferHandle;
+        glGenBuffers(1, &newBufferHandle);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newBufferHandle);
+        glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
 
-        for (u32 i = 0; i < mesh.subMeshes.size(); ++i)
+        if (bufferHandle != 0)
         {
-            vertexBufferSize += mesh.subMeshes[i].vertices.size() * sizeof(float);
-            indexBufferSize += mesh.subMeshes[i].indices.size() * sizeof(u32);
+            glBindBuffer(GL_COPY_READ_BUFFER, bufferHandle);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedSize);
+            glDeleteBuffers(1, &bufferHandle);
         }
 
-        glGenBuffers(1, &mesh.vertexBufferHandle);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-        glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
-
-        glGenBuffers(1, &mesh.indexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+        bufferHandle = newBufferHandle;
+    }
 
-        u32 indicesOffset = 0;
-        u32 verticesOffset = 0;
+    void AddToGeometryPools(App* app, Mesh& mesh)
+    {
+        std::vector<GeometryPool>& pools = app->geometryPools;
 
-        for (u32 i = 0; i < mesh.subMeshes.size(); ++i)
+        // Place every submesh at the end of the pool of its vertex format
+        for (SubMesh& subMesh : mesh.subMeshes)
         {
-            const void* verticesData = mesh.subMeshes[i].vertices.data();
-            const u32   verticesSize = mesh.subMeshes[i].vertices.size() * sizeof(float);
-            glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-            mesh.subMeshes[i].vertexOffset = verticesOffset;
-            verticesOffset += verticesSize;
+            u32 poolIdx = 0;
+            while (poolIdx < pools.size() && (!SameVertexFormat(pools[poolIdx].vertexBufferLayout, subMesh.vertexBufferLayout) || pools[poolIdx].indexSize != subMesh.indexSize))
+                ++poolIdx;
 
-            const void* indicesData = mesh.subMeshes[i].indices.data();
-            const u32   indicesSize = mesh.subMeshes[i].indices.size() * sizeof(u32);
-            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-            mesh.subMeshes[i].indexOffset = indicesOffset;
-            indicesOffset += indicesSize;
+            if (poolIdx == pools.size())
+            {
+                GeometryPool pool = {};
+                pool.vertexBufferLayout = subMesh.vertexBufferLayout;
+                pool.indexSize = subMesh.indexSize;
+                pools.push_back(pool);
+            }
+
+            GeometryPool& pool = pools[poolIdx];
+            const u32 stride = pool.vertexBufferLayout.stride;
+
+            // Pools grow by doubling as models stream in, the VAOs point at the old buffers
+            const bool growVertices = pool.vertexCount + subMesh.vertexCount > pool.vertexCapacity;
+            const bool growIndices = pool.indexCount + subMesh.indexCount > pool.indexCapacity;
+            if (growVertices)
+            {
+                const u32 vertexCapacity = glm::max(2 * pool.vertexCapacity, pool.vertexCount + subMesh.vertexCount);
+                GrowPoolBuffer(pool.vertexBufferHandle, pool.vertexCount * stride, vertexCapacity * stride);
+                pool.vertexCapacity = vertexCapacity;
+            }
+            if (growIndices)
+            {
+                const u32 indexCapacity = glm::max(2 * pool.indexCapacity, pool.indexCount + subMesh.indexCount);
+                GrowPoolBuffer(pool.indexBufferHandle, pool.indexCount * pool.indexSize, indexCapacity * pool.indexSize);
+                pool.indexCapacity = indexCapacity;
+            }
+            if (growVertices || growIndices)
+            {
+                for (const VAO& vao : pool.vaos)
+                {
+                    glDeleteVertexArrays(1, &vao.handle);
+                }
+                pool.vaos.clear();
+            }
+
+            subMesh.poolIdx = poolIdx;
+            subMesh.baseVertex = pool.vertexCount;
+            subMesh.firstIndex = pool.indexCount;
+
+            // Indices stay relative to their submesh, the draws add baseVertex.
+            // Uploaded through GL_ARRAY_BUFFER so no VAO element binding gets touched
+            glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBufferHandle);
+            glBufferSubData(GL_ARRAY_BUFFER, subMesh.baseVertex * stride, subMesh.vertexCount * stride, subMesh.vertexData);
+
+            glBindBuffer(GL_ARRAY_BUFFER, pool.indexBufferHandle);
+            glBufferSubData(GL_ARRAY_BUFFER, subMesh.firstIndex * pool.indexSize, subMesh.indexCount * pool.indexSize, subMesh.indexData);
+
+            pool.vertexCount += subMesh.vertexCount;
+            pool.indexCount += subMesh.indexCount;
+
+            // Meshlets of every pool share one storage buffer, the culling pass reads them by index
+            subMesh.firstMeshlet = app->meshletCount;
+            if (subMesh.meshletCount == 0)
+                continue;
+
+            if (app->meshletCount + subMesh.meshletCount > app->meshletCapacity)
+            {
+                const u32 meshletCapacity = glm::max(2 * app->meshletCapacity, app->meshletCount + subMesh.meshletCount);
+                GrowPoolBuffer(app->meshletBufferHandle, app->meshletCount * sizeof(Meshlet), meshletCapacity * sizeof(Meshlet));
+                app->meshletCapacity = meshletCapacity;
+            }
+
+            glBindBuffer(GL_ARRAY_BUFFER, app->meshletBufferHandle);
+            glBufferSubData(GL_ARRAY_BUFFER, subMesh.firstMeshlet * sizeof(Meshlet), subMesh.meshletCount * sizeof(Meshlet), subMesh.meshletData);
+            app->meshletCount += subMesh.meshletCount;
         }
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-        return modelIdx;
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
     }
 }
\ No newline at end of file
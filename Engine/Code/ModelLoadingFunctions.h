@@ -4,9 +4,50 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "Globals.h"
+#include "TextureStreamer.h"
 
 struct App;
 
+enum MaterialTexture
+{
+    MaterialTexture_Albedo,
+    MaterialTexture_Emissive,
+    MaterialTexture_Specular,
+    MaterialTexture_Normals,
+    MaterialTexture_Bump,
+    MaterialTexture_Count
+};
+
+// A model as Assimp imports it, in floats. It only lives while the model is baked
+struct ImportedSubMesh
+{
+    VertexBufferLayout vertexBufferLayout;
+    std::vector<float> vertices;
+    std::vector<u32> indices;
+    u32 materialIdx;
+    AABB aabb;
+    BoundingSphere sphere;
+    MeshLod lods[MAX_MESH_LODS];
+    u32 lodCount;
+    std::vector<Meshlet> meshlets; // Of LOD 0, bounds in object space
+};
+
+struct ImportedMaterial
+{
+    std::string name;
+    vec3 albedo;
+    vec3 emissive;
+    f32 smoothness;
+    std::string texturePaths[MaterialTexture_Count];
+};
+
+struct ImportedModel
+{
+    std::vector<ImportedSubMesh> subMeshes;
+    std::vector<ImportedMaterial> materials;
+    std::vector<std::string> dependencies; // Source files, the bake is redone when one changes
+};
+
 namespace ModelLoader
 {
     Image LoadImage(const char* filename);
@@ -15,13 +56,45 @@ namespace ModelLoader
 
     GLuint CreateTexture2DFromImage(Image image);
 
-    u32 LoadTexture2D(App* app, const char* filepath);
+    // Level 0 is a copy of the image, 3 and 4 channels of 8 bits
+    void BuildMipChain(const Image& image, std::vector<TextureMip>& mips);
+
+    // Compresses the mip chain of an image into 4x4 blocks, normal maps keep two channels
+    bool BakeTexture(const char* filename, const char* bakedFilename, bool normalMap);
+
+    // Streamed textures are returned right away and stay white until they are resident,
+    // they are block compressed when the driver supports it
+    u32 LoadTexture2D(App* app, const char* filepath, bool streamed = true, bool normalMap = false);
 
-    void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+    void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, ImportedModel& model);
 
-    void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory);
+    void ProcessAssimpMaterial(aiMaterial* material, ImportedMaterial& myMaterial, const std::string& directory);
 
-    void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+    void ProcessAssimpNode(const aiScene* scene, aiNode* node, ImportedModel& model);
 
+    bool ImportModel(const char* filename, ImportedModel& model);
+
+    // Imports a model and prints the mesh optimizer stats of every submesh, before and after, to stdout
+    bool AnalyzeModel(const char* filename);
+
+    // Models are loaded from a baked file next to their source, mapped and
+    // uploaded as is. It is baked again whenever one of its sources changes
+    bool BakeModel(const char* filename, const char* bakedFilename);
+
+    bool IsBakeUpToDate(const char* bakedFilename);
+
+    void UploadBakedModel(App* app, u32 modelIdx, MappedFile file);
+
+    // Returns the model right away, it is baked and mapped on a worker and uploaded
+    // on the render thread. Until then its mesh has no submeshes
     u32 LoadModel(App* app, const char* filename);
+
+    // Reads back the baked data of a resident submesh, positions dequantized to object space
+    u32 GetIndex(const SubMesh& subMesh, u32 i);
+
+    vec3 GetPosition(const Mesh& mesh, const SubMesh& subMesh, u32 vertex);
+
+    bool SameVertexFormat(const VertexBufferLayout& a, const VertexBufferLayout& b);
+
+    void AddToGeometryPools(App* app, Mesh& mesh);
 }
\ No newline at end of file
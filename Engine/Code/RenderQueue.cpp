@@ -0,0 +1,62 @@
+#include "RenderQueue.h"
+
+namespace RenderQueue
+{
+    u64 MakeSortKey(RenderPass pass, u32 programIdx, u32 vertexFormat, u32 textureIdx, f32 normalizedDepth)
+    {
+        const u64 depthMax = (1ull << SORT_KEY_DEPTH_BITS) - 1;
+        const u64 depth = (u64)(glm::clamp(normalizedDepth, 0.0f, 1.0f) * depthMax);
+
+        u64 key = 0;
+        key |= ((u64)pass & ((1ull << SORT_KEY_PASS_BITS) - 1)) << SORT_KEY_PASS_SHIFT;
+        key |= ((u64)programIdx & ((1ull << SORT_KEY_PROGRAM_BITS) - 1)) << SORT_KEY_PROGRAM_SHIFT;
+        key |= ((u64)vertexFormat & ((1ull << SORT_KEY_FORMAT_BITS) - 1)) << SORT_KEY_FORMAT_SHIFT;
+        key |= ((u64)textureIdx & ((1ull << SORT_KEY_TEXTURE_BITS) - 1)) << SORT_KEY_TEXTURE_SHIFT;
+        key |= depth;
+        return key;
+    }
+
+    RenderPass GetPass(u64 key)
+    {
+        return (RenderPass)(key >> SORT_KEY_PASS_SHIFT);
+    }
+
+    u64 GetStateBits(u64 key)
+    {
+        return key >> SORT_KEY_DEPTH_BITS;
+    }
+
+    void RadixSort(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch)
+    {
+        const u32 count = (u32)items.size();
+        scratch.resize(count);
+
+        for (u32 shift = 0; shift < 64; shift += 8)
+        {
+            u32 histogram[256] = {};
+            for (u32 i = 0; i < count; ++i)
+            {
+                histogram[(items[i].key >> shift) & 0xFF]++;
+            }
+
+            // Nothing to reorder when the whole queue falls in one bucket
+            if (count == 0 || histogram[(items[0].key >> shift) & 0xFF] == count)
+                continue;
+
+            u32 offset = 0;
+            for (u32 bucket = 0; bucket < 256; ++bucket)
+            {
+                const u32 bucketCount = histogram[bucket];
+                histogram[bucket] = offset;
+                offset += bucketCount;
+            }
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                scratch[histogram[(items[i].key >> shift) & 0xFF]++] = items[i];
+            }
+
+            items.swap(scratch);
+        }
+    }
+}
\ No newline at end of file
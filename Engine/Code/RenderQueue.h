@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Globals.h"
+
+// Sort key layout, from the most to the least significant bits. State changes
+// weigh more the higher they are, depth only orders draws sharing all the state.
+#define SORT_KEY_DEPTH_BITS 24
+#define SORT_KEY_TEXTURE_BITS 20
+#define SORT_KEY_FORMAT_BITS 8
+#define SORT_KEY_PROGRAM_BITS 8
+#define SORT_KEY_PASS_BITS 4
+
+#define SORT_KEY_TEXTURE_SHIFT SORT_KEY_DEPTH_BITS
+#define SORT_KEY_FORMAT_SHIFT (SORT_KEY_TEXTURE_SHIFT + SORT_KEY_TEXTURE_BITS)
+#define SORT_KEY_PROGRAM_SHIFT (SORT_KEY_FORMAT_SHIFT + SORT_KEY_FORMAT_BITS)
+#define SORT_KEY_PASS_SHIFT (SORT_KEY_PROGRAM_SHIFT + SORT_KEY_PROGRAM_BITS)
+
+enum RenderPass
+{
+    RenderPass_Geometry,
+    RenderPass_Indicators,
+    RenderPass_Count
+};
+
+struct DrawItem
+{
+    u64 key;
+    u32 modelIdx;
+    u32 subMeshIdx;
+    u32 lod;
+    u32 baseInstance;
+    u32 instanceCount;
+};
+
+namespace RenderQueue
+{
+    // normalizedDepth in [0, 1], smaller sorts first (front to back)
+    u64 MakeSortKey(RenderPass pass, u32 programIdx, u32 vertexFormat, u32 textureIdx, f32 normalizedDepth);
+
+    RenderPass GetPass(u64 key);
+
+    // The key without its depth, equal for draws that need no state change between them
+    u64 GetStateBits(u64 key);
+
+    // LSD radix sort on the keys, one byte per pass, passes where every key shares the byte are skipped
+    void RadixSort(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch);
+}
\ No newline at end of file
@@ -0,0 +1,612 @@
+#include "ShaderFunctions.h"
+#include "engine.h"
+
+// GL_KHR_parallel_shader_compile is not part of the 4.3 loader
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+static PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreadsKHR = NULL;
+
+namespace ShaderCompiler
+{
+    // Declarations shared by every program, prepended after the defines so it can test them
+    #define SHADER_COMMON_FILE "common.glsl"
+
+    // The full source of a stage as handed to the driver, the injected prefix included
+    struct ShaderSource
+    {
+        char          shaderNameDefine[128];
+        const GLchar* strings[6];
+        GLint         lengths[6];
+    };
+
+    static void BuildShaderSource(ShaderSource& shaderSource, const char* stageDefine, String commonSource, String programSource, const char* shaderName, const char* programDefines)
+    {
+        static const char versionString[] = "#version 430\n";
+        sprintf(shaderSource.shaderNameDefine, "#define %s\n", shaderName);
+
+        shaderSource.strings[0] = versionString;
+        shaderSource.strings[1] = shaderSource.shaderNameDefine;
+        shaderSource.strings[2] = programDefines;
+        shaderSource.strings[3] = stageDefine;
+        shaderSource.strings[4] = commonSource.str;
+        shaderSource.strings[5] = programSource.str;
+        for (u32 i = 0; i < ARRAY_COUNT(shaderSource.strings) - 2; ++i)
+        {
+            shaderSource.lengths[i] = (GLint)strlen(shaderSource.strings[i]);
+        }
+        shaderSource.lengths[4] = (GLint)commonSource.len;
+        shaderSource.lengths[5] = (GLint)programSource.len;
+    }
+
+    static GLuint SubmitShader(GLenum type, const ShaderSource& shaderSource)
+    {
+        // The status is only checked once the program is complete, so the compile does not block here
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, ARRAY_COUNT(shaderSource.strings), shaderSource.strings, shaderSource.lengths);
+        glCompileShader(shader);
+
+        return shader;
+    }
+
+    // FNV-1a
+    static u64 HashBytes(const void* data, u64 size, u64 hash = 14695981039346656037ull)
+    {
+        const u8* bytes = (const u8*)data;
+        for (u64 i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static u64 HashShaderSource(const ShaderSource& shaderSource, u64 hash)
+    {
+        for (u32 i = 0; i < ARRAY_COUNT(shaderSource.strings); ++i)
+        {
+            hash = HashBytes(shaderSource.strings[i], shaderSource.lengths[i], hash);
+        }
+        return hash;
+    }
+
+    // Program binary cache, one file per program hash under PROGRAM_CACHE_DIRECTORY
+    #define PROGRAM_CACHE_DIRECTORY "ShaderCache"
+    #define PROGRAM_CACHE_MAGIC 0x48435250 // "PRCH"
+
+    struct ProgramBinaryHeader
+    {
+        u32    magic;
+        GLenum format;
+        u64    hash;
+        u32    size;
+        f32    compileTime; // Main thread ms spent compiling it, what a hit saves
+    };
+
+    static bool programCacheEnabled = false;
+    static u64  driverHash = 0;
+
+    static void GetProgramCachePath(u64 hash, char* path, u32 pathSize)
+    {
+        snprintf(path, pathSize, PROGRAM_CACHE_DIRECTORY "/%016llx.bin", (unsigned long long)hash);
+    }
+
+    static bool LoadCachedProgram(App* app, Program& program)
+    {
+        f64 loadStart = glfwGetTime();
+
+        char path[256];
+        GetProgramCachePath(program.binaryHash, path, sizeof(path));
+        FILE* file = fopen(path, "rb");
+        if (!file)
+            return false;
+
+        ProgramBinaryHeader header = {};
+        std::vector<u8> binary;
+        bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == PROGRAM_CACHE_MAGIC && header.hash == program.binaryHash;
+        if (valid)
+        {
+            binary.resize(header.size);
+            valid = fread(binary.data(), 1, header.size, file) == header.size;
+        }
+        fclose(file);
+
+        if (!valid)
+        {
+            ELOG("Program cache entry %s for %s is corrupt, compiling it\n", path, program.programName.c_str());
+            return false;
+        }
+
+        // The driver may still reject it, e.g. after an update that kept the version string
+        GLuint programHandle = glCreateProgram();
+        glProgramBinary(programHandle, header.format, binary.data(), header.size);
+
+        GLint success;
+        glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            ILOG("Program cache entry %s for %s was rejected by the driver, compiling it\n", path, program.programName.c_str());
+            glDeleteProgram(programHandle);
+            return false;
+        }
+
+        program.pendingHandle = programHandle;
+
+        const f32 loadTime = (f32)((glfwGetTime() - loadStart) * 1000.0);
+        app->programCacheStats.hits++;
+        app->programCacheStats.timeSaved += glm::max(header.compileTime - loadTime, 0.0f);
+        return true;
+    }
+
+    static void StoreCachedProgram(const Program& program)
+    {
+        GLint binarySize = 0;
+        glGetProgramiv(program.handle, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+        if (binarySize <= 0)
+            return;
+
+        ProgramBinaryHeader header = {};
+        header.magic = PROGRAM_CACHE_MAGIC;
+        header.hash = program.binaryHash;
+        header.compileTime = program.compileTime;
+
+        std::vector<u8> binary(binarySize);
+        GLsizei length = 0;
+        glGetProgramBinary(program.handle, binarySize, &length, &header.format, binary.data());
+        header.size = (u32)length;
+
+        char path[256];
+        GetProgramCachePath(program.binaryHash, path, sizeof(path));
+        FILE* file = fopen(path, "wb");
+        if (!file)
+        {
+            ELOG("fopen() failed writing program cache entry %s\n", path);
+            return;
+        }
+
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(binary.data(), 1, header.size, file);
+        fclose(file);
+    }
+
+    static void ReflectAttributes(Program& program)
+    {
+        program.shaderLayout.attributes.clear();
+
+        GLint attributeCount = 0;
+        glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
+        for (GLuint i = 0; i < attributeCount; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            GLchar name[256];
+            glGetActiveAttrib(program.handle, i, ARRAY_COUNT(name), &length, &size, &type, name);
+
+            u8 location = glGetAttribLocation(program.handle, name);
+            program.shaderLayout.attributes.push_back(VertexShaderAttribute{ location, u8(size) });
+        }
+    }
+
+    static const char* uniformNames[Uniform_Count] = {
+        "uTexture",
+        "uAlbedo",
+        "uNormals",
+        "uPosition",
+        "uViewDir",
+        "uDepth",
+        "uVolumeScale",
+        "uDequantization",
+        "uSource",
+        "uSourceLevel",
+        "uFromDepth",
+        "uPhase",
+        "uInstanceCount",
+        "uCommandCount",
+        "uCullViewProjection",
+        "uPyramidValid",
+        "uPyramidLevels",
+        "uDepthPyramid",
+    };
+
+    // Bindings the engine binds its buffers to, a shader declaring one elsewhere is reported at link time
+    struct BlockBinding
+    {
+        const char* name;
+        GLenum      interface;
+        GLint       binding;
+    };
+
+    static const BlockBinding engineBlockBindings[] = {
+        { "GlobalsParams",   GL_UNIFORM_BLOCK,        0 },
+        { "Lights",          GL_SHADER_STORAGE_BLOCK, 0 },
+        { "LightGrid",       GL_SHADER_STORAGE_BLOCK, 1 },
+        { "LightIndices",    GL_SHADER_STORAGE_BLOCK, 2 },
+        { "Instances",       GL_SHADER_STORAGE_BLOCK, 3 },
+        { "Bounds",          GL_SHADER_STORAGE_BLOCK, 4 },
+        { "SourceCommands",  GL_SHADER_STORAGE_BLOCK, 4 },
+        { "CulledInstances", GL_SHADER_STORAGE_BLOCK, 5 },
+        { "CulledCommands",  GL_SHADER_STORAGE_BLOCK, 5 },
+        { "GroupCounters",   GL_SHADER_STORAGE_BLOCK, 6 },
+        { "Rejected",        GL_SHADER_STORAGE_BLOCK, 7 },
+        { "Meshlets",        GL_SHADER_STORAGE_BLOCK, 4 },
+        { "MeshletJobs",     GL_SHADER_STORAGE_BLOCK, 5 },
+        { "MeshletCommands", GL_SHADER_STORAGE_BLOCK, 6 },
+    };
+
+    static bool IsSamplerType(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_SAMPLER_2D:
+        case GL_SAMPLER_3D:
+        case GL_SAMPLER_CUBE:
+        case GL_SAMPLER_2D_SHADOW:
+        case GL_SAMPLER_2D_ARRAY:
+        case GL_INT_SAMPLER_2D:
+        case GL_UNSIGNED_INT_SAMPLER_2D:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static void ReflectBlocks(Program& program, GLenum interface, std::vector<ShaderBlock>& blocks)
+    {
+        blocks.clear();
+
+        GLint blockCount = 0;
+        glGetProgramInterfaceiv(program.handle, interface, GL_ACTIVE_RESOURCES, &blockCount);
+        for (GLint i = 0; i < blockCount; ++i)
+        {
+            const GLenum properties[] = { GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+            GLint values[ARRAY_COUNT(properties)] = {};
+            glGetProgramResourceiv(program.handle, interface, i, ARRAY_COUNT(properties), properties, ARRAY_COUNT(values), NULL, values);
+
+            GLchar name[256];
+            glGetProgramResourceName(program.handle, interface, i, ARRAY_COUNT(name), NULL, name);
+
+            for (const BlockBinding& expected : engineBlockBindings)
+            {
+                if (expected.interface == interface && strcmp(expected.name, name) == 0 && expected.binding != values[0])
+                {
+                    ELOG("Program %s declares %s at binding %d, the engine binds it to %d\n", program.programName.c_str(), name, values[0], expected.binding);
+                }
+            }
+
+            blocks.push_back(ShaderBlock{ name, values[0], values[1] });
+        }
+    }
+
+    static void ReflectUniforms(Program& program)
+    {
+        program.reflection.uniforms.clear();
+        for (u32 i = 0; i < Uniform_Count; ++i)
+        {
+            program.uniformLocations[i] = -1;
+            program.textureUnits[i] = -1;
+        }
+
+        GLint uniformCount = 0;
+        glGetProgramInterfaceiv(program.handle, GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniformCount);
+
+        i32 nextTextureUnit = 0;
+        for (GLint i = 0; i < uniformCount; ++i)
+        {
+            const GLenum properties[] = { GL_BLOCK_INDEX, GL_LOCATION, GL_TYPE, GL_ARRAY_SIZE };
+            GLint values[ARRAY_COUNT(properties)] = {};
+            glGetProgramResourceiv(program.handle, GL_UNIFORM, i, ARRAY_COUNT(properties), properties, ARRAY_COUNT(values), NULL, values);
+
+            // Members of uniform blocks are fed through their buffer
+            if (values[0] != -1)
+                continue;
+
+            GLchar name[256];
+            glGetProgramResourceName(program.handle, GL_UNIFORM, i, ARRAY_COUNT(name), NULL, name);
+            if (char* arraySuffix = strstr(name, "[0]"))
+                *arraySuffix = '\0';
+
+            ShaderUniform uniform = { name, values[1], (GLenum)values[2], values[3], -1 };
+
+            // Samplers keep their unit for the lifetime of the program
+            if (IsSamplerType(uniform.type))
+            {
+                uniform.textureUnit = nextTextureUnit++;
+                glProgramUniform1i(program.handle, uniform.location, uniform.textureUnit);
+            }
+
+            for (u32 j = 0; j < Uniform_Count; ++j)
+            {
+                if (strcmp(uniformNames[j], name) == 0)
+                {
+                    program.uniformLocations[j] = uniform.location;
+                    program.textureUnits[j] = uniform.textureUnit;
+                    break;
+                }
+            }
+
+            program.reflection.uniforms.push_back(uniform);
+        }
+    }
+
+    static void ReflectProgram(Program& program)
+    {
+        ReflectAttributes(program);
+        ReflectUniforms(program);
+        ReflectBlocks(program, GL_UNIFORM_BLOCK, program.reflection.uniformBlocks);
+        ReflectBlocks(program, GL_SHADER_STORAGE_BLOCK, program.reflection.storageBlocks);
+    }
+
+    static void ReleaseProgramVAOs(App* app, GLuint programHandle)
+    {
+        // A deleted program name can be reused by the driver, so its VAOs go with it
+        auto releaseVAOs = [programHandle](std::vector<VAO>& vaos)
+        {
+            for (u32 i = 0; i < vaos.size();)
+            {
+                if (vaos[i].programHandle == programHandle)
+                {
+                    glDeleteVertexArrays(1, &vaos[i].handle);
+                    vaos[i] = vaos.back();
+                    vaos.pop_back();
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        };
+
+        for (GeometryPool& pool : app->geometryPools)
+        {
+            releaseVAOs(pool.vaos);
+        }
+    }
+
+    static void FinishProgram(App* app, Program& program)
+    {
+        f64 finishStart = glfwGetTime();
+
+        GLchar  infoLogBuffer[1024] = {};
+        GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+        GLsizei infoLogSize;
+        GLint   success;
+
+        // Cached programs arrive already linked, with no shaders
+        const bool compiled = program.pendingShaders[0] != 0;
+        const u32 shaderCount = !compiled ? 0 : program.isCompute ? 1 : 2;
+        glGetProgramiv(program.pendingHandle, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            for (u32 i = 0; i < shaderCount; ++i)
+            {
+                glGetShaderiv(program.pendingShaders[i], GL_COMPILE_STATUS, &success);
+                if (!success)
+                {
+                    GLint shaderType;
+                    glGetShaderiv(program.pendingShaders[i], GL_SHADER_TYPE, &shaderType);
+                    const char* stageName = (shaderType == GL_COMPUTE_SHADER) ? "compute" : (shaderType == GL_VERTEX_SHADER) ? "vertex" : "fragment";
+
+                    glGetShaderInfoLog(program.pendingShaders[i], infoLogBufferSize, &infoLogSize, infoLogBuffer);
+                    ELOG("glCompileShader() failed with %s shader %s\nReported message:\n%s\n", stageName, program.programName.c_str(), infoLogBuffer);
+                }
+            }
+
+            glGetProgramInfoLog(program.pendingHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+            ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", program.programName.c_str(), infoLogBuffer);
+        }
+
+        for (u32 i = 0; i < shaderCount; ++i)
+        {
+            glDetachShader(program.pendingHandle, program.pendingShaders[i]);
+            glDeleteShader(program.pendingShaders[i]);
+            program.pendingShaders[i] = 0;
+        }
+
+        if (!success)
+        {
+            // A failed reload keeps the last working program
+            glDeleteProgram(program.pendingHandle);
+            program.pendingHandle = 0;
+            return;
+        }
+
+        if (program.handle != 0)
+        {
+            ReleaseProgramVAOs(app, program.handle);
+            glDeleteProgram(program.handle);
+        }
+
+        program.handle = program.pendingHandle;
+        program.pendingHandle = 0;
+        program.ready = true;
+        ReflectProgram(program);
+
+        if (compiled && programCacheEnabled)
+        {
+            program.compileTime += (f32)((glfwGetTime() - finishStart) * 1000.0);
+            StoreCachedProgram(program);
+        }
+    }
+
+    bool LoadParallelShaderCompile()
+    {
+        if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+        {
+            glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+        }
+
+        if (glMaxShaderCompilerThreadsKHR != NULL)
+        {
+            // Let the driver pick how many threads to use
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+            return true;
+        }
+
+        return false;
+    }
+
+    bool LoadProgramBinaryCache()
+    {
+        GLint binaryFormatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormatCount);
+        if (binaryFormatCount == 0 || !MakeDirectory(PROGRAM_CACHE_DIRECTORY))
+            return false;
+
+        // Binaries are only valid for the driver that produced them
+        driverHash = HashBytes(glGetString(GL_VENDOR), strlen((const char*)glGetString(GL_VENDOR)));
+        driverHash = HashBytes(glGetString(GL_RENDERER), strlen((const char*)glGetString(GL_RENDERER)), driverHash);
+        driverHash = HashBytes(glGetString(GL_VERSION), strlen((const char*)glGetString(GL_VERSION)), driverHash);
+
+        programCacheEnabled = true;
+        return true;
+    }
+
+    // Of the newest of its sources, an edit to the common one reloads every program
+    static u64 GetProgramSourceTimestamp(const Program& program)
+    {
+        return glm::max(GetFileLastWriteTimestamp(program.filepath.c_str()), GetFileLastWriteTimestamp(SHADER_COMMON_FILE));
+    }
+
+    void SubmitProgram(App* app, Program& program)
+    {
+        assert(program.pendingHandle == 0);
+        f64 submitStart = glfwGetTime();
+
+        String commonSource = ReadTextFile(SHADER_COMMON_FILE);
+        String programSource = ReadTextFile(program.filepath.c_str());
+        program.lastWriteTimestamp = GetProgramSourceTimestamp(program);
+
+        const u32 shaderCount = program.isCompute ? 1 : 2;
+        const GLenum shaderTypes[2] = { program.isCompute ? (GLenum)GL_COMPUTE_SHADER : (GLenum)GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+        const char* stageDefines[2] = { program.isCompute ? "#define COMPUTE\n" : "#define VERTEX\n", "#define FRAGMENT\n" };
+
+        ShaderSource shaderSources[2];
+        program.binaryHash = driverHash;
+        for (u32 i = 0; i < shaderCount; ++i)
+        {
+            BuildShaderSource(shaderSources[i], stageDefines[i], commonSource, programSource, program.programName.c_str(), program.defines.c_str());
+            program.binaryHash = HashShaderSource(shaderSources[i], program.binaryHash);
+        }
+
+        if (programCacheEnabled)
+        {
+            if (LoadCachedProgram(app, program))
+                return;
+
+            app->programCacheStats.misses++;
+        }
+
+        for (u32 i = 0; i < shaderCount; ++i)
+        {
+            program.pendingShaders[i] = SubmitShader(shaderTypes[i], shaderSources[i]);
+        }
+
+        // Linking right away queues it behind the compiles instead of waiting for them
+        program.pendingHandle = glCreateProgram();
+        if (programCacheEnabled)
+        {
+            glProgramParameteri(program.pendingHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        for (u32 i = 0; i < shaderCount; ++i)
+        {
+            glAttachShader(program.pendingHandle, program.pendingShaders[i]);
+        }
+        glLinkProgram(program.pendingHandle);
+
+        program.compileTime = (f32)((glfwGetTime() - submitStart) * 1000.0);
+    }
+
+    // programDefines are added as #define lines after the program name, so one
+    // program block can be compiled in several variants
+    u32 LoadProgram(App* app, const char* filepath, const char* programName, const std::vector<const char*>& programDefines)
+    {
+        Program program = {};
+        for (const char* define : programDefines)
+        {
+            program.defines += "#define " + std::string(define) + "\n";
+        }
+        program.filepath = filepath;
+        program.programName = programName;
+
+        SubmitProgram(app, program);
+        app->programs.push_back(program);
+
+        return app->programs.size() - 1;
+    }
+
+    u32 LoadComputeProgram(App* app, const char* filepath, const char* programName)
+    {
+        Program program = {};
+        program.filepath = filepath;
+        program.programName = programName;
+        program.isCompute = true;
+
+        SubmitProgram(app, program);
+        app->programs.push_back(program);
+
+        return app->programs.size() - 1;
+    }
+
+    u32 PollPrograms(App* app)
+    {
+        u32 pendingCount = 0;
+        for (Program& program : app->programs)
+        {
+            if (program.pendingHandle == 0)
+                continue;
+
+            // Without the extension asking for the link status blocks until it is done
+            GLint completed = GL_TRUE;
+            if (app->parallelShaderCompile)
+            {
+                glGetProgramiv(program.pendingHandle, GL_COMPLETION_STATUS_KHR, &completed);
+            }
+
+            if (completed)
+                FinishProgram(app, program);
+            else
+                pendingCount++;
+        }
+
+        return pendingCount;
+    }
+
+    void WaitForProgram(App* app, u32 programIdx)
+    {
+        Program& program = app->programs[programIdx];
+        if (program.pendingHandle != 0)
+        {
+            FinishProgram(app, program);
+        }
+    }
+
+    void BindTexture(const Program& program, ProgramUniform sampler, GLuint textureHandle)
+    {
+        const i32 textureUnit = program.textureUnits[sampler];
+        if (textureUnit < 0)
+            return;
+
+        glActiveTexture(GL_TEXTURE0 + textureUnit);
+        glBindTexture(GL_TEXTURE_2D, textureHandle);
+    }
+
+    bool IsReady(const App* app, u32 programIdx)
+    {
+        return app->programs[programIdx].ready;
+    }
+
+    void ReloadChangedPrograms(App* app)
+    {
+        for (Program& program : app->programs)
+        {
+            if (program.pendingHandle != 0)
+                continue;
+
+            if (GetProgramSourceTimestamp(program) > program.lastWriteTimestamp)
+            {
+                ILOG("Reloading program %s from %s\n", program.programName.c_str(), program.filepath.c_str());
+                SubmitProgram(app, program);
+            }
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Globals.h"
+
+struct App;
+
+namespace ShaderCompiler
+{
+    // Programs are compiled through a queue: every shader is submitted up front
+    // and polled across frames, a program is only used once it is ready.
+    // GL_KHR_parallel_shader_compile lets the driver compile them in the background
+    bool LoadParallelShaderCompile();
+
+    // Linked programs are stored with glGetProgramBinary, keyed by a hash of their
+    // full source and the driver, so a hit skips compiling altogether
+    bool LoadProgramBinaryCache();
+
+    u32 LoadProgram(App* app, const char* filepath, const char* programName, const std::vector<const char*>& programDefines = {});
+
+    u32 LoadComputeProgram(App* app, const char* filepath, const char* programName);
+
+    void SubmitProgram(App* app, Program& program);
+
+    // Returns the programs still compiling
+    u32 PollPrograms(App* app);
+
+    void WaitForProgram(App* app, u32 programIdx);
+
+    bool IsReady(const App* app, u32 programIdx);
+
+    // Binds a texture to the unit the program reserved for that sampler at link time
+    void BindTexture(const Program& program, ProgramUniform sampler, GLuint textureHandle);
+
+    // Hot reload, the old program is used until the new one is ready
+    void ReloadChangedPrograms(App* app);
+}
\ No newline at end of file
@@ -0,0 +1,386 @@
+#include "TextureCompression.h"
+#include "platform.h"
+#include <thread>
+#include <cfloat>
+
+#define DDS_MAGIC 0x20534444 // "DDS "
+#define DDS_FOURCC(a, b, c, d) ((u32)(a) | ((u32)(b) << 8) | ((u32)(c) << 16) | ((u32)(d) << 24))
+
+// Written in the reserved words of the header so stale or foreign files are baked again
+#define COMPRESSED_TEXTURE_TAG DDS_FOURCC('A', 'P', 'T', 'X')
+#define COMPRESSED_TEXTURE_VERSION 1
+
+struct DDSPixelFormat
+{
+    u32 size;
+    u32 flags;
+    u32 fourCC;
+    u32 rgbBitCount;
+    u32 masks[4];
+};
+
+struct DDSHeader
+{
+    u32 magic;
+    u32 size;
+    u32 flags;
+    u32 height;
+    u32 width;
+    u32 linearSize;
+    u32 depth;
+    u32 mipMapCount;
+    u32 tag;
+    u32 version;
+    u64 sourceTimestamp;
+    u32 reserved1[7];
+    DDSPixelFormat pixelFormat;
+    u32 caps[4];
+    u32 reserved2;
+};
+
+static_assert(sizeof(DDSHeader) == 128, "DDS header layout");
+
+static const u32 FormatFourCC[BlockFormat_Count] = {
+    DDS_FOURCC('D', 'X', 'T', '1'),
+    DDS_FOURCC('D', 'X', 'T', '5'),
+    DDS_FOURCC('A', 'T', 'I', '2')
+};
+
+static u16 ToRGB565(vec3 color)
+{
+    color = glm::clamp(color, vec3(0.0f), vec3(255.0f));
+    return ((u16)(color.r * 31.0f / 255.0f + 0.5f) << 11) |
+           ((u16)(color.g * 63.0f / 255.0f + 0.5f) << 5) |
+           ((u16)(color.b * 31.0f / 255.0f + 0.5f));
+}
+
+static vec3 FromRGB565(u16 color)
+{
+    return vec3((color >> 11) & 31, (color >> 5) & 63, color & 31) * vec3(255.0f / 31.0f, 255.0f / 63.0f, 255.0f / 31.0f);
+}
+
+// Endpoints along the principal axis of the block colors, then the nearest of the 4 palette entries
+static void EncodeColorBlock(const u8 block[16][4], u8* out)
+{
+    vec3 colors[16];
+    vec3 mean = vec3(0.0f);
+    for (u32 i = 0; i < 16; ++i)
+    {
+        colors[i] = vec3(block[i][0], block[i][1], block[i][2]);
+        mean += colors[i];
+    }
+    mean /= 16.0f;
+
+    glm::mat3 covariance = glm::mat3(0.0f);
+    for (u32 i = 0; i < 16; ++i)
+    {
+        const vec3 d = colors[i] - mean;
+        covariance += glm::outerProduct(d, d);
+    }
+
+    vec3 axis = vec3(1.0f);
+    for (u32 i = 0; i < 4; ++i)
+    {
+        axis = covariance * axis;
+        const f32 length = glm::length(axis);
+        if (length < 1e-4f)
+        {
+            axis = vec3(0.57735f);
+            break;
+        }
+        axis /= length;
+    }
+
+    f32 minT = FLT_MAX;
+    f32 maxT = -FLT_MAX;
+    for (u32 i = 0; i < 16; ++i)
+    {
+        const f32 t = glm::dot(colors[i] - mean, axis);
+        minT = glm::min(minT, t);
+        maxT = glm::max(maxT, t);
+    }
+
+    u16 c0 = ToRGB565(mean + axis * maxT);
+    u16 c1 = ToRGB565(mean + axis * minT);
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    // c0 > c1 selects the 4 color mode, equal endpoints only use index 0
+    u32 indices = 0;
+    if (c0 != c1)
+    {
+        vec3 palette[4];
+        palette[0] = FromRGB565(c0);
+        palette[1] = FromRGB565(c1);
+        palette[2] = (2.0f * palette[0] + palette[1]) / 3.0f;
+        palette[3] = (palette[0] + 2.0f * palette[1]) / 3.0f;
+
+        for (u32 i = 0; i < 16; ++i)
+        {
+            u32 best = 0;
+            f32 bestDistance = FLT_MAX;
+            for (u32 j = 0; j < 4; ++j)
+            {
+                const vec3 d = colors[i] - palette[j];
+                const f32 distance = glm::dot(d, d);
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = j;
+                }
+            }
+            indices |= best << (2 * i);
+        }
+    }
+
+    out[0] = c0 & 0xFF;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 0xFF;
+    out[3] = c1 >> 8;
+    memcpy(out + 4, &indices, sizeof(indices));
+}
+
+// Single channel block, 8 interpolated values between the channel extremes
+static void EncodeChannelBlock(const u8 block[16][4], u32 channel, u8* out)
+{
+    u8 a0 = 0;
+    u8 a1 = 255;
+    for (u32 i = 0; i < 16; ++i)
+    {
+        a0 = glm::max(a0, block[i][channel]);
+        a1 = glm::min(a1, block[i][channel]);
+    }
+
+    u64 indices = 0;
+    if (a0 != a1)
+    {
+        u32 palette[8];
+        palette[0] = a0;
+        palette[1] = a1;
+        for (u32 j = 2; j < 8; ++j)
+            palette[j] = ((8 - j) * a0 + (j - 1) * a1 + 3) / 7;
+
+        for (u32 i = 0; i < 16; ++i)
+        {
+            u64 best = 0;
+            u32 bestDistance = UINT32_MAX;
+            for (u32 j = 0; j < 8; ++j)
+            {
+                const u32 distance = glm::abs((i32)block[i][channel] - (i32)palette[j]);
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = j;
+                }
+            }
+            indices |= best << (3 * i);
+        }
+    }
+
+    out[0] = a0;
+    out[1] = a1;
+    for (u32 i = 0; i < 6; ++i)
+        out[2 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+static void CompressBlockRows(const TextureMip& level, u32 channels, BlockFormat format, u32 firstRow, u32 lastRow, u8* out)
+{
+    const u32 blocksX = (level.size.x + 3) / 4;
+    const u32 blockBytes = TextureCompression::GetBlockBytes(format);
+
+    for (u32 by = firstRow; by < lastRow; ++by)
+    {
+        for (u32 bx = 0; bx < blocksX; ++bx)
+        {
+            // Texels past the edge repeat the last row and column
+            u8 block[16][4];
+            for (u32 i = 0; i < 16; ++i)
+            {
+                const i32 x = glm::min<i32>(bx * 4 + i % 4, level.size.x - 1);
+                const i32 y = glm::min<i32>(by * 4 + i / 4, level.size.y - 1);
+                const u8* texel = level.pixels.data() + (y * level.size.x + x) * channels;
+                block[i][0] = texel[0];
+                block[i][1] = texel[1];
+                block[i][2] = texel[2];
+                block[i][3] = channels == 4 ? texel[3] : 255;
+            }
+
+            u8* dst = out + (by * blocksX + bx) * blockBytes;
+            switch (format)
+            {
+            case BlockFormat_BC1: EncodeColorBlock(block, dst); break;
+            case BlockFormat_BC3: EncodeChannelBlock(block, 3, dst); EncodeColorBlock(block, dst + 8); break;
+            case BlockFormat_BC5: EncodeChannelBlock(block, 0, dst); EncodeChannelBlock(block, 1, dst + 8); break;
+            default: break;
+            }
+        }
+    }
+}
+
+namespace TextureCompression
+{
+    bool LoadBlockCompression()
+    {
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &formatCount);
+        std::vector<GLint> formats(formatCount);
+        if (formatCount > 0)
+            glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats.data());
+
+        bool bc1 = false;
+        bool bc3 = false;
+        for (GLint format : formats)
+        {
+            bc1 |= format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            bc3 |= format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        }
+
+        return (bc1 && bc3) || glfwExtensionSupported("GL_EXT_texture_compression_s3tc");
+    }
+
+    GLenum GetInternalFormat(BlockFormat format)
+    {
+        switch (format)
+        {
+        case BlockFormat_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BlockFormat_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BlockFormat_BC5: return GL_COMPRESSED_RG_RGTC2;
+        default: return GL_NONE;
+        }
+    }
+
+    u32 GetBlockBytes(BlockFormat format)
+    {
+        return format == BlockFormat_BC1 ? 8 : 16;
+    }
+
+    u32 GetLevelSize(BlockFormat format, ivec2 size)
+    {
+        return ((size.x + 3) / 4) * ((size.y + 3) / 4) * GetBlockBytes(format);
+    }
+
+    BlockFormat ChooseFormat(const Image& image, bool normalMap)
+    {
+        if (normalMap)
+            return BlockFormat_BC5;
+
+        if (image.nchannels == 4)
+        {
+            const u8* pixels = (const u8*)image.pixels;
+            for (i32 i = 0; i < image.size.x * image.size.y; ++i)
+                if (pixels[i * 4 + 3] != 255)
+                    return BlockFormat_BC3;
+        }
+
+        return BlockFormat_BC1;
+    }
+
+    void CompressLevel(const TextureMip& level, u32 channels, BlockFormat format, TextureMip& compressed)
+    {
+        const u32 blockRows = (level.size.y + 3) / 4;
+        compressed.size = level.size;
+        compressed.pixels.resize(GetLevelSize(format, level.size));
+
+        const u32 threadCount = glm::clamp(std::thread::hardware_concurrency(), 1u, glm::max(blockRows / 16, 1u));
+        if (threadCount == 1)
+        {
+            CompressBlockRows(level, channels, format, 0, blockRows, compressed.pixels.data());
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        const u32 rowsPerThread = (blockRows + threadCount - 1) / threadCount;
+        for (u32 i = 0; i < threadCount; ++i)
+        {
+            const u32 firstRow = i * rowsPerThread;
+            const u32 lastRow = glm::min(firstRow + rowsPerThread, blockRows);
+            if (firstRow < lastRow)
+                threads.emplace_back(CompressBlockRows, std::cref(level), channels, format, firstRow, lastRow, compressed.pixels.data());
+        }
+
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    bool WriteCompressedTexture(const char* filename, const char* sourceFilename, BlockFormat format, const std::vector<TextureMip>& levels)
+    {
+        DDSHeader header = {};
+        header.magic = DDS_MAGIC;
+        header.size = sizeof(DDSHeader) - sizeof(header.magic);
+        header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; // Caps, height, width, pixel format, mip count, linear size
+        header.height = levels[0].size.y;
+        header.width = levels[0].size.x;
+        header.linearSize = levels[0].pixels.size();
+        header.mipMapCount = levels.size();
+        header.tag = COMPRESSED_TEXTURE_TAG;
+        header.version = COMPRESSED_TEXTURE_VERSION;
+        header.sourceTimestamp = GetFileLastWriteTimestamp(sourceFilename);
+        header.pixelFormat.size = sizeof(DDSPixelFormat);
+        header.pixelFormat.flags = 0x4; // FourCC
+        header.pixelFormat.fourCC = FormatFourCC[format];
+        header.caps[0] = 0x1000 | 0x400000 | 0x8; // Texture, mipmap, complex
+
+        FILE* file = fopen(filename, "wb");
+        if (!file)
+        {
+            ELOG("fopen() failed writing compressed texture %s", filename);
+            return false;
+        }
+
+        fwrite(&header, sizeof(header), 1, file);
+        for (const TextureMip& level : levels)
+            fwrite(level.pixels.data(), 1, level.pixels.size(), file);
+
+        fclose(file);
+        return true;
+    }
+
+    bool ReadCompressedTexture(const char* filename, BlockFormat& format, std::vector<TextureMip>& levels)
+    {
+        FILE* file = fopen(filename, "rb");
+        if (!file)
+            return false;
+
+        DDSHeader header = {};
+        bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == DDS_MAGIC &&
+                     header.tag == COMPRESSED_TEXTURE_TAG && header.version == COMPRESSED_TEXTURE_VERSION;
+
+        format = BlockFormat_Count;
+        for (u32 i = 0; valid && i < BlockFormat_Count; ++i)
+            if (header.pixelFormat.fourCC == FormatFourCC[i])
+                format = (BlockFormat)i;
+        valid = valid && format != BlockFormat_Count && header.mipMapCount > 0;
+
+        levels.clear();
+        for (u32 i = 0; valid && i < header.mipMapCount; ++i)
+        {
+            TextureMip level;
+            level.size = glm::max(ivec2(header.width >> i, header.height >> i), ivec2(1));
+            level.pixels.resize(GetLevelSize(format, level.size));
+            valid = fread(level.pixels.data(), 1, level.pixels.size(), file) == level.pixels.size();
+            levels.push_back(std::move(level));
+        }
+
+        fclose(file);
+        if (!valid)
+        {
+            ELOG("Compressed texture %s is corrupt", filename);
+        }
+        return valid;
+    }
+
+    bool IsCompressedTextureUpToDate(const char* filename, const char* sourceFilename)
+    {
+        FILE* file = fopen(filename, "rb");
+        if (!file)
+            return false;
+
+        DDSHeader header = {};
+        bool upToDate = fread(&header, sizeof(header), 1, file) == 1 && header.magic == DDS_MAGIC &&
+                        header.tag == COMPRESSED_TEXTURE_TAG && header.version == COMPRESSED_TEXTURE_VERSION &&
+                        header.sourceTimestamp == GetFileLastWriteTimestamp(sourceFilename);
+
+        fclose(file);
+        return upToDate;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Globals.h"
+#include "TextureStreamer.h"
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+enum BlockFormat
+{
+    BlockFormat_BC1,  // Opaque color
+    BlockFormat_BC3,  // Color with alpha
+    BlockFormat_BC5,  // Two channels, normal maps keep X and Y
+    BlockFormat_Count
+};
+
+// Textures are compressed into 4x4 blocks when they are baked, with their whole
+// mip chain, and stored in a DDS file next to their source
+namespace TextureCompression
+{
+    // BC5 is core, BC1 and BC3 need S3TC
+    bool LoadBlockCompression();
+
+    GLenum GetInternalFormat(BlockFormat format);
+
+    u32 GetBlockBytes(BlockFormat format);
+
+    u32 GetLevelSize(BlockFormat format, ivec2 size);
+
+    BlockFormat ChooseFormat(const Image& image, bool normalMap);
+
+    // Rows of blocks are split across threads on large levels
+    void CompressLevel(const TextureMip& level, u32 channels, BlockFormat format, TextureMip& compressed);
+
+    bool WriteCompressedTexture(const char* filename, const char* sourceFilename, BlockFormat format, const std::vector<TextureMip>& levels);
+
+    bool ReadCompressedTexture(const char* filename, BlockFormat& format, std::vector<TextureMip>& levels);
+
+    bool IsCompressedTextureUpToDate(const char* filename, const char* sourceFilename);
+}
\ No newline at end of file
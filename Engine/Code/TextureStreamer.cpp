@@ -0,0 +1,161 @@
+#include "TextureStreamer.h"
+#include "BufferSupFunctions.h"
+
+static void GetLevelRows(const TextureUpload& upload, const TextureMip& mip, u32& rowSize, u32& rowCount)
+{
+    if (upload.blockBytes)
+    {
+        rowSize = ((mip.size.x + 3) / 4) * upload.blockBytes;
+        rowCount = (mip.size.y + 3) / 4;
+    }
+    else
+    {
+        rowSize = mip.size.x * upload.channels;
+        rowCount = mip.size.y;
+    }
+}
+
+void TextureStreamer::Init(u32 maxFrameBytes)
+{
+    stagingBuffer = BufferManager::CreateRingBuffer(maxFrameBytes, GL_PIXEL_UNPACK_BUFFER, 4);
+    throughputStart = glfwGetTime();
+}
+
+void TextureStreamer::Enqueue(TextureUpload& upload)
+{
+    for (const TextureMip& mip : upload.mips)
+    {
+        pendingBytes += mip.pixels.size();
+    }
+
+    upload.nextLevel = upload.mips.size() - 1;
+    upload.nextRow = 0;
+    queue.push_back(std::move(upload));
+}
+
+void TextureStreamer::Update(std::vector<Texture>& textures, u32 frameRegion, u32 budgetBytes)
+{
+    struct RowCopy
+    {
+        u32 uploadIdx;
+        i32 level;
+        u32 firstRow;
+        u32 rowCount;
+        u64 offset;
+        bool completesLevel;
+    };
+
+    std::vector<RowCopy> copies;
+    u32 finishedUploads = 0;
+    u32 frameBytes = 0;
+    budgetBytes = glm::min(budgetBytes, stagingBuffer.regionSize);
+
+    if (queue.empty())
+    {
+        AccountThroughput(0);
+        return;
+    }
+
+    // Stage the rows that fit the budget, front to back
+    BufferManager::BeginRingRegion(stagingBuffer, frameRegion);
+    for (u32 uploadIdx = 0; uploadIdx < queue.size(); ++uploadIdx)
+    {
+        TextureUpload& upload = queue[uploadIdx];
+        while (upload.nextLevel >= 0)
+        {
+            TextureMip& mip = upload.mips[upload.nextLevel];
+            u32 rowSize, levelRows;
+            GetLevelRows(upload, mip, rowSize, levelRows);
+            const u32 stagingLeft = stagingBuffer.regionStart + stagingBuffer.regionSize - BufferManager::Align(stagingBuffer.head, 4);
+            const u32 bytesLeft = glm::min(budgetBytes - frameBytes, stagingLeft);
+
+            u32 rowCount = glm::min(levelRows - upload.nextRow, bytesLeft / rowSize);
+
+            // A row wider than the whole budget still goes through, alone in its frame
+            if (rowCount == 0 && frameBytes == 0 && rowSize <= stagingLeft)
+                rowCount = 1;
+            if (rowCount == 0)
+                break;
+
+            BufferManager::AlignHead(stagingBuffer, 4);
+            const u64 offset = stagingBuffer.head;
+            PushData(stagingBuffer, mip.pixels.data() + upload.nextRow * rowSize, rowCount * rowSize);
+            frameBytes += rowCount * rowSize;
+
+            upload.nextRow += rowCount;
+            const bool completesLevel = upload.nextRow == levelRows;
+            copies.push_back({ uploadIdx, upload.nextLevel, upload.nextRow - rowCount, rowCount, offset, completesLevel });
+
+            if (completesLevel)
+            {
+                // Staged, the decoded copy is no longer needed
+                pendingBytes -= mip.pixels.size();
+                std::vector<u8>().swap(mip.pixels);
+
+                upload.nextLevel--;
+                upload.nextRow = 0;
+            }
+        }
+
+        if (upload.nextLevel >= 0)
+            break;
+
+        finishedUploads++;
+    }
+    BufferManager::EndRingRegion(stagingBuffer);
+
+    if (!copies.empty())
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer.handle);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        for (const RowCopy& copy : copies)
+        {
+            const TextureUpload& upload = queue[copy.uploadIdx];
+            const ivec2 levelSize = glm::max(ivec2(upload.mips[0].size.x >> copy.level, upload.mips[0].size.y >> copy.level), ivec2(1));
+
+            glBindTexture(GL_TEXTURE_2D, upload.handle);
+            if (upload.blockBytes)
+            {
+                const u32 y = copy.firstRow * 4;
+                const u32 height = glm::min(copy.rowCount * 4, (u32)levelSize.y - y);
+                const u32 size = copy.rowCount * ((levelSize.x + 3) / 4) * upload.blockBytes;
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, copy.level, 0, y, levelSize.x, height, upload.dataFormat, size, (void*)copy.offset);
+            }
+            else
+            {
+                glTexSubImage2D(GL_TEXTURE_2D, copy.level, 0, copy.firstRow, levelSize.x, copy.rowCount, upload.dataFormat, GL_UNSIGNED_BYTE, (void*)copy.offset);
+            }
+
+            // Sampling starts at the largest complete level, the texture is used from its smallest one on
+            if (copy.completesLevel)
+            {
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, copy.level);
+                textures[upload.textureIdx].handle = upload.handle;
+            }
+        }
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    for (u32 i = 0; i < finishedUploads; ++i)
+    {
+        queue.pop_front();
+    }
+
+    AccountThroughput(frameBytes);
+}
+
+void TextureStreamer::AccountThroughput(u32 frameBytes)
+{
+    throughputBytes += frameBytes;
+    const f64 now = glfwGetTime();
+    if (now - throughputStart >= 0.5)
+    {
+        throughput = (f32)(throughputBytes / (now - throughputStart));
+        throughputBytes = 0;
+        throughputStart = now;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Globals.h"
+#include <deque>
+
+struct TextureMip
+{
+    std::vector<u8> pixels;
+    ivec2 size;
+};
+
+// A texture with its whole mip chain decoded, waiting to be copied into its storage
+struct TextureUpload
+{
+    u32 textureIdx;
+    GLuint handle;    // Immutable storage for every level, swapped in once the smallest one is uploaded
+    GLenum dataFormat;        // Internal format of the blocks when they are compressed
+    u32 channels;
+    u32 blockBytes;           // 0 for uncompressed levels, rows are then rows of texels instead of blocks
+    std::vector<TextureMip> mips;
+    i32 nextLevel;    // Levels go from the smallest to the largest
+    u32 nextRow;
+};
+
+// Uploads decoded textures through a persistently mapped pixel unpack ring,
+// one region per frame fenced by the frame fences, and never more than the
+// given budget per frame. Levels are split by rows, of texels or of 4x4 blocks,
+// when they don't fit
+class TextureStreamer
+{
+public:
+
+    void Init(u32 maxFrameBytes);
+
+    void Enqueue(TextureUpload& upload);
+
+    // Must run between BeginFrameRegion and EndFrameRegion
+    void Update(std::vector<Texture>& textures, u32 frameRegion, u32 budgetBytes);
+
+    u32 GetMaxFrameBytes() const { return stagingBuffer.regionSize; }
+
+    u32 GetQueueDepth() const { return queue.size(); }
+
+    u64 GetPendingBytes() const { return pendingBytes; }
+
+    // Bytes per second, averaged over the last half second
+    f32 GetThroughput() const { return throughput; }
+
+private:
+
+    void AccountThroughput(u32 frameBytes);
+
+    Buffer stagingBuffer;
+    std::deque<TextureUpload> queue;
+    u64 pendingBytes = 0;
+
+    f64 throughputStart = 0.0;
+    u64 throughputBytes = 0;
+    f32 throughput = 0.0f;
+};
\ No newline at end of file
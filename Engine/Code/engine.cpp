@@ -7,171 +7,88 @@
 
 #include "engine.h"
 #include <imgui.h>
+#include <algorithm>
 #include "ModelLoadingFunctions.h"
+#include "CullingFunctions.h"
+#include "ShaderFunctions.h"
+#include "TextureCompression.h"
 
-GLuint CreateProgramFromSource(String programSource, const char* shaderName)
+GLenum GetIndexType(u32 indexSize)
 {
-    GLchar  infoLogBuffer[1024] = {};
-    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
-    GLsizei infoLogSize;
-    GLint   success;
-
-    char versionString[] = "#version 430\n";
-    char shaderNameDefine[128];
-    sprintf(shaderNameDefine, "#define %s\n", shaderName);
-    char vertexShaderDefine[] = "#define VERTEX\n";
-    char fragmentShaderDefine[] = "#define FRAGMENT\n";
-
-    const GLchar* vertexShaderSource[] = {
-        versionString,
-        shaderNameDefine,
-        vertexShaderDefine,
-        programSource.str
-    };
-    const GLint vertexShaderLengths[] = {
-        (GLint)strlen(versionString),
-        (GLint)strlen(shaderNameDefine),
-        (GLint)strlen(vertexShaderDefine),
-        (GLint)programSource.len
-    };
-    const GLchar* fragmentShaderSource[] = {
-        versionString,
-        shaderNameDefine,
-        fragmentShaderDefine,
-        programSource.str
-    };
-    const GLint fragmentShaderLengths[] = {
-        (GLint)strlen(versionString),
-        (GLint)strlen(shaderNameDefine),
-        (GLint)strlen(fragmentShaderDefine),
-        (GLint)programSource.len
-    };
-
-    GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vshader, ARRAY_COUNT(vertexShaderSource), vertexShaderSource, vertexShaderLengths);
-    glCompileShader(vshader);
-    glGetShaderiv(vshader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with vertex shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
-    }
-
-    GLuint fshader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fshader, ARRAY_COUNT(fragmentShaderSource), fragmentShaderSource, fragmentShaderLengths);
-    glCompileShader(fshader);
-    glGetShaderiv(fshader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with fragment shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
-    }
-
-    GLuint programHandle = glCreateProgram();
-    glAttachShader(programHandle, vshader);
-    glAttachShader(programHandle, fshader);
-    glLinkProgram(programHandle);
-    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
-    }
-
-    glUseProgram(0);
-
-    glDetachShader(programHandle, vshader);
-    glDetachShader(programHandle, fshader);
-    glDeleteShader(vshader);
-    glDeleteShader(fshader);
-
-    return programHandle;
+    return indexSize == sizeof(u16) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
+GLuint CreateVAO(GLuint vertexBufferHandle, GLuint indexBufferHandle, const VertexBufferLayout& vertexBufferLayout, const Program& program, GLuint instanceIndexBufferHandle)
 {
-    String programSource = ReadTextFile(filepath);
+    GLuint vaoHandle = 0;
+    glGenVertexArrays(1, &vaoHandle);
+    glBindVertexArray(vaoHandle);
 
-    Program program = {};
-    program.handle = CreateProgramFromSource(programSource, programName);
-    program.filepath = filepath;
-    program.programName = programName;
-    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferHandle);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferHandle);
 
-    GLint attributeCount = 0;
-    glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
-    for (GLuint i = 0; i < attributeCount; i++)
+    auto& ShaderLayout = program.shaderLayout.attributes;
+    for (auto shaderIt = ShaderLayout.cbegin(); shaderIt != ShaderLayout.cend(); ++shaderIt)
     {
-        GLsizei bufSize = 256;
-        GLsizei length = 0;
-        GLint size = 0;
-        GLenum type = 0;
-        GLchar name[256];
-        glGetActiveAttrib(program.handle, i, ARRAY_COUNT(name), &length, &size, &type, name);
-
-        u8 location = glGetAttribLocation(program.handle, name);
-        program.shaderLayout.attributes.push_back(VertexShaderAttribute{ location, u8(size) });
-    }
-
-    app->programs.push_back(program);
-
-    return app->programs.size() - 1;
-}
-
-GLuint FindVAO(Mesh& mesh, u32 subMeshIdx, const Program& program)
-{
-    GLuint returnValue = 0;
-
-    SubMesh& subMesh = mesh.subMeshes[subMeshIdx];
-    for (u32 i = 0; i < (u32)subMesh.vaos.size(); ++i)
-    {
-        if (subMesh.vaos[i].programHandle == program.handle)
+        if (shaderIt->location == INSTANCE_INDEX_LOCATION)
         {
-            returnValue = subMesh.vaos[i].handle;
-            break;
+            // One index per instance, offset by the baseInstance of the draw
+            assert(instanceIndexBufferHandle != 0);
+            glBindBuffer(GL_ARRAY_BUFFER, instanceIndexBufferHandle);
+            glVertexAttribIPointer(INSTANCE_INDEX_LOCATION, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+            glVertexAttribDivisor(INSTANCE_INDEX_LOCATION, 1);
+            glEnableVertexAttribArray(INSTANCE_INDEX_LOCATION);
+            glBindBuffer(GL_ARRAY_BUFFER, vertexBufferHandle);
+            continue;
         }
-    }
 
-    if (returnValue == 0)
-    {
-        glGenVertexArrays(1, &returnValue);
-        glBindVertexArray(returnValue);
-
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-
-        auto& ShaderLayout = program.shaderLayout.attributes;
-        for (auto shaderIt = ShaderLayout.cbegin(); shaderIt != ShaderLayout.cend(); ++shaderIt)
+        bool attributeWasLinked = false;
+        auto& BufferLayout = vertexBufferLayout.attributes;
+        for (auto bufferIt = BufferLayout.cbegin(); bufferIt != BufferLayout.cend(); ++bufferIt)
         {
-            bool attributeWasLinked = false;
-            auto& SubMeshLayout = subMesh.vertexBufferLayout.attributes;
-            for (auto subMeshIt = SubMeshLayout.cbegin(); subMeshIt != SubMeshLayout.cend(); ++subMeshIt)
+            if (shaderIt->location == bufferIt->location)
             {
-                if (shaderIt->location == subMeshIt->location)
-                {
-                    const u32 index = subMeshIt->location;
-                    const u32 ncomp = subMeshIt->componentCount;
-                    const u32 offset = subMeshIt->offset + subMesh.vertexOffset;
-                    const u32 stride = subMesh.vertexBufferLayout.stride;
-
-                    glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
-                    glEnableVertexAttribArray(index);
+                const u32 index = bufferIt->location;
+                const u32 ncomp = bufferIt->componentCount;
+                const u32 offset = bufferIt->offset;
+                const u32 stride = vertexBufferLayout.stride;
 
-                    attributeWasLinked = true;
-                    break;
+                switch (bufferIt->format)
+                {
+                case VertexFormat_Float: glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset); break;
+                case VertexFormat_Half: glVertexAttribPointer(index, ncomp, GL_HALF_FLOAT, GL_FALSE, stride, (void*)(u64)offset); break;
+                case VertexFormat_SNorm16: glVertexAttribPointer(index, ncomp, GL_SHORT, GL_TRUE, stride, (void*)(u64)offset); break;
+                case VertexFormat_SNorm10_10_10_2: glVertexAttribPointer(index, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(u64)offset); break;
                 }
-            }
+                glEnableVertexAttribArray(index);
 
-            assert(attributeWasLinked);
+                attributeWasLinked = true;
+                break;
+            }
         }
 
-        glBindVertexArray(0);
+        assert(attributeWasLinked);
+    }
 
-        VAO vao = { returnValue, program.handle };
-        subMesh.vaos.push_back(vao);
+    glBindVertexArray(0);
+
+    return vaoHandle;
+}
+
+GLuint FindVAO(GeometryPool& pool, const Program& program, GLuint instanceIndexBufferHandle = 0)
+{
+    for (u32 i = 0; i < (u32)pool.vaos.size(); ++i)
+    {
+        if (pool.vaos[i].programHandle == program.handle)
+            return pool.vaos[i].handle;
     }
 
-    return returnValue;
+    GLuint vaoHandle = CreateVAO(pool.vertexBufferHandle, pool.indexBufferHandle, pool.vertexBufferLayout, program, instanceIndexBufferHandle);
+
+    VAO vao = { vaoHandle, program.handle };
+    pool.vaos.push_back(vao);
+
+    return vaoHandle;
 }
 
 glm::mat4 TranformScale(const vec3& scaleFactors)
@@ -189,6 +106,37 @@ glm::mat4 RotateMatrix(const glm::mat4 matrix, const vec3& direction)
     return glm::rotate(matrix, 1.0f, direction);
 }
 
+f32 ComputeLightRadius(const Light& light)
+{
+    // Same attenuation terms as the lighting shaders, the radius is the distance
+    // at which the brightest channel falls under 5/256
+    const f32 constant = 1.0f;
+    const f32 lineal = 0.09f;
+    const f32 quadratic = 0.032f;
+    const f32 maxBrightness = glm::max(glm::max(light.color.r, light.color.g), light.color.b);
+
+    return (-lineal + sqrtf(lineal * lineal - 4.0f * quadratic * (constant - (256.0f / 5.0f) * maxBrightness))) / (2.0f * quadratic);
+}
+
+f32 ComputeEnclosingScale(const Mesh& mesh)
+{
+    // The faces of a low poly sphere cut inside the unit sphere, scaling it by
+    // the inverse of the closest face distance makes it enclose the whole sphere
+    f32 minFaceDistance = 1.0f;
+    for (const SubMesh& subMesh : mesh.subMeshes)
+    {
+        for (u32 i = 0; i + 2 < subMesh.lods[0].indexCount; i += 3)
+        {
+            const vec3 v0 = ModelLoader::GetPosition(mesh, subMesh, ModelLoader::GetIndex(subMesh, i + 0));
+            const vec3 v1 = ModelLoader::GetPosition(mesh, subMesh, ModelLoader::GetIndex(subMesh, i + 1));
+            const vec3 v2 = ModelLoader::GetPosition(mesh, subMesh, ModelLoader::GetIndex(subMesh, i + 2));
+            const vec3 normal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+            minFaceDistance = glm::min(minFaceDistance, glm::abs(glm::dot(normal, v0)));
+        }
+    }
+    return 1.0f / minFaceDistance;
+}
+
 void Init(App* app)
 {
     // TODO: Initialize your resources here!
@@ -228,23 +176,56 @@ void Init(App* app)
 
     app->camera.SetCamera(app->displaySize.x, app->displaySize.y, vec3(5, 5, 5));
 
+    // Models and textures stream in through the asset pipeline, the placeholders are loaded right away
+    app->assetPipeline.Start(glm::max(std::thread::hardware_concurrency(), 2u) - 1);
+    app->blockCompression = TextureCompression::LoadBlockCompression();
+    app->whiteTexIdx = ModelLoader::LoadTexture2D(app, "color_white.png", false);
+    app->magentaTexIdx = ModelLoader::LoadTexture2D(app, "color_magenta.png", false);
+
+    // Every program is submitted here and keeps compiling while the assets load
+    app->parallelShaderCompile = ShaderCompiler::LoadParallelShaderCompile();
+    app->programBinaryCache = ShaderCompiler::LoadProgramBinaryCache();
+
     // Forward Mode
-    app->renderToBackBufferShader = LoadProgram(app, "renderToBackBuffer.glsl", "RENDER_TO_BACK_BUFFER");
+    app->renderToBackBufferShader = ShaderCompiler::LoadProgram(app, "renderToBackBuffer.glsl", "RENDER_TO_BACK_BUFFER");
+    app->depthPrepassShader = ShaderCompiler::LoadProgram(app, "renderToBackBuffer.glsl", "DEPTH_PREPASS");
 
     // Deferred Mode
-    app->renderToFrameBufferShader = LoadProgram(app, "renderToFrameBuffer.glsl", "RENDER_TO_FRAMEBUFFER");
-    app->frameBufferToQuadShader = LoadProgram(app, "frameBufferToQuad.glsl", "FRAMEBUFFER_TO_QUAD");
-
-    app->renderIndicatorsShader = LoadProgram(app, "shaders.glsl", "RENDER_INDICATORS");
+    app->renderToFrameBufferShader[GBufferLayout_Full] = ShaderCompiler::LoadProgram(app, "renderToFrameBuffer.glsl", "RENDER_TO_FRAMEBUFFER");
+    app->frameBufferToQuadShader[GBufferLayout_Full] = ShaderCompiler::LoadProgram(app, "frameBufferToQuad.glsl", "FRAMEBUFFER_TO_QUAD");
+
+    app->renderToFrameBufferShader[GBufferLayout_Compact] = ShaderCompiler::LoadProgram(app, "renderToFrameBuffer.glsl", "RENDER_TO_FRAMEBUFFER", { "COMPACT_GBUFFER" });
+    app->frameBufferToQuadShader[GBufferLayout_Compact] = ShaderCompiler::LoadProgram(app, "frameBufferToQuad.glsl", "FRAMEBUFFER_TO_QUAD", { "COMPACT_GBUFFER" });
+
+    app->renderIndicatorsShader = ShaderCompiler::LoadProgram(app, "shaders.glsl", "RENDER_INDICATORS");
+
+    // Clustered lighting
+    app->lightCullingShader = ShaderCompiler::LoadComputeProgram(app, "lightCulling.glsl", "CLUSTERED_LIGHT_CULLING");
+    app->depthPyramidShader = ShaderCompiler::LoadComputeProgram(app, "occlusionCulling.glsl", "DEPTH_PYRAMID");
+    app->occlusionCullShader = ShaderCompiler::LoadComputeProgram(app, "occlusionCulling.glsl", "OCCLUSION_CULL");
+    app->occlusionCommandsShader = ShaderCompiler::LoadComputeProgram(app, "occlusionCulling.glsl", "OCCLUSION_COMMANDS");
+    app->meshletCullShader = ShaderCompiler::LoadComputeProgram(app, "occlusionCulling.glsl", "MESHLET_CULL");
+    app->lightHeatmapShader[GBufferLayout_Full] = ShaderCompiler::LoadProgram(app, "frameBufferToQuad.glsl", "LIGHT_HEATMAP");
+    app->lightHeatmapShader[GBufferLayout_Compact] = ShaderCompiler::LoadProgram(app, "frameBufferToQuad.glsl", "LIGHT_HEATMAP", { "COMPACT_GBUFFER" });
+
+    // Light volumes
+    app->frameBufferToQuadDirectionalShader[GBufferLayout_Full] = ShaderCompiler::LoadProgram(app, "frameBufferToQuad.glsl", "FRAMEBUFFER_TO_QUAD_DIRECTIONAL");
+    app->frameBufferToQuadDirectionalShader[GBufferLayout_Compact] = ShaderCompiler::LoadProgram(app, "frameBufferToQuad.glsl", "FRAMEBUFFER_TO_QUAD_DIRECTIONAL", { "COMPACT_GBUFFER" });
+    app->lightVolumeStencilShader = ShaderCompiler::LoadProgram(app, "lightVolume.glsl", "LIGHT_VOLUME_STENCIL");
+    app->lightVolumeShader[GBufferLayout_Full] = ShaderCompiler::LoadProgram(app, "lightVolume.glsl", "LIGHT_VOLUME");
+    app->lightVolumeShader[GBufferLayout_Compact] = ShaderCompiler::LoadProgram(app, "lightVolume.glsl", "LIGHT_VOLUME", { "COMPACT_GBUFFER" });
+
+    if (app->programBinaryCache)
+    {
+        ILOG("Program cache: %u hits, %u misses, %.2f ms saved\n", app->programCacheStats.hits, app->programCacheStats.misses, app->programCacheStats.timeSaved);
+    }
 
-    const Program& texturedGeometryProgram = app->programs[app->renderToBackBufferShader];
-    app->programUniformTexture = glGetUniformLocation(texturedGeometryProgram.handle, "uTexture");
     u32 patrickModelIndex = ModelLoader::LoadModel(app, "Patrick/Patrick.obj");
     u32 groundModelIndex = ModelLoader::LoadModel(app, "Patrick/Ground.obj");
 
     VertexBufferLayout vertexBufferLayout = {};
-    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
-    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, 3 * sizeof(float) });
+    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0, VertexFormat_Float });
+    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, 3 * sizeof(float), VertexFormat_Float });
     vertexBufferLayout.stride = 5 * sizeof(float);
 
     glEnable(GL_DEPTH_TEST);
@@ -252,24 +233,65 @@ void Init(App* app)
 
     glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->maxUniformBufferSize);
     glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBlockAlignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &app->storageBlockAlignment);
+
+    app->persistentRingBuffers = BufferManager::LoadBufferStorage();
+    const u32 ringAlignment = glm::max(app->uniformBlockAlignment, app->storageBlockAlignment);
+
+    app->localUniformBuffer = BufferManager::CreateRingBuffer(app->maxUniformBufferSize, GL_UNIFORM_BUFFER, ringAlignment);
+
+    app->instanceBuffer = BufferManager::CreateRingBuffer(MAX_INSTANCES * sizeof(glm::mat4), GL_SHADER_STORAGE_BUFFER, ringAlignment);
+    app->instanceIndexBuffer = CreateStaticVertexBuffer(MAX_INSTANCES * sizeof(u32));
+    BufferManager::MapBuffer(app->instanceIndexBuffer, GL_WRITE_ONLY);
+    for (u32 i = 0; i < MAX_INSTANCES; ++i)
+    {
+        PushUInt(app->instanceIndexBuffer, i);
+    }
+    BufferManager::UnmapBuffer(app->instanceIndexBuffer);
+
+    app->indirectBuffer = BufferManager::CreateRingBuffer(MAX_INDIRECT_COMMANDS * sizeof(DrawElementsIndirectCommand), GL_DRAW_INDIRECT_BUFFER, ringAlignment);
+
+    app->textureStreamer.Init(MAX_TEXTURE_UPLOAD_BYTES);
 
-    app->localUniformBuffer = CreateConstantBuffer(app->maxUniformBufferSize);
+    // Occlusion culling, the bounds are streamed and the rest only lives on the GPU
+    app->instanceBoundsBuffer = BufferManager::CreateRingBuffer(MAX_INSTANCES * sizeof(InstanceBounds), GL_SHADER_STORAGE_BUFFER, ringAlignment);
+    app->culledInstanceBuffer = BufferManager::CreateBuffer(MAX_INSTANCES * sizeof(glm::mat4), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+    app->culledCommandBuffer = BufferManager::CreateBuffer(2 * MAX_INDIRECT_COMMANDS * sizeof(DrawElementsIndirectCommand), GL_DRAW_INDIRECT_BUFFER, GL_DYNAMIC_COPY);
+    app->groupCounterBuffer = BufferManager::CreateBuffer(2 * MAX_INSTANCES * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+    app->rejectedBuffer = BufferManager::CreateBuffer(MAX_INSTANCES * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
 
-    app->entities.push_back({ TransformPositionScale(vec3(2.0, 0.0, -4.0), vec3(1.0, 1.0, 1.0)), patrickModelIndex, 0, 0 });
-    app->entities.push_back({ TransformPositionScale(vec3(0.0, 0.0, 0.0), vec3(1.0, 1.0, 1.0)), patrickModelIndex, 0, 0 });
-    app->entities.push_back({ TransformPositionScale(vec3(-2.0, 0.0, 4.0), vec3(1.0, 1.0, 1.0)), patrickModelIndex, 0, 0 });
+    // Meshlet culling, the jobs are streamed and the commands only live on the GPU
+    app->meshletJobBuffer = BufferManager::CreateRingBuffer(MAX_MESHLET_COMMANDS * sizeof(MeshletJob), GL_SHADER_STORAGE_BUFFER, ringAlignment);
+    app->meshletCommandBuffer = BufferManager::CreateBuffer(2 * MAX_MESHLET_COMMANDS * sizeof(DrawElementsIndirectCommand), GL_DRAW_INDIRECT_BUFFER, GL_DYNAMIC_COPY);
+    app->meshletRejectedBuffer = BufferManager::CreateBuffer(MAX_MESHLET_COMMANDS * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
 
-    app->entities.push_back({ TransformPositionScale(vec3(0.0, -5.0, 0.0), vec3(1.0, 1.0, 1.0)), groundModelIndex, 0, 0});
+    app->entities.push_back({ TransformPositionScale(vec3(2.0, 0.0, -4.0), vec3(1.0, 1.0, 1.0)), patrickModelIndex, BVH_NULL_NODE, 0 });
+    app->entities.push_back({ TransformPositionScale(vec3(0.0, 0.0, 0.0), vec3(1.0, 1.0, 1.0)), patrickModelIndex, BVH_NULL_NODE, 0 });
+    app->entities.push_back({ TransformPositionScale(vec3(-2.0, 0.0, 4.0), vec3(1.0, 1.0, 1.0)), patrickModelIndex, BVH_NULL_NODE, 0 });
+
+    app->entities.push_back({ TransformPositionScale(vec3(0.0, -5.0, 0.0), vec3(1.0, 1.0, 1.0)), groundModelIndex, BVH_NULL_NODE, 0 });
+
+    app->lights.push_back({ LightType::LightType_Directional, vec3(1.0, 1.0, 1.0), vec3(-1.0, -1.0, 0.0), vec3(0.0, 3.0, 0.0), 0.0f, BVH_NULL_NODE });
+    app->lights.push_back({ LightType::LightType_Directional, vec3(1.0, 1.0, 1.0), vec3(0.0, -1.0, 1.0), vec3(0.0, 5.0, 0.0), 0.0f, BVH_NULL_NODE });
+    app->lights.push_back({ LightType::LightType_Directional, vec3(1.0, 1.0, 1.0), vec3(0.0, 0.0, -1.0), vec3(0.0, 7.0, 0.0), 0.0f, BVH_NULL_NODE });
+
+    app->lights.push_back({ LightType::LightType_Point, vec3(1.0, 0.0, 0.0), vec3(1.0, 1.0, 1.0), vec3(-7.0, 1.0, -2.0), 0.0f, BVH_NULL_NODE });
+    app->lights.push_back({ LightType::LightType_Point, vec3(0.0, 1.0, 0.0), vec3(1.0, 1.0, 1.0), vec3(0.0, 2.0, -1.0), 0.0f, BVH_NULL_NODE });
+    app->lights.push_back({ LightType::LightType_Point, vec3(0.0, 0.0, 1.0), vec3(1.0, 1.0, 1.0), vec3(3.0, 3.0, 5.0), 0.0f, BVH_NULL_NODE });
+
+    for (size_t i = 0; i < app->lights.size(); ++i)
+    {
+        app->lights[i].radius = ComputeLightRadius(app->lights[i]);
+    }
 
-    app->lights.push_back({ LightType::LightType_Directional, vec3(1.0, 1.0, 1.0), vec3(-1.0, -1.0, 0.0), vec3(0.0, 3.0, 0.0) });
-    app->lights.push_back({ LightType::LightType_Directional, vec3(1.0, 1.0, 1.0), vec3(0.0, -1.0, 1.0), vec3(0.0, 5.0, 0.0) });
-    app->lights.push_back({ LightType::LightType_Directional, vec3(1.0, 1.0, 1.0), vec3(0.0, 0.0, -1.0), vec3(0.0, 7.0, 0.0) });
+    app->BuildSpatialIndex();
 
-    app->lights.push_back({ LightType::LightType_Point, vec3(1.0, 0.0, 0.0), vec3(1.0, 1.0, 1.0), vec3(-7.0, 1.0, -2.0) });
-    app->lights.push_back({ LightType::LightType_Point, vec3(0.0, 1.0, 0.0), vec3(1.0, 1.0, 1.0), vec3(0.0, 2.0, -1.0) });
-    app->lights.push_back({ LightType::LightType_Point, vec3(0.0, 0.0, 1.0), vec3(1.0, 1.0, 1.0), vec3(3.0, 3.0, 5.0) });
+    app->lightBuffer = BufferManager::CreateRingBuffer(MAX_LIGHTS * sizeof(vec4) * 4, GL_SHADER_STORAGE_BUFFER, ringAlignment);
+    app->lightGridBuffer = BufferManager::CreateBuffer(CLUSTER_COUNT * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+    app->lightIndexBuffer = BufferManager::CreateBuffer(CLUSTER_COUNT * CLUSTER_MAX_LIGHTS * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
 
-    app->ConfigureFrameBuffer(app->deferredFrameBuffer);
+    // The depth pyramid is created by the first frame, at the render size
+    app->gpuProfiler.Init();
 
     app->mode = Mode_Deferred;
 
@@ -277,20 +299,156 @@ void Init(App* app)
     u32 squareModelIndex = ModelLoader::LoadModel(app, "Patrick/Quad.obj");
     u32 sphereModelIndex = ModelLoader::LoadModel(app, "Patrick/Sphere.obj");
 
+    // The scale is computed once the sphere is resident, until then there are no volumes to draw
+    app->lightVolumeModelIndex = sphereModelIndex;
+    app->lightVolumeScale = 1.0f;
+
     for (size_t i = 0; i < app->lights.size(); ++i)
     {
         u32 indicatorModel = (app->lights[i].type == LightType::LightType_Directional) ? squareModelIndex : sphereModelIndex;
-        app->lightsIndicators.push_back({ TransformPositionScale(app->lights[i].position, vec3(0.3, 0.3, 0.3)), indicatorModel, 0, 0 });
+        app->lightsIndicators.push_back({ TransformPositionScale(app->lights[i].position, vec3(0.3, 0.3, 0.3)), indicatorModel, BVH_NULL_NODE, 0 });
         app->lightsIndicators[i].worldMatrix = RotateMatrix(app->lightsIndicators[i].worldMatrix, app->lights[i].direction);
     }
+
+    // Forward mode is the fallback while the rest finish, so the first frame needs it
+    ShaderCompiler::WaitForProgram(app, app->renderToBackBufferShader);
+    ShaderCompiler::WaitForProgram(app, app->lightCullingShader);
+    app->pendingProgramCount = ShaderCompiler::PollPrograms(app);
 }
 
 void Gui(App* app)
 {
     ImGui::Begin("Info");
-    ImGui::Text("FPS: %f", 1.0f / app->deltaTime);
+    ImGui::Text("FPS: %f  GPU frame: %.3f ms", 1.0f / app->deltaTime, app->gpuProfiler.GetFrameTime());
     ImGui::Text("%s", app->openglDebugInfo.c_str());
 
+    ImGui::Checkbox("Instancing", &app->useInstancing);
+    ImGui::SameLine();
+    ImGui::Checkbox("Multi Draw Indirect", &app->useMultiDrawIndirect);
+    ImGui::Checkbox("Frustum Culling", &app->useFrustumCulling);
+    ImGui::SameLine();
+    ImGui::Checkbox("BVH", &app->useBVH);
+    ImGui::SameLine();
+    ImGui::Checkbox("Occlusion Culling", &app->useOcclusionCulling);
+    if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("Two phase Hi-Z culling, deferred mode with multi draw indirect only");
+    ImGui::Checkbox("Meshlet Culling", &app->useMeshletCulling);
+    if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("Frustum, cone and Hi-Z tests per meshlet of the LOD 0 draws, multi draw indirect only");
+    ImGui::SameLine();
+    ImGui::Text("Meshlet commands: %u", app->meshletCommands);
+    ImGui::Text("BVH height: %d  Lit entity pairs: %u  Entity ahead: %d", app->entityBVH.GetHeight(), (u32)app->lightEntityPairs.size(), app->pickedEntity == BVH_NULL_NODE ? -1 : (int)app->pickedEntity);
+    ImGui::Text("Visible entities: %u / %u  Geometry draw calls: %u", app->visibleEntityCount, (u32)app->entities.size(), app->drawCalls);
+    ImGui::Checkbox("LODs", &app->useLods);
+    ImGui::SameLine();
+    ImGui::Text("Triangles submitted: %u", app->submittedTriangles);
+    if (app->useLods)
+    {
+        ImGui::SliderFloat("LOD error (px)", &app->lodErrorThreshold, 0.25f, 8.0f);
+        ImGui::SliderFloat("LOD hysteresis", &app->lodHysteresis, 0.0f, 0.5f);
+    }
+    if (app->useMultiDrawIndirect)
+    {
+        ImGui::Text("%u indirect commands in %u multi draws", app->drawCommands, (u32)app->geometryBatches.size());
+    }
+    ImGui::Text("Programs compiling: %u (%s)", app->pendingProgramCount, app->parallelShaderCompile ? "parallel" : "serial");
+    if (app->programBinaryCache)
+    {
+        ImGui::Text("Program cache: %u hits, %u misses, %.2f ms saved", app->programCacheStats.hits, app->programCacheStats.misses, app->programCacheStats.timeSaved);
+    }
+    ImGui::Text("Assets streaming: %u on %u workers", app->assetPipeline.GetPendingTasks(), app->assetPipeline.GetWorkerCount());
+    ImGui::SliderFloat("Upload budget (ms)", &app->assetUploadBudget, 0.5f, 16.0f);
+    ImGui::Text("Texture uploads: %u queued, %.2f MB pending, %.2f MB/s", app->textureStreamer.GetQueueDepth(),
+                app->textureStreamer.GetPendingBytes() / (f32)MB(1), app->textureStreamer.GetThroughput() / (f32)MB(1));
+    i32 textureBudgetKB = app->textureUploadBudget / KB(1);
+    if (ImGui::SliderInt("Texture budget (KB/frame)", &textureBudgetKB, 64, app->textureStreamer.GetMaxFrameBytes() / KB(1)))
+        app->textureUploadBudget = textureBudgetKB * KB(1);
+    ImGui::Text("Ring buffers (%s): %.3f ms stall", app->persistentRingBuffers ? "persistent" : "unsynchronized map", app->ringStallTime);
+
+    // Triangle weighted, ATVR vertex weighted, as imported -> as baked
+    if (ImGui::TreeNode("Mesh optimization"))
+    {
+        for (const Mesh& mesh : app->meshes)
+        {
+            MeshStats importStats = {};
+            MeshStats bakeStats = {};
+            u32 triangleCount = 0;
+            u32 vertexCount = 0;
+            for (const SubMesh& subMesh : mesh.subMeshes)
+            {
+                const f32 triangles = subMesh.lods[0].indexCount / 3.0f;
+                importStats.acmr += subMesh.importStats.acmr * triangles;
+                importStats.overdraw += subMesh.importStats.overdraw * triangles;
+                importStats.overfetch += subMesh.importStats.overfetch * triangles;
+                bakeStats.acmr += subMesh.bakeStats.acmr * triangles;
+                bakeStats.overdraw += subMesh.bakeStats.overdraw * triangles;
+                bakeStats.overfetch += subMesh.bakeStats.overfetch * triangles;
+                importStats.atvr += subMesh.importStats.atvr * subMesh.vertexCount;
+                bakeStats.atvr += subMesh.bakeStats.atvr * subMesh.vertexCount;
+                triangleCount += subMesh.lods[0].indexCount / 3;
+                vertexCount += subMesh.vertexCount;
+            }
+            if (triangleCount == 0)
+                continue;
+
+            ImGui::Text("%s: %u triangles", mesh.name.c_str(), triangleCount);
+            ImGui::Text("  ACMR %.3f -> %.3f  ATVR %.3f -> %.3f", importStats.acmr / triangleCount, bakeStats.acmr / triangleCount,
+                        importStats.atvr / vertexCount, bakeStats.atvr / vertexCount);
+            std::string lodTriangles;
+            for (u32 lod = 0; lod < mesh.lodCount; ++lod)
+            {
+                u32 lodTriangleCount = 0;
+                for (const SubMesh& subMesh : mesh.subMeshes)
+                    lodTriangleCount += subMesh.lods[glm::min(lod, subMesh.lodCount - 1)].indexCount / 3;
+                lodTriangles += (lod ? " / " : "") + std::to_string(lodTriangleCount);
+            }
+            ImGui::Text("  LODs: %s triangles", lodTriangles.c_str());
+            ImGui::Text("  Overdraw %.3f -> %.3f  overfetch %.3f -> %.3f",
+                        importStats.overdraw / triangleCount, bakeStats.overdraw / triangleCount,
+                        importStats.overfetch / triangleCount, bakeStats.overfetch / triangleCount);
+        }
+        ImGui::TreePop();
+    }
+
+    // Read back a few frames late, averaged over the history, and nested by scope depth
+    if (ImGui::TreeNode("GPU profiler"))
+    {
+        const std::vector<GpuProfilerTrack>& tracks = app->gpuProfiler.GetTracks();
+        const u64 resolvedFrames = app->gpuProfiler.GetResolvedFrames();
+        if (!tracks.empty())
+        {
+            const u32 historyCount = (u32)glm::min(resolvedFrames, (u64)GPU_PROFILER_HISTORY);
+            const u32 historyOffset = (historyCount == GPU_PROFILER_HISTORY) ? resolvedFrames % GPU_PROFILER_HISTORY : 0;
+            ImGui::PlotLines("Frame (ms)", tracks[0].times, historyCount, historyOffset, NULL, 0.0f, FLT_MAX, ImVec2(0, 60));
+        }
+
+        for (const GpuProfilerTrack& track : tracks)
+        {
+            const f32 lastTime = resolvedFrames ? track.times[(resolvedFrames - 1) % GPU_PROFILER_HISTORY] : 0.0f;
+            ImGui::Text("%*s%s: %.3f ms (avg %.3f)", (int)track.depth * 2, "", track.name, lastTime, track.average);
+        }
+        ImGui::Text("Dropped frames: %u", app->gpuProfiler.GetDroppedFrames());
+
+        if (ImGui::Button("Export CSV"))
+        {
+            if (app->gpuProfiler.ExportCsv("gpu_profile.csv"))
+                ILOG("GPU profile written to gpu_profile.csv");
+        }
+        ImGui::TreePop();
+    }
+
+    // Pooled against what the transient targets would take without sharing textures
+    const std::vector<FrameGraphPass>& graphPasses = app->frameGraph.GetPasses();
+    const u32 culledPasses = (u32)std::count_if(graphPasses.begin(), graphPasses.end(), [](const FrameGraphPass& pass) { return pass.culled; });
+    ImGui::Text("Frame graph: %u passes, %u culled, %u textures %.2f MB (%.2f MB requested)", (u32)graphPasses.size(), culledPasses,
+                app->frameGraph.GetPooledTextureCount(), app->frameGraph.GetPooledBytes() / (f32)MB(1), app->frameGraph.GetRequestedBytes() / (f32)MB(1));
+    if (ImGui::TreeNode("Frame graph passes"))
+    {
+        for (const FrameGraphPass& pass : graphPasses)
+            ImGui::Text("%s%s", pass.name, pass.culled ? " (culled)" : "");
+        ImGui::TreePop();
+    }
+
     const char* renderModes[] = { "Forward", "Deferred" };
     if (ImGui::BeginCombo("Render Mode", renderModes[app->mode]))
     {
@@ -305,13 +463,52 @@ void Gui(App* app)
         ImGui::EndCombo();
     }
 
+    if (app->mode == Mode_Forward)
+    {
+        ImGui::Checkbox("Depth Pre-pass", &app->useDepthPrepass);
+    }
     
     if (app->mode == Mode_Deferred)
     {
-        const char* colorAttachments[] = { "Albedo", "Normals", "Position", "ViewDir", "Depth" };
+        ImGui::Checkbox("Point Light Volumes", &app->useLightVolumes);
+
+        ImGui::Checkbox("Dynamic Resolution", &app->useDynamicResolution);
+        if (app->useDynamicResolution)
+        {
+            ImGui::SliderFloat("Target GPU time (ms)", &app->targetGpuTime, 4.0f, 33.0f);
+            ImGui::SliderFloat("Min render scale", &app->minRenderScale, 0.25f, 1.0f);
+        }
+        ImGui::Text("Render scale: %.2f (%dx%d)", app->renderScale, app->renderSize.x, app->renderSize.y);
+
+        const char* layouts[] = { "Full (5 targets)", "Compact (2 targets)" };
+        if (ImGui::BeginCombo("G-Buffer Layout", layouts[app->gBufferLayout]))
+        {
+            for (int n = 0; n < ARRAY_COUNT(layouts); n++)
+            {
+                bool is_selected = (app->gBufferLayout == n);
+                if (ImGui::Selectable(layouts[n], is_selected))
+                {
+                    app->gBufferLayout = static_cast<GBufferLayout>(n);
+                    app->shownTextureIndex = 0;
+                }
+            }
+            ImGui::EndCombo();
+        }
+
+        // Bytes written per pixel by the geometry pass, depth-stencil included
+        const u32 gBufferPixelSize = (app->gBufferLayout == GBufferLayout_Compact) ? (4 + 4 + 4) : (4 + 4 * 8 + 4);
+        ImGui::Text("G-Buffer: %u bytes/pixel", gBufferPixelSize);
+
+        std::vector<const char*> colorAttachments;
+        if (app->gBufferLayout == GBufferLayout_Compact)
+            colorAttachments = { "Albedo", "Normals (Octahedral)", "Depth" };
+        else
+            colorAttachments = { "Albedo", "Normals", "Position", "ViewDir", "Depth" };
+        colorAttachments.push_back("Light Heatmap");
+
         if (ImGui::BeginCombo("Color Attachment", colorAttachments[app->shownTextureIndex]))
         {
-            for (int n = 0; n < ARRAY_COUNT(colorAttachments); n++)
+            for (int n = 0; n < (int)colorAttachments.size(); n++)
             {
                 bool is_selected = (app->shownTextureIndex == n);
                 if (ImGui::Selectable(colorAttachments[n], is_selected))
@@ -321,7 +518,13 @@ void Gui(App* app)
             }
             ImGui::EndCombo();
         }
-        ImGui::Image(ImTextureID(app->deferredFrameBuffer.colorAttachments[app->shownTextureIndex]), ImVec2(250, 150), ImVec2(0, 1), ImVec2(1, 0));
+
+        // Filled by the last frame, the heatmap is only drawn while it is shown
+        if (app->shownTextureIndex < (int)app->debugViewTextures.size() && app->debugViewTextures[app->shownTextureIndex] != 0)
+        {
+            ImGui::Image((ImTextureID)(intptr_t)app->debugViewTextures[app->shownTextureIndex], ImVec2(250, 150), ImVec2(0, 1), ImVec2(1, 0));
+        }
+        ImGui::Text("Point lights: %u", app->pointLightCount);
     }
 
     ImGui::End();
@@ -329,6 +532,11 @@ void Gui(App* app)
 
 void Update(App* app)
 {
+    ShaderCompiler::ReloadChangedPrograms(app);
+    app->pendingProgramCount = ShaderCompiler::PollPrograms(app);
+
+    app->assetPipeline.ResumeRenderThreadStages(app->assetUploadBudget);
+
     if (app->input.mouseButtons[1] == BUTTON_PRESSED) // Mouse left
     {
         if (app->input.keys[33] == BUTTON_PRESSED) // W
@@ -395,232 +603,961 @@ void App::Rotate(float pitch, float roll, float yaw, vec3& dir) {
 
 void Render(App* app)
 {
-    switch (app->mode)
+    // Ended after the ImGui draw, by the platform layer
+    app->gpuProfiler.BeginFrame();
+
+    // Minimized, there is nothing to size the targets to
+    if (app->displaySize.x <= 0 || app->displaySize.y <= 0)
+        return;
+
+    app->BeginFrameRegion();
+    app->textureStreamer.Update(app->textures, app->frameRegion, app->textureUploadBudget);
+    app->UpdateCamera();
+
+    // Deferred mode falls back to forward until all of its programs are linked
+    Mode frameMode = app->mode;
+    if (frameMode == Mode_Deferred && !app->DeferredProgramsReady())
+        frameMode = Mode_Forward;
+
+    app->UpdateRenderScale(frameMode);
+
+    // The transient targets follow the window in the frame graph, the pyramid outlives the frame
+    if (app->depthPyramidSize != app->renderSize)
+        app->CreateDepthPyramid();
+
+    app->UpdateLightBuffer();
+    app->UpdateEntityBuffer(frameMode);
+
+    FrameGraph& graph = app->frameGraph;
+    graph.Begin(app->displaySize);
+
+    const FrameGraphResource backBuffer = graph.ImportBackBuffer();
+    const FrameGraphResource lightClusters = graph.ImportBuffer("Light clusters", app->lightGridBuffer.handle);
+
+    const u32 lightCullingPass = graph.AddPass("Light culling", [app](const FrameGraph&, u32) { app->CullLights(); });
+    graph.Write(lightCullingPass, lightClusters);
+
+    // Deferred targets, the depth stencil one apart
+    u32 gBufferPass = FRAME_GRAPH_NONE;
+    std::vector<FrameGraphResource> gBuffer;
+    FrameGraphResource depthStencil = FRAME_GRAPH_NONE;
+    std::vector<FrameGraphResource> debugView;
+
+    switch (frameMode)
     {
     case Mode_Forward:
     {
-        app->UpdateEntityBuffer();
+        const u32 forwardPass = graph.AddPass("Forward", [app](const FrameGraph&, u32)
+        {
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            // Depth only first, so the lit pass shades every pixel once
+            const bool depthPrepass = app->useDepthPrepass && ShaderCompiler::IsReady(app, app->depthPrepassShader);
+            if (depthPrepass)
+            {
+                const Program& prepassProgram = app->programs[app->depthPrepassShader];
+                glUseProgram(prepassProgram.handle);
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+                app->RenderGeometry(prepassProgram, true);
+
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                glDepthFunc(GL_EQUAL);
+                glDepthMask(GL_FALSE);
+            }
 
-        const Program& forwardProgram = app->programs[app->renderToBackBufferShader];
-        glUseProgram(forwardProgram.handle);
+            const Program& forwardProgram = app->programs[app->renderToBackBufferShader];
+            glUseProgram(forwardProgram.handle);
 
-        app->RenderGeometry(forwardProgram);
+            app->RenderGeometry(forwardProgram);
 
-        glUseProgram(0);
+            if (depthPrepass)
+            {
+                glDepthFunc(GL_LESS);
+                glDepthMask(GL_TRUE);
+            }
+
+            glUseProgram(0);
+        });
+        graph.Read(forwardPass, lightClusters);
+        graph.Write(forwardPass, backBuffer);
     }
     break;
     case Mode_Deferred:
     {
-        app->UpdateEntityBuffer();
+        if (app->gBufferLayout == GBufferLayout_Compact)
+        {
+            gBuffer.push_back(graph.CreateTexture("Albedo", GL_RGBA8, app->renderSize));
+            gBuffer.push_back(graph.CreateTexture("Normals (Octahedral)", GL_RG16, app->renderSize));
+        }
+        else
+        {
+            gBuffer.push_back(graph.CreateTexture("Albedo", GL_RGBA8, app->renderSize));
+            gBuffer.push_back(graph.CreateTexture("Normals", GL_RGBA16F, app->renderSize));
+            gBuffer.push_back(graph.CreateTexture("Position", GL_RGBA16F, app->renderSize));
+            gBuffer.push_back(graph.CreateTexture("ViewDir", GL_RGBA16F, app->renderSize));
+            gBuffer.push_back(graph.CreateTexture("Depth", GL_RGBA16F, app->renderSize));
+        }
+        depthStencil = graph.CreateTexture("Depth stencil", GL_DEPTH24_STENCIL8, app->renderSize);
+        const FrameGraphResource depthPyramid = graph.ImportTexture("Depth pyramid", app->depthPyramidHandle);
 
-        // Render to FrameBuffer colorAttachments
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+        gBufferPass = graph.AddPass("G-buffer", [app](const FrameGraph&, u32)
+        {
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            const Program& deferredProgram = app->programs[app->renderToFrameBufferShader[app->gBufferLayout]];
+            glUseProgram(deferredProgram.handle);
+
+            if (app->useOcclusionCulling && app->useMultiDrawIndirect && app->OcclusionProgramsReady())
+                app->RenderGeometryOcclusionCulled(deferredProgram);
+            else
+                app->RenderGeometry(deferredProgram);
+        });
+        for (FrameGraphResource target : gBuffer)
+            graph.AddColorAttachment(gBufferPass, target);
+        graph.SetDepthAttachment(gBufferPass, depthStencil);
+        graph.Write(gBufferPass, depthPyramid);
+
+        auto readGBuffer = [&](u32 pass)
+        {
+            for (FrameGraphResource target : gBuffer)
+                graph.Read(pass, target);
+            graph.Read(pass, depthStencil);
+        };
 
-        glBindFramebuffer(GL_FRAMEBUFFER, app->deferredFrameBuffer.fbHandle);
+        if (app->useLightVolumes)
+        {
+            // Accumulated apart at the render size and blitted. The volumes stencil test against a copy of the
+            // G-buffer depth, the compact layout samples the original to rebuild positions
+            const FrameGraphResource lighting = graph.CreateTexture("Lighting", GL_RGBA16F, app->renderSize);
+            const FrameGraphResource volumeDepthStencil = graph.CreateTexture("Volume depth stencil", GL_DEPTH24_STENCIL8, app->renderSize);
+            const u32 lightVolumesPass = graph.AddPass("Light volumes", [app](const FrameGraph& graph, u32 pass) { app->RenderLightVolumes(graph.GetFramebuffer(pass)); });
+            readGBuffer(lightVolumesPass);
+            graph.AddColorAttachment(lightVolumesPass, lighting);
+            graph.SetDepthAttachment(lightVolumesPass, volumeDepthStencil);
+            graph.Write(lightVolumesPass, backBuffer);
+        }
+        else
+        {
+            // Shades every back buffer pixel from the G-buffer texel under it, the upscale of dynamic resolution
+            const u32 lightingPass = graph.AddPass("Lighting", [app](const FrameGraph&, u32)
+            {
+                glClearColor(0.1f, 0.1f, 0.1f, 0.1f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glDrawBuffers(app->deferredFrameBuffer.colorAttachments.size(), app->deferredFrameBuffer.colorAttachments.data());
+                const Program& frameBufferToQuadProgram = app->programs[app->frameBufferToQuadShader[app->gBufferLayout]];
+                glUseProgram(frameBufferToQuadProgram.handle);
 
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                // Render Quad
+                glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+                app->BindGBufferTextures(frameBufferToQuadProgram);
 
-        const Program& deferredProgram = app->programs[app->renderToFrameBufferShader];
-        glUseProgram(deferredProgram.handle);
+                glBindVertexArray(app->vao);
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
 
-        app->RenderGeometry(deferredProgram);
-        
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                glBindVertexArray(0);
+                glUseProgram(0);
+            });
+            readGBuffer(lightingPass);
+            graph.Read(lightingPass, lightClusters);
+            graph.Write(lightingPass, backBuffer);
+        }
+
+        // Only drawn when the debug view shows it, the graph culls it otherwise
+        FrameGraphResource lightHeatmap = FRAME_GRAPH_NONE;
+        if (ShaderCompiler::IsReady(app, app->lightHeatmapShader[app->gBufferLayout]))
+        {
+            // Looks its clusters up with the viewport the lighting shades in
+            lightHeatmap = graph.CreateTexture("Light heatmap", GL_RGBA8, app->shadingSize);
+            const u32 heatmapPass = graph.AddPass("Light heatmap", [app](const FrameGraph&, u32) { app->RenderLightHeatmap(); });
+            readGBuffer(heatmapPass);
+            graph.Read(heatmapPass, lightClusters);
+            graph.AddColorAttachment(heatmapPass, lightHeatmap);
+        }
 
-        // Render to BackBuffer from colorAttachments
-        glClearColor(0.1f, 0.1f, 0.1f, 0.1f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+        // The debug view samples its texture once the frame is over, so it must not be aliased
+        debugView = gBuffer;
+        if (app->gBufferLayout == GBufferLayout_Compact)
+            debugView.push_back(depthStencil);
+        debugView.push_back(lightHeatmap);
+
+        const u32 shownTexture = glm::min((u32)app->shownTextureIndex, (u32)debugView.size() - 1);
+        const u32 debugViewPass = graph.AddPass("Debug view", [](const FrameGraph&, u32) {});
+        if (debugView[shownTexture] != FRAME_GRAPH_NONE)
+            graph.Read(debugViewPass, debugView[shownTexture]);
+        graph.SetSideEffect(debugViewPass);
+    }
+    break;
+    default:;
+    }
 
-        const Program& frameBufferToQuadProgram = app->programs[app->frameBufferToQuadShader];
-        glUseProgram(frameBufferToQuadProgram.handle);
+    const u32 indicatorsPass = graph.AddPass("Light indicators", [app](const FrameGraph&, u32)
+    {
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        if (ShaderCompiler::IsReady(app, app->renderIndicatorsShader))
+        {
+            app->RenderIndicatorsGeometry();
+        }
+    });
+    graph.Write(indicatorsPass, backBuffer);
 
-        // Render Quad
-        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    graph.Compile();
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, app->deferredFrameBuffer.colorAttachments[0]);
-        glUniform1i(glGetUniformLocation(frameBufferToQuadProgram.handle, "uAlbedo"), 0);
+    // The passes reach the G-buffer through the app, and the GUI shows the debug view after the frame
+    if (gBufferPass != FRAME_GRAPH_NONE)
+    {
+        app->gBuffer.fbHandle = graph.GetFramebuffer(gBufferPass);
+        app->gBuffer.colorAttachments.clear();
+        for (FrameGraphResource target : gBuffer)
+            app->gBuffer.colorAttachments.push_back(graph.GetTexture(target));
+        app->gBuffer.depthHandle = graph.GetTexture(depthStencil);
+    }
 
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, app->deferredFrameBuffer.colorAttachments[1]);
-        glUniform1i(glGetUniformLocation(frameBufferToQuadProgram.handle, "uNormals"), 1);
+    app->debugViewTextures.clear();
+    for (FrameGraphResource texture : debugView)
+        app->debugViewTextures.push_back(texture != FRAME_GRAPH_NONE ? graph.GetTexture(texture) : 0);
 
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, app->deferredFrameBuffer.colorAttachments[2]);
-        glUniform1i(glGetUniformLocation(frameBufferToQuadProgram.handle, "uPosition"), 2);
+    graph.Execute(&app->gpuProfiler);
 
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, app->deferredFrameBuffer.colorAttachments[3]);
-        glUniform1i(glGetUniformLocation(frameBufferToQuadProgram.handle, "uViewDir"), 3);
+    app->EndFrameRegion();
+}
 
-        glBindVertexArray(app->vao);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+void Shutdown(App* app)
+{
+    app->assetPipeline.Stop();
+}
 
-        glBindVertexArray(0);
-        glUseProgram(0);
-        
+void App::OnModelResident(u32 modelIdx)
+{
+    // The entities were indexed with empty bounds while the model streamed in
+    for (u32 i = 0; i < entities.size(); ++i)
+    {
+        if (entities[i].modelIndex == modelIdx)
+        {
+            SetEntityTransform(i, entities[i].worldMatrix);
+        }
     }
-    break;
-    default:;
+
+    if (modelIdx == lightVolumeModelIndex)
+    {
+        lightVolumeScale = ComputeEnclosingScale(meshes[models[modelIdx].meshIdx]);
     }
+}
 
-    // lights indicators
-    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    app->UpdateIndicatorsBuffer();
-    app->RenderIndicatorsGeometry();
+bool App::DeferredProgramsReady() const
+{
+    if (!ShaderCompiler::IsReady(this, renderToFrameBufferShader[gBufferLayout]))
+        return false;
+
+    if (useLightVolumes)
+    {
+        return ShaderCompiler::IsReady(this, frameBufferToQuadDirectionalShader[gBufferLayout]) &&
+            ShaderCompiler::IsReady(this, lightVolumeStencilShader) &&
+            ShaderCompiler::IsReady(this, lightVolumeShader[gBufferLayout]);
+    }
+
+    return ShaderCompiler::IsReady(this, frameBufferToQuadShader[gBufferLayout]);
+}
+
+bool App::OcclusionProgramsReady() const
+{
+    return ShaderCompiler::IsReady(this, depthPyramidShader) &&
+        ShaderCompiler::IsReady(this, occlusionCullShader) &&
+        ShaderCompiler::IsReady(this, occlusionCommandsShader);
+}
+
+void App::BeginFrameRegion()
+{
+    frameRegion = (frameRegion + 1) % RING_BUFFER_FRAMES;
+
+    // Only waits when the GPU is still RING_BUFFER_FRAMES frames behind
+    ringStallTime = 0.0f;
+    GLsync& fence = frameFences[frameRegion];
+    if (fence != NULL)
+    {
+        f64 waitStart = glfwGetTime();
+        GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (glClientWaitSync(fence, waitFlags, 1000000) == GL_TIMEOUT_EXPIRED)
+        {
+            waitFlags = 0;
+        }
+        ringStallTime = (f32)((glfwGetTime() - waitStart) * 1000.0);
+
+        glDeleteSync(fence);
+        fence = NULL;
+    }
 }
 
-void App::UpdateEntityBuffer()
+void App::EndFrameRegion()
+{
+    frameFences[frameRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void App::UpdateCamera()
 {
     camera.UpdateCameraAspectRatio(displaySize.x, displaySize.y);
     camera.Matrix(60.0f, 0.1f, 1000.0f);
+    cameraFrustum = Culling::ExtractFrustum(camera.projection * camera.view);
+
+    // Entity straight ahead of the camera
+    pickedEntity = entityBVH.RayCast(camera.position, glm::normalize(camera.direction), camera.farPlane);
+}
+
+void App::UpdateRenderScale(Mode frameMode)
+{
+    // Only the frames read back since the last call, the profiler never waits on the GPU. Frames
+    // still in flight when the scale last changed are read back late and measure the old scale
+    if (gpuProfiler.GetResolvedFrames() != profiledFrames)
+    {
+        profiledFrames = gpuProfiler.GetResolvedFrames();
+        if (gpuProfiler.GetLastResolvedFrameIndex() >= renderScaleFrame)
+        {
+            gpuTimeSum += gpuProfiler.GetFrameTime();
+            gpuTimeSamples++;
+        }
+    }
+
+    if (!useDynamicResolution || frameMode != Mode_Deferred)
+    {
+        if (renderScale != 1.0f)
+            renderScaleFrame = gpuProfiler.GetFrameIndex();
+        renderScale = 1.0f;
+        gpuTimeSum = 0.0f;
+        gpuTimeSamples = 0;
+    }
+    else if (gpuTimeSamples >= RENDER_SCALE_INTERVAL)
+    {
+        // The scaled passes cost about the pixel count, the square of the scale. Half of the way to
+        // the ideal scale is taken, in whole steps, so the targets are not reallocated for noise
+        const f32 averageTime = gpuTimeSum / gpuTimeSamples;
+        if (glm::abs(averageTime - targetGpuTime) > targetGpuTime * 0.05f)
+        {
+            const f32 idealScale = renderScale * glm::sqrt(targetGpuTime / averageTime);
+            f32 scale = glm::round((renderScale + (idealScale - renderScale) * 0.5f) / RENDER_SCALE_STEP) * RENDER_SCALE_STEP;
+            if (glm::abs(scale - renderScale) < RENDER_SCALE_STEP * 0.5f)
+                scale = renderScale + (averageTime > targetGpuTime ? -RENDER_SCALE_STEP : RENDER_SCALE_STEP);
+            scale = glm::clamp(scale, minRenderScale, 1.0f);
+            if (scale != renderScale)
+            {
+                renderScale = scale;
+                renderScaleFrame = gpuProfiler.GetFrameIndex();
+            }
+        }
+
+        gpuTimeSum = 0.0f;
+        gpuTimeSamples = 0;
+    }
+
+    renderSize = glm::max(ivec2(vec2(displaySize) * renderScale), ivec2(1));
+
+    // The light volumes shade at the render size, the lighting quad in the back buffer
+    shadingSize = (frameMode == Mode_Deferred && useLightVolumes) ? renderSize : displaySize;
+}
+
+void App::BuildSpatialIndex()
+{
+    for (u32 i = 0; i < entities.size(); ++i)
+    {
+        entities[i].bvhProxy = entityBVH.CreateProxy(ComputeEntityAABB(entities[i]), i);
+    }
+
+    for (u32 i = 0; i < lights.size(); ++i)
+    {
+        Light& light = lights[i];
+        if (light.type == LightType_Point)
+        {
+            light.bvhProxy = lightBVH.CreateProxy({ light.position - vec3(light.radius), light.position + vec3(light.radius) }, i);
+        }
+        else
+        {
+            light.bvhProxy = BVH_NULL_NODE;
+        }
+    }
+}
+
+void App::SetEntityTransform(u32 entityIdx, const glm::mat4& worldMatrix)
+{
+    Entity& entity = entities[entityIdx];
+    entity.worldMatrix = worldMatrix;
+    entityBVH.MoveProxy(entity.bvhProxy, ComputeEntityAABB(entity));
+}
+
+AABB App::ComputeEntityAABB(const Entity& entity)
+{
+    const Mesh& mesh = meshes[models[entity.modelIndex].meshIdx];
+    return Culling::TransformAABB(mesh.aabb, entity.worldMatrix);
+}
 
-    BufferManager::MapBuffer(localUniformBuffer, GL_WRITE_ONLY);
+void App::UpdateEntityBuffer(Mode frameMode)
+{
+    BufferManager::BeginRingRegion(localUniformBuffer, frameRegion);
 
     // Global Params
     globalParamsOffset = localUniformBuffer.head;
     PushVec3(localUniformBuffer, camera.position);
-    PushUInt(localUniformBuffer, lights.size());
+    PushUInt(localUniformBuffer, directionalLightCount);
+    PushUInt(localUniformBuffer, pointLightCount);
+    PushFloat(localUniformBuffer, camera.nearPlane);
+    PushFloat(localUniformBuffer, camera.farPlane);
+    PushMat4(localUniformBuffer, camera.view);
+    PushMat4(localUniformBuffer, glm::inverse(camera.projection));
+    PushVec2(localUniformBuffer, vec2(shadingSize));
+    PushMat4(localUniformBuffer, camera.projection * camera.view);
+    PushMat4(localUniformBuffer, glm::inverse(camera.projection * camera.view));
+
+    globalParamsSize = localUniformBuffer.head - globalParamsOffset;
 
-    for (size_t i = 0; i < lights.size(); ++i)
+    BufferManager::EndRingRegion(localUniformBuffer);
+
+    CullEntities();
+    SelectLods();
+
+    // Instances, only the visible entities, the indicators go right after them
+    BufferManager::BeginRingRegion(instanceBuffer, frameRegion);
+    BufferManager::BeginRingRegion(instanceBoundsBuffer, frameRegion);
+    glm::mat4* instances = (glm::mat4*)(instanceBuffer.data + instanceBuffer.regionStart);
+    InstanceBounds* bounds = (InstanceBounds*)(instanceBoundsBuffer.data + instanceBoundsBuffer.regionStart);
+    u32 baseInstance = 0;
+    instanceDistances.resize(entities.size() + lightsIndicators.size());
+    PushInstanceGroups(entities, entityVisibility.data(), instanceGroups, instances, bounds, baseInstance);
+    entityInstanceCount = baseInstance;
+    PushInstanceGroups(lightsIndicators, nullptr, indicatorGroups, instances, nullptr, baseInstance);
+    BufferManager::EndRingRegion(instanceBoundsBuffer);
+    BufferManager::EndRingRegion(instanceBuffer);
+
+    BuildRenderQueue(frameMode);
+
+    // Indirect commands, in render queue order
+    BufferManager::BeginRingRegion(indirectBuffer, frameRegion);
+    PushIndirectBatches(RenderPass_Geometry, geometryBatches);
+    drawCommands = (indirectBuffer.head - indirectBuffer.regionStart) / sizeof(DrawElementsIndirectCommand);
+    PushIndirectBatches(RenderPass_Indicators, indicatorBatches);
+    BufferManager::EndRingRegion(indirectBuffer);
+
+    PushMeshletBatches();
+}
+
+void App::CullEntities()
+{
+    entityVisibility.resize(entities.size());
+    if (!useFrustumCulling)
+    {
+        std::fill(entityVisibility.begin(), entityVisibility.end(), 1);
+        visibleEntityCount = entities.size();
+        return;
+    }
+
+    if (useBVH)
     {
-        BufferManager::AlignHead(localUniformBuffer, sizeof(vec4));
+        visibleProxies.clear();
+        entityBVH.QueryFrustum(cameraFrustum, visibleProxies);
 
-        Light& light = lights[i];
-        PushUInt(localUniformBuffer, light.type);
-        PushVec3(localUniformBuffer, light.color);
-        PushVec3(localUniformBuffer, light.direction);
-        PushVec3(localUniformBuffer, light.position);
+        std::fill(entityVisibility.begin(), entityVisibility.end(), 0);
+        for (u32 entityIdx : visibleProxies)
+        {
+            entityVisibility[entityIdx] = 1;
+        }
+        visibleEntityCount = visibleProxies.size();
+        return;
     }
 
-    globalParamsSize = localUniformBuffer.head - globalParamsOffset;
+    entitySpheres.resize(entities.size());
+    for (u32 i = 0; i < entities.size(); ++i)
+    {
+        const Mesh& mesh = meshes[models[entities[i].modelIndex].meshIdx];
+        entitySpheres[i] = Culling::TransformSphere(mesh.sphere, entities[i].worldMatrix);
+    }
 
-    // Local Params
-    u32 iterator = 0;
-    for (auto it = entities.begin(); it != entities.end(); ++it)
+    Culling::CullSpheres(cameraFrustum, entitySpheres.data(), entitySpheres.size(), entityVisibility.data());
+
+    visibleEntityCount = 0;
+    for (u8 visible : entityVisibility)
     {
-        glm::mat4 world = it->worldMatrix;
-        glm::mat4 WVP = camera.projection * camera.view * world;
+        visibleEntityCount += visible;
+    }
+}
 
-        Buffer& localBuffer = localUniformBuffer;
-        BufferManager::AlignHead(localBuffer, uniformBlockAlignment);
-        it->localParamsOffset = localBuffer.head;
-        PushMat4(localBuffer, world);
-        PushMat4(localBuffer, WVP);
-        it->localParamSize = localBuffer.head - it->localParamsOffset;
-        iterator++;
+void App::SelectLods()
+{
+    // Pixels covered by one object space unit at a distance of one
+    const f32 pixelsPerUnit = camera.projection[1][1] * renderSize.y * 0.5f;
+
+    for (Entity& entity : entities)
+    {
+        const Mesh& mesh = meshes[models[entity.modelIndex].meshIdx];
+        if (!useLods || mesh.lodCount <= 1)
+        {
+            entity.lod = 0;
+            continue;
+        }
+
+        // The errors grow with the largest axis scale, and are as near as the nearest point of the sphere
+        const f32 scale = glm::max(glm::max(glm::length(vec3(entity.worldMatrix[0])), glm::length(vec3(entity.worldMatrix[1]))), glm::length(vec3(entity.worldMatrix[2])));
+        const vec3 center = vec3(entity.worldMatrix * vec4(mesh.sphere.center, 1.0f));
+        const f32 distance = glm::max(glm::distance(camera.position, center) - mesh.sphere.radius * scale, camera.nearPlane);
+        const f32 errorToPixels = scale * pixelsPerUnit / distance;
+
+        u32 lod = glm::min(entity.lod, mesh.lodCount - 1);
+        while (lod > 0 && mesh.lodErrors[lod] * errorToPixels > lodErrorThreshold * (1.0f + lodHysteresis))
+            lod--;
+        while (lod + 1 < mesh.lodCount && mesh.lodErrors[lod + 1] * errorToPixels <= lodErrorThreshold * (1.0f - lodHysteresis))
+            lod++;
+        entity.lod = lod;
     }
-    BufferManager::UnmapBuffer(localUniformBuffer);
 }
 
-void App::UpdateIndicatorsBuffer()
+void App::PushInstanceGroups(const std::vector<Entity>& instancedEntities, const u8* visibility, std::vector<InstanceGroup>& groups, glm::mat4* instances, InstanceBounds* bounds, u32& baseInstance)
 {
-    camera.UpdateCameraAspectRatio(displaySize.x, displaySize.y);
-    camera.Matrix(60.0f, 0.1f, 1000.0f);
+    // Counting sort of the entities by model and LOD so that every pair gets a
+    // contiguous range of world matrices
+    const u32 groupKeyCount = models.size() * MAX_MESH_LODS;
+    std::vector<u32> keyInstanceCount(groupKeyCount, 0);
+    for (u32 i = 0; i < instancedEntities.size(); ++i)
+    {
+        if (visibility == nullptr || visibility[i])
+            keyInstanceCount[instancedEntities[i].modelIndex * MAX_MESH_LODS + instancedEntities[i].lod]++;
+    }
 
-    BufferManager::MapBuffer(localUniformBuffer, GL_WRITE_ONLY);
+    groups.clear();
+    std::vector<u32> keyGroupIndex(groupKeyCount, 0);
+    for (u32 key = 0; key < groupKeyCount; ++key)
+    {
+        if (keyInstanceCount[key] == 0)
+            continue;
+
+        keyGroupIndex[key] = groups.size();
+        u32 capacity = glm::min(keyInstanceCount[key], (u32)MAX_INSTANCES - baseInstance);
+        groups.push_back({ key / MAX_MESH_LODS, key % MAX_MESH_LODS, baseInstance, 0 });
+        keyInstanceCount[key] = capacity;
+        baseInstance += capacity;
+    }
 
-    // Local Params
-    u32 iterator = 0;
-    for (auto it = lightsIndicators.begin(); it != lightsIndicators.end(); ++it)
+    for (u32 i = 0; i < instancedEntities.size(); ++i)
     {
-        glm::mat4 world = it->worldMatrix;
-        glm::mat4 WVP = camera.projection * camera.view * world;
+        if (visibility != nullptr && !visibility[i])
+            continue;
+
+        const Entity& entity = instancedEntities[i];
+        const u32 key = entity.modelIndex * MAX_MESH_LODS + entity.lod;
+        InstanceGroup& group = groups[keyGroupIndex[key]];
+        if (group.instanceCount == keyInstanceCount[key])
+            continue;
+
+        const u32 instanceIdx = group.baseInstance + group.instanceCount++;
+        // Quantized positions are expanded by the instance matrix
+        const vec4 dequantization = meshes[models[entity.modelIndex].meshIdx].dequantization;
+        instances[instanceIdx] = entity.worldMatrix * TransformPositionScale(vec3(dequantization), vec3(dequantization.w));
+        instanceDistances[instanceIdx] = glm::distance(camera.position, vec3(entity.worldMatrix[3]));
+
+        if (bounds != nullptr)
+        {
+            const AABB aabb = ComputeEntityAABB(entity);
+            bounds[instanceIdx] = { aabb.min, group.baseInstance, aabb.max, 0 };
+        }
+    }
+}
+
+void App::BuildRenderQueue(Mode frameMode)
+{
+    // Every draw of a pass shares its program, it only keeps the passes apart. The frame mode
+    // is the one drawn, forward while the deferred programs are still compiling
+    const u32 geometryProgram = (frameMode == Mode_Forward) ? renderToBackBufferShader : renderToFrameBufferShader[gBufferLayout];
+    const f32 inverseFarPlane = 1.0f / camera.farPlane;
+
+    auto pushDrawItems = [&](RenderPass pass, u32 programIdx, const std::vector<InstanceGroup>& groups, bool perInstance, bool sortByTexture)
+    {
+        for (const InstanceGroup& group : groups)
+        {
+            const Model& model = models[group.modelIndex];
+            const Mesh& mesh = meshes[model.meshIdx];
+
+            // A group is as near as its nearest instance
+            f32 groupDistance = camera.farPlane;
+            for (u32 j = 0; j < group.instanceCount; ++j)
+            {
+                groupDistance = glm::min(groupDistance, instanceDistances[group.baseInstance + j]);
+            }
+
+            for (u32 i = 0; i < mesh.subMeshes.size(); ++i)
+            {
+                const u32 vertexFormat = mesh.subMeshes[i].poolIdx;
+                const u32 textureIdx = sortByTexture ? materials[model.materialIdx[i]].albedoTextureIdx : 0;
+
+                if (!perInstance)
+                {
+                    const u64 key = RenderQueue::MakeSortKey(pass, programIdx, vertexFormat, textureIdx, groupDistance * inverseFarPlane);
+                    renderQueue.push_back({ key, group.modelIndex, i, group.lod, group.baseInstance, group.instanceCount });
+                    continue;
+                }
 
-        Buffer& localBuffer = localUniformBuffer;
-        BufferManager::AlignHead(localBuffer, uniformBlockAlignment);
-        it->localParamsOffset = localBuffer.head;
-        PushMat4(localBuffer, world);
-        PushMat4(localBuffer, WVP);
-        it->localParamSize = localBuffer.head - it->localParamsOffset;
-        iterator++;
+                for (u32 j = 0; j < group.instanceCount; ++j)
+                {
+                    const u32 instanceIdx = group.baseInstance + j;
+                    const u64 key = RenderQueue::MakeSortKey(pass, programIdx, vertexFormat, textureIdx, instanceDistances[instanceIdx] * inverseFarPlane);
+                    renderQueue.push_back({ key, group.modelIndex, i, group.lod, instanceIdx, 1 });
+                }
+            }
+        }
+    };
+
+    // Indirect commands keep their instance groups whole, the occlusion pass counts per group
+    renderQueue.clear();
+    pushDrawItems(RenderPass_Geometry, geometryProgram, instanceGroups, !useInstancing && !useMultiDrawIndirect, true);
+    pushDrawItems(RenderPass_Indicators, renderIndicatorsShader, indicatorGroups, false, false);
+
+    RenderQueue::RadixSort(renderQueue, renderQueueScratch);
+
+    submittedTriangles = 0;
+    for (const DrawItem& item : renderQueue)
+    {
+        if (RenderQueue::GetPass(item.key) != RenderPass_Geometry)
+            continue;
+
+        const SubMesh& subMesh = meshes[models[item.modelIdx].meshIdx].subMeshes[item.subMeshIdx];
+        submittedTriangles += subMesh.lods[glm::min(item.lod, subMesh.lodCount - 1)].indexCount / 3 * item.instanceCount;
+    }
+
+    u32 itemIdx = 0;
+    for (u32 pass = 0; pass < RenderPass_Count; ++pass)
+    {
+        renderQueuePassStart[pass] = itemIdx;
+        while (itemIdx < renderQueue.size() && RenderQueue::GetPass(renderQueue[itemIdx].key) == pass)
+            ++itemIdx;
     }
-    BufferManager::UnmapBuffer(localUniformBuffer);
+    renderQueuePassStart[RenderPass_Count] = itemIdx;
 }
 
-void App::ConfigureFrameBuffer(FrameBuffer& configFB)
+void App::PushIndirectBatches(RenderPass pass, std::vector<IndirectBatch>& batches)
 {
-    // Framebuffer class
-    configFB.colorAttachments.push_back(CreateTexture());
-    configFB.colorAttachments.push_back(CreateTexture(true));
-    configFB.colorAttachments.push_back(CreateTexture(true));
-    configFB.colorAttachments.push_back(CreateTexture(true));
-    configFB.colorAttachments.push_back(CreateTexture(true));
+    // Items sharing all the state bits of their key go in the same multi draw,
+    // without bindless textures a texture change still needs its own
+    batches.clear();
+    u64 batchState = UINT64_MAX;
+    for (u32 i = renderQueuePassStart[pass]; i < renderQueuePassStart[pass + 1]; ++i)
+    {
+        const u32 commandIdx = (indirectBuffer.head - indirectBuffer.regionStart) / sizeof(DrawElementsIndirectCommand);
+        if (commandIdx == MAX_INDIRECT_COMMANDS)
+            break;
 
-    glGenTextures(1, &configFB.depthHandle);
-    glBindTexture(GL_TEXTURE_2D, configFB.depthHandle);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, displaySize.x, displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D, 0);
+        const DrawItem& item = renderQueue[i];
+        if (pass == RenderPass_Geometry && UsesMeshletCulling(item))
+            continue;
+
+        const Model& model = models[item.modelIdx];
+        const SubMesh& subMesh = meshes[model.meshIdx].subMeshes[item.subMeshIdx];
+
+        const u64 state = RenderQueue::GetStateBits(item.key);
+        if (state != batchState)
+        {
+            batches.push_back({ subMesh.poolIdx, materials[model.materialIdx[item.subMeshIdx]].albedoTextureIdx, commandIdx, 0 });
+            batchState = state;
+        }
+
+        const MeshLod& lod = subMesh.lods[glm::min(item.lod, subMesh.lodCount - 1)];
+        DrawElementsIndirectCommand command = { lod.indexCount, item.instanceCount, subMesh.firstIndex + lod.firstIndex, (i32)subMesh.baseVertex, item.baseInstance };
+        PushData(indirectBuffer, &command, sizeof(DrawElementsIndirectCommand));
+        batches.back().commandCount++;
+    }
+}
+
+bool App::UsesMeshletCulling(const DrawItem& item) const
+{
+    if (!useMeshletCulling || !useMultiDrawIndirect || !ShaderCompiler::IsReady(this, meshletCullShader))
+        return false;
+
+    // Only LOD 0 is split, the coarser LODs are small enough to go whole
+    const SubMesh& subMesh = meshes[models[item.modelIdx].meshIdx].subMeshes[item.subMeshIdx];
+    return subMesh.meshletCount > 0 && glm::min(item.lod, subMesh.lodCount - 1) == 0;
+}
+
+void App::PushMeshletBatches()
+{
+    // Batched as PushIndirectBatches does, but the commands are written by the culling pass.
+    // Every instance gets a job per MESHLET_CULL_GROUP_SIZE meshlets of the submesh
+    meshletBatches.clear();
+    meshletCommands = 0;
+    meshletsCulled = false;
+
+    BufferManager::BeginRingRegion(meshletJobBuffer, frameRegion);
+    u64 batchState = UINT64_MAX;
+    for (u32 i = renderQueuePassStart[RenderPass_Geometry]; i < renderQueuePassStart[RenderPass_Geometry + 1]; ++i)
+    {
+        const DrawItem& item = renderQueue[i];
+        if (!UsesMeshletCulling(item))
+            continue;
+
+        const Model& model = models[item.modelIdx];
+        const SubMesh& subMesh = meshes[model.meshIdx].subMeshes[item.subMeshIdx];
+        if (meshletCommands + item.instanceCount * subMesh.meshletCount > MAX_MESHLET_COMMANDS)
+            break;
+
+        const u64 state = RenderQueue::GetStateBits(item.key);
+        if (state != batchState)
+        {
+            meshletBatches.push_back({ subMesh.poolIdx, materials[model.materialIdx[item.subMeshIdx]].albedoTextureIdx, meshletCommands, 0 });
+            batchState = state;
+        }
+
+        for (u32 j = 0; j < item.instanceCount; ++j)
+        {
+            for (u32 first = 0; first < subMesh.meshletCount; first += MESHLET_CULL_GROUP_SIZE)
+            {
+                const u32 count = glm::min(subMesh.meshletCount - first, (u32)MESHLET_CULL_GROUP_SIZE);
+                MeshletJob job = { item.baseInstance + j, subMesh.firstMeshlet + first, count, meshletCommands, subMesh.firstIndex, (i32)subMesh.baseVertex, {} };
+                PushData(meshletJobBuffer, &job, sizeof(MeshletJob));
+                meshletCommands += count;
+            }
+        }
+        meshletBatches.back().commandCount += item.instanceCount * subMesh.meshletCount;
+    }
+    meshletJobCount = (meshletJobBuffer.head - meshletJobBuffer.regionStart) / sizeof(MeshletJob);
+    BufferManager::EndRingRegion(meshletJobBuffer);
+}
 
-    glGenFramebuffers(1, &configFB.fbHandle);
-    glBindFramebuffer(GL_FRAMEBUFFER, configFB.fbHandle);
+void PushLight(Buffer& buffer, const Light& light)
+{
+    BufferManager::AlignHead(buffer, sizeof(vec4));
+    PushUInt(buffer, light.type);
+    PushVec3(buffer, light.color);
+    PushVec3(buffer, light.direction);
+    PushVec3(buffer, light.position);
+    PushFloat(buffer, light.radius);
+}
 
-    std::vector<GLuint> drawBuffers;
-    for (size_t i = 0; i < configFB.colorAttachments.size(); i++)
+void App::UpdateLightBuffer()
+{
+    // Point lights whose volume is out of the view can't light anything on screen
+    visibleLights.clear();
+    if (useFrustumCulling && useBVH)
     {
-        GLuint position = GL_COLOR_ATTACHMENT0 + i;
-        glFramebufferTexture(GL_FRAMEBUFFER, position, configFB.colorAttachments[i], 0);
-        drawBuffers.push_back(position);
+        lightBVH.QueryFrustum(cameraFrustum, visibleLights);
+        std::sort(visibleLights.begin(), visibleLights.end());
     }
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, configFB.depthHandle, 0);
+    else
+    {
+        for (u32 i = 0; i < lights.size(); ++i)
+        {
+            if (lights[i].type == LightType_Point)
+                visibleLights.push_back(i);
+        }
+    }
+
+    BufferManager::BeginRingRegion(lightBuffer, frameRegion);
 
-    glDrawBuffers(drawBuffers.size(), drawBuffers.data());
+    // Directional lights first, so the shaders can loop over them without checking
+    // the type and the culling pass only has to walk the point light range
+    directionalLightCount = 0;
+    for (const Light& light : lights)
+    {
+        if (light.type == LightType_Directional && directionalLightCount < MAX_LIGHTS)
+        {
+            PushLight(lightBuffer, light);
+            directionalLightCount++;
+        }
+    }
 
-    GLenum frameBufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if (frameBufferStatus != GL_FRAMEBUFFER_COMPLETE)
+    pointLightCount = glm::min((u32)visibleLights.size(), MAX_LIGHTS - directionalLightCount);
+    for (u32 i = 0; i < pointLightCount; ++i)
     {
-        int y = 0;
+        PushLight(lightBuffer, lights[visibleLights[i]]);
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    BufferManager::EndRingRegion(lightBuffer);
+
+    // Entities reached by every uploaded point light, in a single traversal
+    lightEntityPairs.clear();
+    if (useBVH)
+    {
+        std::vector<AABB> lightAABBs(pointLightCount);
+        for (u32 i = 0; i < pointLightCount; ++i)
+        {
+            const Light& light = lights[visibleLights[i]];
+            lightAABBs[i] = { light.position - vec3(light.radius), light.position + vec3(light.radius) };
+        }
+        entityBVH.QueryAABBBatch(lightAABBs.data(), pointLightCount, lightEntityPairs);
+    }
 }
 
-void App::RenderGeometry(const Program& bindedProgram)
+void App::CullLights()
 {
+    const Program& cullingProgram = programs[lightCullingShader];
+    glUseProgram(cullingProgram.handle);
+
     glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, globalParamsOffset, globalParamsSize);
-    for (auto it = entities.begin(); it != entities.end(); ++it)
+    BufferManager::BindRingRegion(lightBuffer, BINDING(0));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), lightGridBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(2), lightIndexBuffer.handle);
+
+    // Workgroups cover a whole XY slice of the grid and 4 Z slices
+    glDispatchCompute(1, 1, CLUSTER_GRID_Z / 4);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(0);
+}
+
+void App::RenderLightHeatmap()
+{
+    glDisable(GL_DEPTH_TEST);
+
+    const Program& heatmapProgram = programs[lightHeatmapShader[gBufferLayout]];
+    glUseProgram(heatmapProgram.handle);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, globalParamsOffset, globalParamsSize);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), lightGridBuffer.handle);
+    BindGBufferTextures(heatmapProgram);
+
+    glBindVertexArray(vao);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glEnable(GL_DEPTH_TEST);
+}
+
+void App::BindGBufferTextures(const Program& bindedProgram)
+{
+    if (gBufferLayout == GBufferLayout_Compact)
     {
-        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), localUniformBuffer.handle, it->localParamsOffset, it->localParamSize);
+        ShaderCompiler::BindTexture(bindedProgram, Uniform_Albedo, gBuffer.colorAttachments[0]);
+        ShaderCompiler::BindTexture(bindedProgram, Uniform_Normals, gBuffer.colorAttachments[1]);
+
+        // Position and view direction are rebuilt from it, it must not be attached to the pass sampling it
+        ShaderCompiler::BindTexture(bindedProgram, Uniform_Depth, gBuffer.depthHandle);
+        return;
+    }
+
+    ShaderCompiler::BindTexture(bindedProgram, Uniform_Albedo, gBuffer.colorAttachments[0]);
+    ShaderCompiler::BindTexture(bindedProgram, Uniform_Normals, gBuffer.colorAttachments[1]);
+    ShaderCompiler::BindTexture(bindedProgram, Uniform_Position, gBuffer.colorAttachments[2]);
+    ShaderCompiler::BindTexture(bindedProgram, Uniform_ViewDir, gBuffer.colorAttachments[3]);
+}
+
+void App::RenderLightVolumes(GLuint lightingFramebuffer)
+{
+    // The volumes test against their own copy of the depth, the G-buffer one is sampled
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer.fbHandle);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, lightingFramebuffer);
+    glBlitFramebuffer(0, 0, renderSize.x, renderSize.y, 0, 0, renderSize.x, renderSize.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, lightingFramebuffer);
+
+    glClearColor(0.1f, 0.1f, 0.1f, 0.1f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, globalParamsOffset, globalParamsSize);
+    BufferManager::BindRingRegion(lightBuffer, BINDING(0));
+
+    // Directional lights, one full screen pass
+    const Program& directionalProgram = programs[frameBufferToQuadDirectionalShader[gBufferLayout]];
+    glUseProgram(directionalProgram.handle);
+    BindGBufferTextures(directionalProgram);
+
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(vao);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
 
-        Model& model = models[it->modelIndex];
+    if (pointLightCount > 0)
+    {
+        Model& model = models[lightVolumeModelIndex];
         Mesh& mesh = meshes[model.meshIdx];
 
+        // Stencil pass: z-fail counting, a pixel ends with a non zero value only
+        // if its G-buffer depth lies inside at least one light volume
+        const Program& stencilProgram = programs[lightVolumeStencilShader];
+        glUseProgram(stencilProgram.handle);
+        glUniform1f(stencilProgram.uniformLocations[Uniform_VolumeScale], lightVolumeScale);
+        glUniform4fv(stencilProgram.uniformLocations[Uniform_Dequantization], 1, value_ptr(mesh.dequantization));
+
+        glClear(GL_STENCIL_BUFFER_BIT);
+        glEnable(GL_STENCIL_TEST);
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_DEPTH_CLAMP);
+        glDepthMask(GL_FALSE);
+        glDisable(GL_CULL_FACE);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glStencilFunc(GL_ALWAYS, 0, 0xFF);
+        glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+        glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+
         for (u32 i = 0; i < mesh.subMeshes.size(); ++i)
         {
-            GLuint vao = FindVAO(mesh, i, bindedProgram);
-            glBindVertexArray(vao);
-
-            u32 subMeshMaterialIdx = model.materialIdx[i];
-            Material subMeshMaterial = materials[subMeshMaterialIdx];
+            const SubMesh& subMesh = mesh.subMeshes[i];
+            glBindVertexArray(FindVAO(geometryPools[subMesh.poolIdx], stencilProgram));
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, subMesh.lods[0].indexCount, GetIndexType(subMesh.indexSize), (void*)((u64)subMesh.firstIndex * subMesh.indexSize), pointLightCount, subMesh.baseVertex);
+        }
 
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, textures[subMeshMaterial.albedoTextureIdx].handle);
-            glUniform1i(texturedMeshProgram_uTexture, 0);
+        // Lighting pass: back faces only so the volumes still shade when the
+        // camera is inside them, additive blending over the directional result
+        const Program& volumeProgram = programs[lightVolumeShader[gBufferLayout]];
+        glUseProgram(volumeProgram.handle);
+        glUniform1f(volumeProgram.uniformLocations[Uniform_VolumeScale], lightVolumeScale);
+        glUniform4fv(volumeProgram.uniformLocations[Uniform_Dequantization], 1, value_ptr(mesh.dequantization));
+        BindGBufferTextures(volumeProgram);
+
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        glEnable(GL_BLEND);
+        glBlendEquation(GL_FUNC_ADD);
+        glBlendFunc(GL_ONE, GL_ONE);
 
-            SubMesh& subMesh = mesh.subMeshes[i];
-            glDrawElements(GL_TRIANGLES, subMesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)subMesh.indexOffset);
+        for (u32 i = 0; i < mesh.subMeshes.size(); ++i)
+        {
+            const SubMesh& subMesh = mesh.subMeshes[i];
+            glBindVertexArray(FindVAO(geometryPools[subMesh.poolIdx], volumeProgram));
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, subMesh.lods[0].indexCount, GetIndexType(subMesh.indexSize), (void*)((u64)subMesh.firstIndex * subMesh.indexSize), pointLightCount, subMesh.baseVertex);
         }
+
+        glDisable(GL_BLEND);
+        glCullFace(GL_BACK);
+        glDisable(GL_STENCIL_TEST);
+        glDisable(GL_DEPTH_CLAMP);
+        glDepthMask(GL_TRUE);
     }
+
+    glEnable(GL_DEPTH_TEST);
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    // Copy the accumulated lighting to the BackBuffer
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, lightingFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    const GLenum filter = (renderSize != displaySize) ? GL_LINEAR : GL_NEAREST;
+    glBlitFramebuffer(0, 0, renderSize.x, renderSize.y, 0, 0, displaySize.x, displaySize.y, GL_COLOR_BUFFER_BIT, filter);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+void App::RenderGeometry(const Program& bindedProgram, bool depthOnly)
+{
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, globalParamsOffset, globalParamsSize);
+    BufferManager::BindRingRegion(instanceBuffer, BINDING(3));
+
+    // The depth of this frame won't be reduced, so the pyramid goes stale
+    depthPyramidValid = false;
+
+    if (useMultiDrawIndirect)
+    {
+        // A depth prepass draws the same meshlets, the commands are only culled once
+        if (!meshletBatches.empty() && !meshletsCulled)
+        {
+            CullMeshlets(0);
+            meshletsCulled = true;
+            glUseProgram(bindedProgram.handle);
+        }
+
+        SubmitIndirectBatches(bindedProgram, geometryBatches, !depthOnly, indirectBuffer.handle, indirectBuffer.regionStart);
+        SubmitIndirectBatches(bindedProgram, meshletBatches, !depthOnly, meshletCommandBuffer.handle, 0);
+        drawCalls = geometryBatches.size() + meshletBatches.size();
+        return;
+    }
+
+    SubmitDrawItems(bindedProgram, RenderPass_Geometry, !depthOnly);
+}
 
 void App::RenderIndicatorsGeometry()
 {
@@ -628,41 +1565,248 @@ void App::RenderIndicatorsGeometry()
     glUseProgram(program.handle);
 
     glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, globalParamsOffset, globalParamsSize);
-    for (auto it = lightsIndicators.begin(); it != lightsIndicators.end(); ++it)
+    BufferManager::BindRingRegion(instanceBuffer, BINDING(3));
+
+    if (useMultiDrawIndirect)
     {
-        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), localUniformBuffer.handle, it->localParamsOffset, it->localParamSize);
+        SubmitIndirectBatches(program, indicatorBatches, false, indirectBuffer.handle, indirectBuffer.regionStart);
+    }
+    else
+    {
+        SubmitDrawItems(program, RenderPass_Indicators, false);
+    }
 
-        Model& model = models[it->modelIndex];
-        Mesh& mesh = meshes[model.meshIdx];
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
 
-        for (u32 i = 0; i < mesh.subMeshes.size(); ++i)
+void App::SubmitDrawItems(const Program& bindedProgram, RenderPass pass, bool bindAlbedo)
+{
+    // The sampler unit was set at link time, only the texture changes per draw
+    bindAlbedo = bindAlbedo && bindedProgram.textureUnits[Uniform_Texture] >= 0;
+    if (bindAlbedo)
+    {
+        glActiveTexture(GL_TEXTURE0 + bindedProgram.textureUnits[Uniform_Texture]);
+    }
+
+    // The queue is sorted by state, so only the binds that change are issued
+    GLuint boundVAO = 0;
+    GLuint boundTexture = 0;
+    u32 drawItemCount = 0;
+    for (u32 i = renderQueuePassStart[pass]; i < renderQueuePassStart[pass + 1]; ++i)
+    {
+        const DrawItem& item = renderQueue[i];
+        const Model& model = models[item.modelIdx];
+        const Mesh& mesh = meshes[model.meshIdx];
+        const SubMesh& subMesh = mesh.subMeshes[item.subMeshIdx];
+
+        GLuint vao = FindVAO(geometryPools[subMesh.poolIdx], bindedProgram, instanceIndexBuffer.handle);
+        if (vao != boundVAO)
         {
-            GLuint vao = FindVAO(mesh, i, program);
             glBindVertexArray(vao);
+            boundVAO = vao;
+        }
 
-            SubMesh& subMesh = mesh.subMeshes[i];
-            glDrawElements(GL_TRIANGLES, subMesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)subMesh.indexOffset);
+        if (bindAlbedo)
+        {
+            const Material& subMeshMaterial = materials[model.materialIdx[item.subMeshIdx]];
+            GLuint texture = textures[subMeshMaterial.albedoTextureIdx].handle;
+            if (texture != boundTexture)
+            {
+                glBindTexture(GL_TEXTURE_2D, texture);
+                boundTexture = texture;
+            }
         }
+
+        const MeshLod& lod = subMesh.lods[glm::min(item.lod, subMesh.lodCount - 1)];
+        const u64 indexOffset = (u64)(subMesh.firstIndex + lod.firstIndex) * subMesh.indexSize;
+        glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, lod.indexCount, GetIndexType(subMesh.indexSize), (void*)indexOffset, item.instanceCount, subMesh.baseVertex, item.baseInstance);
+        drawItemCount++;
     }
-    glUseProgram(0);
+
+    if (pass == RenderPass_Geometry)
+    {
+        drawCalls = drawItemCount;
+    }
+}
+
+void App::SubmitIndirectBatches(const Program& bindedProgram, const std::vector<IndirectBatch>& batches, bool bindAlbedo, GLuint commandBufferHandle, u64 commandBufferOffset)
+{
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBufferHandle);
+
+    // The sampler unit was set at link time, only the texture changes per draw
+    bindAlbedo = bindAlbedo && bindedProgram.textureUnits[Uniform_Texture] >= 0;
+    if (bindAlbedo)
+    {
+        glActiveTexture(GL_TEXTURE0 + bindedProgram.textureUnits[Uniform_Texture]);
+    }
+
+    GLuint boundVAO = 0;
+    GLuint boundTexture = 0;
+    for (const IndirectBatch& batch : batches)
+    {
+        GLuint vao = FindVAO(geometryPools[batch.poolIdx], bindedProgram, instanceIndexBuffer.handle);
+        if (vao != boundVAO)
+        {
+            glBindVertexArray(vao);
+            boundVAO = vao;
+        }
+
+        if (bindAlbedo && textures[batch.albedoTextureIdx].handle != boundTexture)
+        {
+            boundTexture = textures[batch.albedoTextureIdx].handle;
+            glBindTexture(GL_TEXTURE_2D, boundTexture);
+        }
+
+        const u64 commandOffset = commandBufferOffset + batch.firstCommand * sizeof(DrawElementsIndirectCommand);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GetIndexType(geometryPools[batch.poolIdx].indexSize), (void*)commandOffset, batch.commandCount, 0);
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 }
 
-const GLuint App::CreateTexture(const bool isFloatingPoint)
+void App::RenderGeometryOcclusionCulled(const Program& bindedProgram)
 {
-    GLuint textureHandle;
+    // Phase 0, instances and meshlets not hidden by the depth of the previous frame
+    CullOcclusion(0);
+    if (!meshletBatches.empty())
+        CullMeshlets(0);
 
-    GLenum internalFormat = isFloatingPoint ? GL_RGBA16F : GL_RGBA8;
-    GLenum format = GL_RGBA;
-    GLenum dataType = isFloatingPoint ? GL_FLOAT : GL_UNSIGNED_BYTE;
+    // The meshlet commands index the instances as uploaded, not the compacted ones
+    glUseProgram(bindedProgram.handle);
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, globalParamsOffset, globalParamsSize);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(3), culledInstanceBuffer.handle);
+    SubmitIndirectBatches(bindedProgram, geometryBatches, true, culledCommandBuffer.handle, 0);
+    BufferManager::BindRingRegion(instanceBuffer, BINDING(3));
+    SubmitIndirectBatches(bindedProgram, meshletBatches, true, meshletCommandBuffer.handle, 0);
+
+    // Phase 1, the rejected ones again against what phase 0 drew, so nothing
+    // that became visible this frame pops in a frame late
+    BuildDepthPyramid();
+    CullOcclusion(1);
+    if (!meshletBatches.empty())
+        CullMeshlets(1);
+
+    glUseProgram(bindedProgram.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(3), culledInstanceBuffer.handle);
+    SubmitIndirectBatches(bindedProgram, geometryBatches, true, culledCommandBuffer.handle, drawCommands * sizeof(DrawElementsIndirectCommand));
+    BufferManager::BindRingRegion(instanceBuffer, BINDING(3));
+    SubmitIndirectBatches(bindedProgram, meshletBatches, true, meshletCommandBuffer.handle, meshletCommands * sizeof(DrawElementsIndirectCommand));
+
+    drawCalls = 2 * (geometryBatches.size() + meshletBatches.size());
+}
 
-    glGenTextures(1, &textureHandle);
-    glBindTexture(GL_TEXTURE_2D, textureHandle);
-    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, displaySize.x, displaySize.y, 0, format, dataType, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+void App::CreateDepthPyramid()
+{
+    if (depthPyramidHandle != 0)
+        glDeleteTextures(1, &depthPyramidHandle);
+
+    // Max depth pyramid with a full mip chain over the G-buffer depth
+    depthPyramidSize = renderSize;
+    depthPyramidLevels = 1 + (i32)glm::floor(glm::log2((f32)glm::max(renderSize.x, renderSize.y)));
+    glGenTextures(1, &depthPyramidHandle);
+    glBindTexture(GL_TEXTURE_2D, depthPyramidHandle);
+    glTexStorage2D(GL_TEXTURE_2D, depthPyramidLevels, GL_R32F, renderSize.x, renderSize.y);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glBindTexture(GL_TEXTURE_2D, 0);
-    return textureHandle;
+
+    // Nothing of the old size can be tested against
+    depthPyramidValid = false;
+}
+
+void App::BuildDepthPyramid()
+{
+    const Program& pyramidProgram = programs[depthPyramidShader];
+    glUseProgram(pyramidProgram.handle);
+
+    for (i32 level = 0; level < depthPyramidLevels; ++level)
+    {
+        ShaderCompiler::BindTexture(pyramidProgram, Uniform_Source, level == 0 ? gBuffer.depthHandle : depthPyramidHandle);
+        glUniform1i(pyramidProgram.uniformLocations[Uniform_FromDepth], level == 0);
+        glUniform1i(pyramidProgram.uniformLocations[Uniform_SourceLevel], glm::max(level - 1, 0));
+        glBindImageTexture(0, depthPyramidHandle, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+        const u32 width = glm::max(depthPyramidSize.x >> level, 1);
+        const u32 height = glm::max(depthPyramidSize.y >> level, 1);
+        glDispatchCompute((width + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE, (height + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE, 1);
+
+        // The next level reads this one through the sampler
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    depthPyramidValid = true;
+    depthPyramidViewProjection = camera.projection * camera.view;
+}
+
+void App::CullOcclusion(u32 phase)
+{
+    if (phase == 0)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, groupCounterBuffer.handle);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, 2 * entityInstanceCount * sizeof(u32), GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Visible instances, compacted per group
+    const Program& cullProgram = programs[occlusionCullShader];
+    glUseProgram(cullProgram.handle);
+    glUniform1ui(cullProgram.uniformLocations[Uniform_Phase], phase);
+    glUniform1ui(cullProgram.uniformLocations[Uniform_InstanceCount], entityInstanceCount);
+    glUniformMatrix4fv(cullProgram.uniformLocations[Uniform_CullViewProjection], 1, GL_FALSE, glm::value_ptr(depthPyramidViewProjection));
+    glUniform1i(cullProgram.uniformLocations[Uniform_PyramidValid], depthPyramidValid);
+    glUniform1i(cullProgram.uniformLocations[Uniform_PyramidLevels], depthPyramidLevels);
+    ShaderCompiler::BindTexture(cullProgram, Uniform_DepthPyramid, depthPyramidHandle);
+
+    BufferManager::BindRingRegion(instanceBuffer, BINDING(3));
+    BufferManager::BindRingRegion(instanceBoundsBuffer, BINDING(4));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(5), culledInstanceBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(6), groupCounterBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(7), rejectedBuffer.handle);
+
+    glDispatchCompute((entityInstanceCount + OCCLUSION_CULL_GROUP_SIZE - 1) / OCCLUSION_CULL_GROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Commands of this phase, the CPU built ones with the surviving instance ranges
+    const Program& commandsProgram = programs[occlusionCommandsShader];
+    glUseProgram(commandsProgram.handle);
+    glUniform1ui(commandsProgram.uniformLocations[Uniform_Phase], phase);
+    glUniform1ui(commandsProgram.uniformLocations[Uniform_CommandCount], drawCommands);
+
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(4), indirectBuffer.handle, indirectBuffer.regionStart, indirectBuffer.regionSize);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(5), culledCommandBuffer.handle);
+
+    glDispatchCompute((drawCommands + OCCLUSION_CULL_GROUP_SIZE - 1) / OCCLUSION_CULL_GROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void App::CullMeshlets(u32 phase)
+{
+    // The frustum and cone tests use the camera of this frame, the occlusion test the pyramid one
+    const Program& cullProgram = programs[meshletCullShader];
+    glUseProgram(cullProgram.handle);
+    glUniform1ui(cullProgram.uniformLocations[Uniform_Phase], phase);
+    glUniform1ui(cullProgram.uniformLocations[Uniform_CommandCount], meshletCommands);
+    glUniformMatrix4fv(cullProgram.uniformLocations[Uniform_CullViewProjection], 1, GL_FALSE, glm::value_ptr(depthPyramidViewProjection));
+    glUniform1i(cullProgram.uniformLocations[Uniform_PyramidValid], depthPyramidValid);
+    glUniform1i(cullProgram.uniformLocations[Uniform_PyramidLevels], depthPyramidLevels);
+    ShaderCompiler::BindTexture(cullProgram, Uniform_DepthPyramid, depthPyramidHandle);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, globalParamsOffset, globalParamsSize);
+    BufferManager::BindRingRegion(instanceBuffer, BINDING(3));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(4), meshletBufferHandle);
+    BufferManager::BindRingRegion(meshletJobBuffer, BINDING(5));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(6), meshletCommandBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(7), meshletRejectedBuffer.handle);
+
+    glDispatchCompute(meshletJobCount, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
 }
\ No newline at end of file
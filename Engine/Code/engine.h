@@ -8,6 +8,11 @@
 #include "BufferSupFunctions.h"
 #include "Globals.h"
 #include "Camera.h"
+#include "BVH.h"
+#include "RenderQueue.h"
+#include "AssetPipeline.h"
+#include "TextureStreamer.h"
+#include "FrameGraph.h"
 
 const VertexV3V2 vertices[] = {
     {glm::vec3(-1.0,-1.0,0.0), glm::vec2(0.0,0.0)},
@@ -21,17 +26,80 @@ const u16 indices[] = {
     0,2,3
 };
 
-struct App
-{
-    void UpdateEntityBuffer();
-    void UpdateIndicatorsBuffer();
+// Clustered lighting, the grid values must match the ones in the lighting shaders
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+#define CLUSTER_MAX_LIGHTS 128
+#define MAX_LIGHTS 4096
+
+// Per instance data lives in a storage buffer, the vertex shaders reach it through
+// an instanced attribute holding baseInstance + gl_InstanceID
+#define MAX_INSTANCES 65536
+#define INSTANCE_INDEX_LOCATION 5
+
+// Capacity of the indirect command buffer shared by the geometry and indicator passes
+#define MAX_INDIRECT_COMMANDS 16384
+
+// Size of each frame region of the texture staging ring, the upload budget is clamped to it
+#define MAX_TEXTURE_UPLOAD_BYTES MB(8)
+
+// Local sizes of the occlusion culling compute shaders
+#define DEPTH_PYRAMID_GROUP_SIZE 8
+#define OCCLUSION_CULL_GROUP_SIZE 64
 
-    void ConfigureFrameBuffer(FrameBuffer& configFB);
+// Meshlet culling, one command per meshlet and instance of the LOD 0 draws
+#define MESHLET_CULL_GROUP_SIZE 64
+#define MAX_MESHLET_COMMANDS 65536
 
-    void RenderGeometry(const Program& bindedProgram);
+// Frames of GPU time averaged between two changes of the dynamic resolution scale, and its step
+#define RENDER_SCALE_INTERVAL 8
+#define RENDER_SCALE_STEP 0.05f
+
+struct App
+{
+    // Called once the data of a streamed model is uploaded
+    void OnModelResident(u32 modelIdx);
+
+    bool DeferredProgramsReady() const;
+    bool OcclusionProgramsReady() const;
+    bool UsesMeshletCulling(const DrawItem& item) const;
+
+    void BeginFrameRegion();
+    void EndFrameRegion();
+
+    void UpdateCamera();
+    void UpdateRenderScale(Mode frameMode);
+    void BuildSpatialIndex();
+    void SetEntityTransform(u32 entityIdx, const glm::mat4& worldMatrix);
+    AABB ComputeEntityAABB(const Entity& entity);
+
+    void UpdateEntityBuffer(Mode frameMode);
+    void UpdateLightBuffer();
+    void CullEntities();
+    void SelectLods();
+    void PushInstanceGroups(const std::vector<Entity>& instancedEntities, const u8* visibility, std::vector<InstanceGroup>& groups, glm::mat4* instances, InstanceBounds* bounds, u32& baseInstance);
+    void BuildRenderQueue(Mode frameMode);
+    void PushIndirectBatches(RenderPass pass, std::vector<IndirectBatch>& batches);
+    void PushMeshletBatches();
+
+    void CullLights();
+    void RenderLightHeatmap();
+    void RenderLightVolumes(GLuint lightingFramebuffer);
+
+    void BindGBufferTextures(const Program& bindedProgram);
+
+    void RenderGeometry(const Program& bindedProgram, bool depthOnly = false);
     void RenderIndicatorsGeometry();
+    void SubmitDrawItems(const Program& bindedProgram, RenderPass pass, bool bindAlbedo);
+    void SubmitIndirectBatches(const Program& bindedProgram, const std::vector<IndirectBatch>& batches, bool bindAlbedo, GLuint commandBufferHandle, u64 commandBufferOffset);
 
-    const GLuint CreateTexture(const bool isFloatingPoint = false);
+    void RenderGeometryOcclusionCulled(const Program& bindedProgram);
+    void CreateDepthPyramid();
+    void BuildDepthPyramid();
+    void CullOcclusion(u32 phase);
+    void CullMeshlets(u32 phase);
 
     // Camera
     Camera camera;
@@ -55,16 +123,33 @@ struct App
     std::vector<Mesh>  meshes;
     std::vector<Model>  models;
     std::vector<Program>  programs;
+    bool parallelShaderCompile;
+    bool blockCompression;
+    bool programBinaryCache;
+    ProgramCacheStats programCacheStats;
+    u32 pendingProgramCount;
 
     // program indices
     GLuint renderToBackBufferShader;
+    GLuint depthPrepassShader;
 
-    GLuint renderToFrameBufferShader;
-    GLuint frameBufferToQuadShader;
+    // Deferred programs, one per G-buffer layout
+    GLuint renderToFrameBufferShader[GBufferLayout_Count];
+    GLuint frameBufferToQuadShader[GBufferLayout_Count];
 
     GLuint renderIndicatorsShader;
 
-    GLuint texturedMeshProgram_uTexture;
+    GLuint lightCullingShader;
+    GLuint lightHeatmapShader[GBufferLayout_Count];
+
+    GLuint frameBufferToQuadDirectionalShader[GBufferLayout_Count];
+    GLuint lightVolumeStencilShader;
+    GLuint lightVolumeShader[GBufferLayout_Count];
+
+    GLuint depthPyramidShader;
+    GLuint occlusionCullShader;
+    GLuint occlusionCommandsShader;
+    GLuint meshletCullShader;
 
     // texture indices
     u32 diceTexIdx;
@@ -73,17 +158,23 @@ struct App
     u32 normalTexIdx;
     u32 magentaTexIdx;
 
+    // Asset streaming, render thread stages get assetUploadBudget ms per frame
+    AssetPipeline assetPipeline;
+    f32 assetUploadBudget = 4.0f;
+
+    // Texture levels go through a pixel unpack ring, textureUploadBudget bytes per frame
+    TextureStreamer textureStreamer;
+    u32 textureUploadBudget = MB(2);
+
     // Mode
     Mode mode;
+    bool useDepthPrepass = false;
 
     // Embedded geometry (in-editor simple meshes such as
     // a screen filling quad, a cube, a sphere...)
     GLuint embeddedVertices;
     GLuint embeddedElements;
 
-    // Location of the texture uniform in the textured quad shader
-    GLuint programUniformTexture;
-
     // VAO object to link our screen filling quad with our textured quad shader
     GLuint vao;
 
@@ -91,17 +182,140 @@ struct App
 
     GLint maxUniformBufferSize;
     GLint uniformBlockAlignment;
+    GLint storageBlockAlignment;
     Buffer localUniformBuffer;
+
+    // Every buffer written each frame is a ring, the fence of a region is
+    // waited on before the CPU writes into it again
+    bool persistentRingBuffers;
+    u32 frameRegion = 0;
+    GLsync frameFences[RING_BUFFER_FRAMES] = {};
+    f32 ringStallTime = 0.0f;
+
     std::vector<Entity> entities;
+
+    // Frustum culling of the entity bounding spheres, run before the instance upload
+    bool useFrustumCulling = true;
+    Frustum cameraFrustum;
+    std::vector<BoundingSphere> entitySpheres;
+    std::vector<u8> entityVisibility;
+    u32 visibleEntityCount;
+
+    // LOD per entity from the projected size of the LOD errors, a coarser LOD is taken once its
+    // error is under lodErrorThreshold pixels by the hysteresis margin, a finer one once it is over
+    bool useLods = true;
+    f32 lodErrorThreshold = 1.0f;
+    f32 lodHysteresis = 0.25f;
+    u32 submittedTriangles;
+
+    // Dynamic resolution, deferred mode only. The G-buffer is rendered at renderScale of the display
+    // and upscaled by the lighting pass. Every RENDER_SCALE_INTERVAL frames the scale moves towards
+    // the one holding targetGpuTime, as measured by the GPU profiler
+    bool useDynamicResolution = false;
+    f32 targetGpuTime = 16.0f;
+    f32 minRenderScale = 0.5f;
+    f32 renderScale = 1.0f;
+    ivec2 renderSize;
+    ivec2 shadingSize; // Viewport of the pass shading the G-buffer, given to the shaders
+    u64 profiledFrames = 0;
+    u64 renderScaleFrame = 0; // First profiler frame rendered at the current scale
+    f32 gpuTimeSum = 0.0f;
+    u32 gpuTimeSamples = 0;
+
+    // Entity world matrices grouped by model, one draw per submesh and group
+    bool useInstancing = true;
+    Buffer instanceBuffer;
+    Buffer instanceIndexBuffer;
+    std::vector<InstanceGroup> instanceGroups;
+    std::vector<f32> instanceDistances;
+    u32 drawCalls;
+
+    // Draw items of every pass sorted by their 64 bit keys, passes stay contiguous
+    std::vector<DrawItem> renderQueue;
+    std::vector<DrawItem> renderQueueScratch;
+    u32 renderQueuePassStart[RenderPass_Count + 1];
+
+    // Multi draw indirect, one command per submesh and instance group, one
+    // glMultiDrawElementsIndirect per geometry pool and albedo texture
+    bool useMultiDrawIndirect = true;
+    std::vector<GeometryPool> geometryPools;
+    Buffer indirectBuffer;
+    std::vector<IndirectBatch> geometryBatches;
+    u32 drawCommands;
+
+    // Two phase occlusion culling against a max depth pyramid, deferred mode only.
+    // The pyramid is built after the first phase and reused by the next frame.
+    bool useOcclusionCulling = true;
+    GLuint depthPyramidHandle = 0;
+    ivec2 depthPyramidSize = ivec2(0);
+    i32 depthPyramidLevels;
+    bool depthPyramidValid = false;
+    glm::mat4 depthPyramidViewProjection;
+    Buffer instanceBoundsBuffer;
+    Buffer culledInstanceBuffer;
+    Buffer culledCommandBuffer;
+    Buffer groupCounterBuffer;
+    Buffer rejectedBuffer;
+    u32 entityInstanceCount;
+
+    // Meshlet culling, LOD 0 draws go as one command per meshlet and instance, and the culling
+    // pass leaves out the meshlets outside the frustum, facing away or occluded. With occlusion
+    // culling it runs in the same two phases, otherwise only the frustum and cone tests apply
+    bool useMeshletCulling = true;
+    GLuint meshletBufferHandle;
+    u32 meshletCount;
+    u32 meshletCapacity;
+    Buffer meshletJobBuffer;
+    Buffer meshletCommandBuffer;
+    Buffer meshletRejectedBuffer;
+    std::vector<IndirectBatch> meshletBatches;
+    u32 meshletJobCount;
+    u32 meshletCommands;
+    bool meshletsCulled;
+
+    // Spatial index, entities and point lights as leaves of their own tree,
+    // directional lights are unbounded and stay out of it
+    bool useBVH = true;
+    BVH entityBVH;
+    BVH lightBVH;
+    std::vector<u32> visibleProxies;
+    std::vector<u32> visibleLights;
+    std::vector<std::pair<u32, u32>> lightEntityPairs;
+    u32 pickedEntity = BVH_NULL_NODE;
+
     std::vector<Light> lights;
     std::vector<Entity> lightsIndicators;
+    std::vector<InstanceGroup> indicatorGroups;
+    std::vector<IndirectBatch> indicatorBatches;
+
+    // Lights are uploaded with the directional ones first, the point lights
+    // are assigned to the view frustum clusters by the light culling pass
+    Buffer lightBuffer;
+    Buffer lightGridBuffer;
+    Buffer lightIndexBuffer;
+    u32 directionalLightCount;
+    u32 pointLightCount;
+
+    // Point lights drawn as stencil masked spheres instead of the clustered quad
+    bool useLightVolumes = false;
+    u32 lightVolumeModelIndex;
+    f32 lightVolumeScale;
 
     GLint globalParamsOffset;
     GLint globalParamsSize;
 
-    FrameBuffer deferredFrameBuffer;
+    GBufferLayout gBufferLayout = GBufferLayout_Full;
+
+    // Render targets are transient textures of the frame graph, pooled and shared between the
+    // passes whose lifetimes don't overlap. The G-buffer is the one given to this frame
+    FrameGraph frameGraph;
+
+    // Times the frame, every frame graph pass and the ImGui draw
+    GpuProfiler gpuProfiler;
+    FrameBuffer gBuffer;
 
     int shownTextureIndex = 0;
+    std::vector<GLuint> debugViewTextures;
 };
 
 void Init(App* app);
@@ -110,4 +324,6 @@ void Gui(App* app);
 
 void Update(App* app);
 
-void Render(App* app);
\ No newline at end of file
+void Render(App* app);
+
+void Shutdown(App* app);
\ No newline at end of file
@@ -13,10 +13,15 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif
 
 #include "engine.h"
+#include "ModelLoadingFunctions.h"
 #include <stdio.h>
+#include <string.h>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
@@ -112,8 +117,19 @@ void OnGlfwCloseWindow(GLFWwindow* window)
     app->isRunning = false;
 }
 
-int main()
+int main(int argc, char** argv)
 {
+    // Offline mesh analysis, prints the optimizer stats and exits: Engine --analyze-mesh <model>...
+    if (argc > 1 && strcmp(argv[1], "--analyze-mesh") == 0)
+    {
+        bool analyzed = argc > 2;
+        for (int i = 2; i < argc; ++i)
+        {
+            analyzed = ModelLoader::AnalyzeModel(argv[i]) && analyzed;
+        }
+        return analyzed ? 0 : -1;
+    }
+
     App app = {};
     app.deltaTime = 1.0f / 60.0f;
     app.displaySize = ivec2(WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -240,7 +256,10 @@ int main()
         Render(&app);
 
         // ImGui Render
+        const u32 imguiScope = app.gpuProfiler.BeginScope("ImGui");
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        app.gpuProfiler.EndScope(imguiScope);
+        app.gpuProfiler.EndFrame();
         if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable) {
             GLFWwindow* backup_current_context = glfwGetCurrentContext();
             ImGui::UpdatePlatformWindows();
@@ -260,6 +279,8 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    Shutdown(&app);
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -397,6 +418,86 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     return 0;
 }
 
+bool MakeDirectory(const char* path)
+{
+#ifdef _WIN32
+    return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+MappedFile MapFile(const char* filepath)
+{
+    MappedFile file = {};
+
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return file;
+
+    LARGE_INTEGER fileSize;
+    HANDLE mappingHandle = NULL;
+    if (GetFileSizeEx(fileHandle, &fileSize) && fileSize.QuadPart > 0)
+    {
+        mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    if (mappingHandle == NULL)
+    {
+        CloseHandle(fileHandle);
+        return file;
+    }
+
+    file.data = (const u8*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (file.data == NULL)
+    {
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        return file;
+    }
+
+    file.size = fileSize.QuadPart;
+    file.fileHandle = fileHandle;
+    file.mappingHandle = mappingHandle;
+#else
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+        return file;
+
+    struct stat attrib;
+    if (fstat(fd, &attrib) == 0 && attrib.st_size > 0)
+    {
+        void* data = mmap(NULL, attrib.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            file.data = (const u8*)data;
+            file.size = attrib.st_size;
+        }
+    }
+
+    // The mapping keeps its own reference to the file
+    close(fd);
+#endif
+
+    return file;
+}
+
+void UnmapFile(MappedFile& file)
+{
+    if (file.data == NULL)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(file.data);
+    CloseHandle(file.mappingHandle);
+    CloseHandle(file.fileHandle);
+#else
+    munmap((void*)file.data, file.size);
+#endif
+
+    file = {};
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
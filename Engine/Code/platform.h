@@ -31,6 +31,20 @@ String ReadTextFile(const char *filepath);
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+/**
+ * Creates a directory if it does not exist yet. Returns whether the directory
+ * exists after the call.
+ */
+bool MakeDirectory(const char *path);
+
+/**
+ * Maps a whole file read only. The returned data is NULL if the file could not
+ * be mapped, pages are only read from disk when they are touched.
+ */
+MappedFile MapFile(const char *filepath);
+
+void UnmapFile(MappedFile &file);
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
@@ -0,0 +1,192 @@
+// Prepended by the shader compiler to every stage of every program, after the program, variant
+// and stage defines. Blocks and samplers a stage doesn't use stay inactive
+
+// Must match CLUSTER_GRID_* and CLUSTER_MAX_LIGHTS in engine.h
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_MAX_LIGHTS 128
+
+struct Light
+{
+    uint type;
+    vec3 color;
+    vec3 direction;
+    vec3 position;
+    float radius;
+};
+
+layout(binding = 0, std140) uniform GlobalsParams
+{
+    vec3 uCamPosition;
+    uint uDirectionalLightCount;
+    uint uPointLightCount;
+    float uNearPlane;
+    float uFarPlane;
+    mat4 uViewMatrix;
+    mat4 uInverseProjectionMatrix;
+    vec2 uViewportSize;
+    mat4 uViewProjectionMatrix;
+    mat4 uInverseViewProjectionMatrix;
+};
+
+layout(binding = 0, std430) readonly buffer Lights
+{
+    Light uLight[];
+};
+
+#if defined(FRAGMENT) /////////////////////////////////////////////////
+
+layout(binding = 1, std430) readonly buffer LightGrid
+{
+    uint uLightGrid[];
+};
+
+layout(binding = 2, std430) readonly buffer LightIndices
+{
+    uint uLightIndices[];
+};
+
+uint GetClusterIndex(vec2 fragCoord, float viewZ)
+{
+    float depth = max(-viewZ, uNearPlane);
+    uint zSlice = uint(log(depth / uNearPlane) / log(uFarPlane / uNearPlane) * CLUSTER_GRID_Z);
+    uvec3 cluster = uvec3(uvec2(fragCoord / uViewportSize * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y)), zSlice);
+    cluster = min(cluster, uvec3(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1, CLUSTER_GRID_Z - 1));
+    return cluster.x + cluster.y * CLUSTER_GRID_X + cluster.z * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+}
+
+// Ambient, diffuse and specular of one light, normal normalized
+vec3 ShadeLight(Light light, vec3 normal, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.direction);
+
+    float ambientStrenght = 0.2;
+    vec3 ambient = ambientStrenght * light.color;
+
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 diffuse = diff * light.color;
+
+    float specularStrenght = 0.1;
+    vec3 reflectDir = reflect(-lightDir, normal);
+    vec3 normalViewDir = normalize(viewDir);
+    float spec = pow(max(dot(normalViewDir, reflectDir), 0.0), 32);
+    vec3 specular = specularStrenght * spec * light.color;
+
+    return ambient + diffuse + specular;
+}
+
+float GetAttenuation(float distance)
+{
+    float constant = 1.0;
+    float lineal = 0.09;
+    float quadratic = 0.032;
+    return 1.0 / (constant + lineal * distance + quadratic * (distance * distance));
+}
+
+// Summed as vec4(light, 1.0) per light, to be multiplied by the albedo
+vec4 ShadeDirectionalLights(vec3 normal, vec3 viewDir)
+{
+    vec4 result = vec4(0.0);
+    for(uint i = 0; i < uDirectionalLightCount; ++i)
+    {
+        result += vec4(ShadeLight(uLight[i], normal, viewDir), 1.0);
+    }
+    return result;
+}
+
+// Point lights, only the ones assigned to the cluster of the fragment
+vec4 ShadeClusteredPointLights(vec3 position, vec3 normal, vec3 viewDir)
+{
+    vec4 result = vec4(0.0);
+    uint clusterIndex = GetClusterIndex(gl_FragCoord.xy, (uViewMatrix * vec4(position, 1.0)).z);
+    uint clusterLightCount = uLightGrid[clusterIndex];
+    for(uint i = 0; i < clusterLightCount; ++i)
+    {
+        Light light = uLight[uLightIndices[clusterIndex * CLUSTER_MAX_LIGHTS + i]];
+        float attenuation = GetAttenuation(length(light.position - position));
+        result += vec4(ShadeLight(light, normal, viewDir) * attenuation, 1.0);
+    }
+    return result;
+}
+
+// Octahedral normals, remapped to [0, 1] in the RG16 target of the compact G-buffer
+vec2 OctWrap(vec2 v)
+{
+    return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 OctEncode(vec3 n)
+{
+    n /= (abs(n.x) + abs(n.y) + abs(n.z));
+    return n.z >= 0.0 ? n.xy : OctWrap(n.xy);
+}
+
+vec3 OctDecode(vec2 f)
+{
+    vec3 n = vec3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+    float t = clamp(-n.z, 0.0, 1.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// G-buffer reads of the lighting passes
+#ifdef COMPACT_GBUFFER
+
+uniform sampler2D uAlbedo;
+uniform sampler2D uNormals;
+uniform sampler2D uDepth;
+
+bool IsBackground(vec2 texCoord)
+{
+    return texture(uDepth, texCoord).r == 1.0;
+}
+
+vec3 GetNormal(vec2 texCoord)
+{
+    return OctDecode(texture(uNormals, texCoord).xy * 2.0 - 1.0);
+}
+
+vec3 GetPosition(vec2 texCoord)
+{
+    vec4 clip = vec4(vec3(texCoord, texture(uDepth, texCoord).r) * 2.0 - 1.0, 1.0);
+    vec4 world = uInverseViewProjectionMatrix * clip;
+    return world.xyz / world.w;
+}
+
+vec3 GetViewDir(vec2 texCoord)
+{
+    return uCamPosition - GetPosition(texCoord);
+}
+
+#else
+
+uniform sampler2D uAlbedo;
+uniform sampler2D uNormals;
+uniform sampler2D uPosition;
+uniform sampler2D uViewDir;
+
+bool IsBackground(vec2 texCoord)
+{
+    return texture(uPosition, texCoord).w == 0.0;
+}
+
+vec3 GetNormal(vec2 texCoord)
+{
+    return normalize(texture(uNormals, texCoord).xyz);
+}
+
+vec3 GetPosition(vec2 texCoord)
+{
+    return texture(uPosition, texCoord).xyz;
+}
+
+vec3 GetViewDir(vec2 texCoord)
+{
+    return texture(uViewDir, texCoord).xyz;
+}
+
+#endif
+
+#endif
@@ -1,4 +1,6 @@
-#ifdef FRAMEBUFFER_TO_QUAD
+// FRAMEBUFFER_TO_QUAD_DIRECTIONAL only shades the directional lights, the point
+// lights are added afterwards by the light volumes (see lightVolume.glsl)
+#if defined(FRAMEBUFFER_TO_QUAD) || defined(FRAMEBUFFER_TO_QUAD_DIRECTIONAL)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
@@ -15,85 +17,68 @@ void main()
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-struct Light
-{
-    uint type;
-    vec3 color;
-    vec3 direction;
-    vec3 position;
-};
-
-layout(binding = 0, std140) uniform GlobalsParams
-{
-    vec3 uCamPosition;
-    uint uLightCount;
-    Light uLight[16];
-};
+// Lights, clusters and G-buffer reads come from common.glsl
 
 in vec2 vTexCoord;
 
-uniform sampler2D uAlbedo;
-uniform sampler2D uNormals;
-uniform sampler2D uPosition;
-uniform sampler2D uViewDir;
 layout(location = 0) out vec4 oColor;
 
-void CalculateBlitVars(in Light light, out vec3 ambient, out vec3 diffuse, out vec3 specular)
+void main()
 {
-     vec3 vNormal = texture(uNormals, vTexCoord).xyz;
-     vec3 vViewDir = texture(uViewDir, vTexCoord).xyz;
-     vec3 lightDir = normalize(light.direction);
+    vec4 textureColor = texture(uAlbedo, vTexCoord);
+    vec3 normal = GetNormal(vTexCoord);
+    vec3 viewDir = GetViewDir(vTexCoord);
 
-     float ambientStrenght = 0.2;
-     ambient = ambientStrenght * light.color;
-
-     float diff = max(dot(vNormal,lightDir), 0.0);
-     diffuse = diff * light.color;
+    vec4 lighting = ShadeDirectionalLights(normal, viewDir);
+#ifndef FRAMEBUFFER_TO_QUAD_DIRECTIONAL
+    lighting += ShadeClusteredPointLights(GetPosition(vTexCoord), normal, viewDir);
+#endif
 
-     float specularStrenght = 0.1;
-     vec3 reflectDir = reflect(-lightDir, vNormal);
-     vec3 normalViewDir = normalize(vViewDir);
-     float spec = pow(max(dot(normalViewDir, reflectDir), 0.0), 32);
-     specular = specularStrenght * spec * light.color;
+    oColor = lighting * textureColor;
 }
 
+#endif
+#endif
+
+#ifdef LIGHT_HEATMAP
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec2 aTexCoord;
+
+out vec2 vTexCoord;
+
 void main()
 {
-vec4 textureColor = texture(uAlbedo, vTexCoord);
-vec4 finalColor = vec4(0.0f);
+    vTexCoord = aTexCoord;
+    gl_Position = vec4(aPosition, 1.0);
+}
 
-    for(int i=0; i< uLightCount; ++i)
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+// Light count shown as the hottest color
+#define HEATMAP_MAX_LIGHTS 32.0
+
+in vec2 vTexCoord;
+
+layout(location = 0) out vec4 oColor;
+
+void main()
+{
+    if (IsBackground(vTexCoord))
     {
-        Light light = uLight[i];
-        vec3 lightResult = vec3(0.0);
-        vec3 ambient = vec3(0.0);
-        vec3 diffuse = vec3(0.0);
-        vec3 specular = vec3(0.0);
-
-        if(uLight[i].type == 0) //directional light 
-        {
-            CalculateBlitVars(light, ambient, diffuse, specular);
-
-            lightResult = ambient + diffuse + specular;
-            finalColor += vec4(lightResult, 1.0) * textureColor;
-        }
-        else //point light
-        {
-            float constant = 1.0;
-            float lineal = 0.09;
-            float quadratic = 0.032;
-            float distance = length(light.position - texture(uPosition, vTexCoord).xyz);
-            float attenuation = 1.0 / (constant + lineal * distance + quadratic * (distance * distance));
-
-            CalculateBlitVars(light, ambient, diffuse, specular);
-
-            lightResult = (ambient * attenuation) + (diffuse * attenuation) + (specular * attenuation);
-            finalColor += vec4(lightResult, 1.0) * textureColor;
-        }
+        oColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
     }
 
-    oColor = finalColor;
+    uint clusterIndex = GetClusterIndex(gl_FragCoord.xy, (uViewMatrix * vec4(GetPosition(vTexCoord), 1.0)).z);
+    float heat = clamp(float(uLightGrid[clusterIndex]) / HEATMAP_MAX_LIGHTS, 0.0, 1.0);
+
+    // blue -> green -> red
+    vec3 cold = mix(vec3(0.0, 0.0, 1.0), vec3(0.0, 1.0, 0.0), clamp(heat * 2.0, 0.0, 1.0));
+    oColor = vec4(mix(cold, vec3(1.0, 0.0, 0.0), clamp(heat * 2.0 - 1.0, 0.0, 1.0)), 1.0);
 }
 
 #endif
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,95 @@
+#ifdef CLUSTERED_LIGHT_CULLING
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// One invocation per cluster, the dispatch covers the Z slices in groups of 4
+#define GROUP_SIZE (CLUSTER_GRID_X * CLUSTER_GRID_Y * 4)
+
+layout(local_size_x = CLUSTER_GRID_X, local_size_y = CLUSTER_GRID_Y, local_size_z = 4) in;
+
+layout(binding = 1, std430) writeonly buffer LightGrid
+{
+    uint uLightGrid[];
+};
+
+layout(binding = 2, std430) writeonly buffer LightIndices
+{
+    uint uLightIndices[];
+};
+
+// Point lights in view space (xyz) and their radius (w), loaded once per batch
+shared vec4 sharedLights[GROUP_SIZE];
+
+vec3 ScreenToView(vec2 screenCoord)
+{
+    vec4 clip = vec4(screenCoord * 2.0 - 1.0, -1.0, 1.0);
+    vec4 view = uInverseProjectionMatrix * clip;
+    return view.xyz / view.w;
+}
+
+// Intersects the ray from the eye through point with the plane z = zDistance
+vec3 LineIntersectionToZPlane(vec3 point, float zDistance)
+{
+    return point * (zDistance / point.z);
+}
+
+bool SphereIntersectsAABB(vec3 center, float radius, vec3 aabbMin, vec3 aabbMax)
+{
+    vec3 closestPoint = clamp(center, aabbMin, aabbMax);
+    vec3 distance = closestPoint - center;
+    return dot(distance, distance) <= radius * radius;
+}
+
+void main()
+{
+    uvec3 cluster = gl_GlobalInvocationID;
+    uint clusterIndex = cluster.x + cluster.y * CLUSTER_GRID_X + cluster.z * CLUSTER_GRID_X * CLUSTER_GRID_Y;
+
+    // Cluster bounds in view space, Z is sliced exponentially
+    vec2 tileSize = vec2(1.0 / CLUSTER_GRID_X, 1.0 / CLUSTER_GRID_Y);
+    vec3 minPointView = ScreenToView(vec2(cluster.xy) * tileSize);
+    vec3 maxPointView = ScreenToView(vec2(cluster.xy + 1) * tileSize);
+
+    float clusterNear = -uNearPlane * pow(uFarPlane / uNearPlane, float(cluster.z) / CLUSTER_GRID_Z);
+    float clusterFar = -uNearPlane * pow(uFarPlane / uNearPlane, float(cluster.z + 1) / CLUSTER_GRID_Z);
+
+    vec3 minPointNear = LineIntersectionToZPlane(minPointView, clusterNear);
+    vec3 minPointFar = LineIntersectionToZPlane(minPointView, clusterFar);
+    vec3 maxPointNear = LineIntersectionToZPlane(maxPointView, clusterNear);
+    vec3 maxPointFar = LineIntersectionToZPlane(maxPointView, clusterFar);
+
+    vec3 aabbMin = min(min(minPointNear, minPointFar), min(maxPointNear, maxPointFar));
+    vec3 aabbMax = max(max(minPointNear, minPointFar), max(maxPointNear, maxPointFar));
+
+    // Point lights are stored after the directional ones
+    uint lightCount = 0;
+    uint batchCount = (uPointLightCount + GROUP_SIZE - 1) / GROUP_SIZE;
+    for (uint batch = 0; batch < batchCount; ++batch)
+    {
+        uint batchStart = batch * GROUP_SIZE;
+        uint lightIndex = batchStart + gl_LocalInvocationIndex;
+        if (lightIndex < uPointLightCount)
+        {
+            Light light = uLight[uDirectionalLightCount + lightIndex];
+            sharedLights[gl_LocalInvocationIndex] = vec4((uViewMatrix * vec4(light.position, 1.0)).xyz, light.radius);
+        }
+        barrier();
+
+        uint batchLightCount = min(GROUP_SIZE, uPointLightCount - batchStart);
+        for (uint i = 0; i < batchLightCount && lightCount < CLUSTER_MAX_LIGHTS; ++i)
+        {
+            vec4 light = sharedLights[i];
+            if (SphereIntersectsAABB(light.xyz, light.w, aabbMin, aabbMax))
+            {
+                uLightIndices[clusterIndex * CLUSTER_MAX_LIGHTS + lightCount] = uDirectionalLightCount + batchStart + i;
+                lightCount++;
+            }
+        }
+        barrier();
+    }
+
+    uLightGrid[clusterIndex] = lightCount;
+}
+
+#endif
+#endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+#ifdef LIGHT_VOLUME_STENCIL
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+
+// Scale that makes the low poly sphere enclose the unit sphere
+uniform float uVolumeScale;
+
+// The sphere positions are quantized, object space = xyz + aPosition * w
+uniform vec4 uDequantization;
+
+void main()
+{
+    Light light = uLight[uDirectionalLightCount + gl_InstanceID];
+    vec3 position = light.position + (uDequantization.xyz + aPosition * uDequantization.w) * light.radius * uVolumeScale;
+    gl_Position = uViewProjectionMatrix * vec4(position, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+void main()
+{
+}
+
+#endif
+#endif
+
+#ifdef LIGHT_VOLUME
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+
+// Scale that makes the low poly sphere enclose the unit sphere
+uniform float uVolumeScale;
+
+// The sphere positions are quantized, object space = xyz + aPosition * w
+uniform vec4 uDequantization;
+
+flat out uint vLightIndex;
+
+void main()
+{
+    vLightIndex = uDirectionalLightCount + gl_InstanceID;
+    Light light = uLight[vLightIndex];
+    vec3 position = light.position + (uDequantization.xyz + aPosition * uDequantization.w) * light.radius * uVolumeScale;
+    gl_Position = uViewProjectionMatrix * vec4(position, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+// Lights and G-buffer reads come from common.glsl
+
+flat in uint vLightIndex;
+
+layout(location = 0) out vec4 oColor;
+
+void main()
+{
+    vec2 texCoord = gl_FragCoord.xy / uViewportSize;
+    Light light = uLight[vLightIndex];
+
+    // The stencil only tells that the pixel is inside some volume, not this one
+    float distance = length(light.position - GetPosition(texCoord));
+    if (distance > light.radius)
+    {
+        discard;
+    }
+
+    vec3 lightResult = ShadeLight(light, GetNormal(texCoord), GetViewDir(texCoord)) * GetAttenuation(distance);
+    oColor = vec4(lightResult, 1.0) * texture(uAlbedo, texCoord);
+}
+
+#endif
+#endif
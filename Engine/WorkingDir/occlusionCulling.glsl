@@ -0,0 +1,383 @@
+#ifdef DEPTH_PYRAMID
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// Max reduction of the depth buffer, level 0 copies the depth texture and every
+// other level keeps the farthest depth of the texels it covers
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D uSource;
+uniform int uSourceLevel;
+uniform bool uFromDepth;
+
+layout(r32f, binding = 0) writeonly uniform image2D uDestination;
+
+void main()
+{
+    ivec2 destinationSize = imageSize(uDestination);
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(texel, destinationSize)))
+        return;
+
+    if (uFromDepth)
+    {
+        imageStore(uDestination, texel, vec4(texelFetch(uSource, texel, 0).r));
+        return;
+    }
+
+    // Odd sources leave a last row or column that folds into the last texel
+    ivec2 sourceSize = textureSize(uSource, uSourceLevel);
+    ivec2 first = texel * 2;
+    ivec2 last = min(first + 1, sourceSize - 1);
+    if (texel.x == destinationSize.x - 1) last.x = sourceSize.x - 1;
+    if (texel.y == destinationSize.y - 1) last.y = sourceSize.y - 1;
+
+    float depth = 0.0;
+    for (int y = first.y; y <= last.y; ++y)
+    {
+        for (int x = first.x; x <= last.x; ++x)
+        {
+            depth = max(depth, texelFetch(uSource, ivec2(x, y), uSourceLevel).r);
+        }
+    }
+
+    imageStore(uDestination, texel, vec4(depth));
+}
+
+#endif
+#endif
+
+#if defined(OCCLUSION_CULL) || defined(MESHLET_CULL)
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// Pyramid test shared by the instance and the meshlet culling passes
+uniform mat4 uCullViewProjection;
+uniform bool uPyramidValid;
+uniform int uPyramidLevels;
+uniform sampler2D uDepthPyramid;
+
+bool IsOccluded(vec3 boundsMin, vec3 boundsMax)
+{
+    if (!uPyramidValid)
+        return false;
+
+    vec2 uvMin = vec2(1.0);
+    vec2 uvMax = vec2(0.0);
+    float nearestDepth = 1.0;
+    for (int i = 0; i < 8; ++i)
+    {
+        vec3 corner = vec3((i & 1) != 0 ? boundsMax.x : boundsMin.x,
+                           (i & 2) != 0 ? boundsMax.y : boundsMin.y,
+                           (i & 4) != 0 ? boundsMax.z : boundsMin.z);
+        vec4 clip = uCullViewProjection * vec4(corner, 1.0);
+
+        // Crossing the near plane, there is no rect to test
+        if (clip.w <= 0.0)
+            return false;
+
+        vec3 ndc = clip.xyz / clip.w;
+        uvMin = min(uvMin, ndc.xy * 0.5 + 0.5);
+        uvMax = max(uvMax, ndc.xy * 0.5 + 0.5);
+        nearestDepth = min(nearestDepth, ndc.z * 0.5 + 0.5);
+    }
+
+    // Frustum culling already ran, only clamp to the screen here
+    ivec2 size = textureSize(uDepthPyramid, 0);
+    ivec2 pixelMin = clamp(ivec2(uvMin * vec2(size)), ivec2(0), size - 1);
+    ivec2 pixelMax = clamp(ivec2(uvMax * vec2(size)), ivec2(0), size - 1);
+
+    // Lowest level where the rect touches at most 2x2 texels
+    int level = 0;
+    while (level < uPyramidLevels - 1 && any(greaterThan((pixelMax >> level) - (pixelMin >> level), ivec2(1))))
+        level++;
+
+    ivec2 levelMax = textureSize(uDepthPyramid, level) - 1;
+    ivec2 texelMin = min(pixelMin >> level, levelMax);
+    ivec2 texelMax = min(pixelMax >> level, levelMax);
+
+    float farthestDepth = max(max(texelFetch(uDepthPyramid, texelMin, level).r,
+                                  texelFetch(uDepthPyramid, ivec2(texelMax.x, texelMin.y), level).r),
+                              max(texelFetch(uDepthPyramid, ivec2(texelMin.x, texelMax.y), level).r,
+                                  texelFetch(uDepthPyramid, texelMax, level).r));
+
+    return nearestDepth > farthestDepth;
+}
+
+#endif
+#endif
+
+#ifdef OCCLUSION_CULL
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// One invocation per instance. Phase 0 tests every instance against the pyramid of
+// the previous frame, phase 1 tests again the ones phase 0 rejected against the
+// pyramid built from what phase 0 drew. Visible instances are compacted per group.
+layout(local_size_x = 64) in;
+
+struct Instance
+{
+    mat4 worldMatrix;
+};
+
+struct InstanceBounds
+{
+    vec3 min;
+    uint baseInstance;
+    vec3 max;
+    uint padding;
+};
+
+layout(binding = 3, std430) readonly buffer Instances
+{
+    Instance uInstances[];
+};
+
+layout(binding = 4, std430) readonly buffer Bounds
+{
+    InstanceBounds uBounds[];
+};
+
+layout(binding = 5, std430) writeonly buffer CulledInstances
+{
+    Instance uCulledInstances[];
+};
+
+// Two counters per group, indexed by 2 * baseInstance + phase
+layout(binding = 6, std430) buffer GroupCounters
+{
+    uint uGroupCounters[];
+};
+
+layout(binding = 7, std430) buffer Rejected
+{
+    uint uRejected[];
+};
+
+uniform uint uPhase;
+uniform uint uInstanceCount;
+
+void main()
+{
+    uint instanceIdx = gl_GlobalInvocationID.x;
+    if (instanceIdx >= uInstanceCount)
+        return;
+
+    if (uPhase == 1u && uRejected[instanceIdx] == 0u)
+        return;
+
+    InstanceBounds bounds = uBounds[instanceIdx];
+    bool occluded = IsOccluded(bounds.min, bounds.max);
+
+    if (uPhase == 0u)
+        uRejected[instanceIdx] = occluded ? 1u : 0u;
+
+    if (occluded)
+        return;
+
+    // Phase 1 instances go right after the ones phase 0 kept
+    uint groupBase = bounds.baseInstance;
+    uint slot = atomicAdd(uGroupCounters[2u * groupBase + uPhase], 1u);
+    if (uPhase == 1u)
+        slot += uGroupCounters[2u * groupBase];
+
+    uCulledInstances[groupBase + slot] = uInstances[instanceIdx];
+}
+
+#endif
+#endif
+
+#ifdef OCCLUSION_COMMANDS
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// Rewrites the CPU built commands with the instances each phase kept
+layout(local_size_x = 64) in;
+
+struct DrawElementsIndirectCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(binding = 4, std430) readonly buffer SourceCommands
+{
+    DrawElementsIndirectCommand uSourceCommands[];
+};
+
+layout(binding = 5, std430) writeonly buffer CulledCommands
+{
+    DrawElementsIndirectCommand uCulledCommands[];
+};
+
+layout(binding = 6, std430) readonly buffer GroupCounters
+{
+    uint uGroupCounters[];
+};
+
+uniform uint uPhase;
+uniform uint uCommandCount;
+
+void main()
+{
+    uint commandIdx = gl_GlobalInvocationID.x;
+    if (commandIdx >= uCommandCount)
+        return;
+
+    DrawElementsIndirectCommand command = uSourceCommands[commandIdx];
+    uint groupBase = command.baseInstance;
+
+    command.instanceCount = uGroupCounters[2u * groupBase + uPhase];
+    if (uPhase == 1u)
+        command.baseInstance += uGroupCounters[2u * groupBase];
+
+    uCulledCommands[uPhase * uCommandCount + commandIdx] = command;
+}
+
+#endif
+#endif
+
+#ifdef MESHLET_CULL
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// One workgroup per job, one invocation per meshlet of its instance. Every meshlet gets its
+// command, the ones out of the frustum, facing away or occluded draw no instances. Phase 1
+// tests again the meshlets phase 0 found occluded, as the instances in OCCLUSION_CULL
+layout(local_size_x = 64) in;
+
+struct Instance
+{
+    mat4 worldMatrix;
+};
+
+struct Meshlet
+{
+    vec3 center;
+    float radius;
+    vec3 coneAxis;
+    float coneCutoff;
+    uint firstIndex;
+    uint triangleCount;
+    uint padding0;
+    uint padding1;
+};
+
+struct MeshletJob
+{
+    uint instanceIdx;
+    uint firstMeshlet;
+    uint meshletCount;
+    uint firstCommand;
+    uint firstIndex;
+    int baseVertex;
+    uint padding0;
+    uint padding1;
+};
+
+struct DrawElementsIndirectCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(binding = 3, std430) readonly buffer Instances
+{
+    Instance uInstances[];
+};
+
+layout(binding = 4, std430) readonly buffer Meshlets
+{
+    Meshlet uMeshlets[];
+};
+
+layout(binding = 5, std430) readonly buffer MeshletJobs
+{
+    MeshletJob uJobs[];
+};
+
+layout(binding = 6, std430) writeonly buffer MeshletCommands
+{
+    DrawElementsIndirectCommand uCommands[];
+};
+
+layout(binding = 7, std430) buffer Rejected
+{
+    uint uRejected[];
+};
+
+uniform uint uPhase;
+uniform uint uCommandCount;
+
+bool IsOutsideFrustum(vec3 center, float radius)
+{
+    // Planes from the rows of the view projection, not normalized so the radius is scaled instead
+    mat4 rows = transpose(uViewProjectionMatrix);
+    vec4 planes[6] = vec4[](rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[3] + rows[2], rows[3] - rows[2]);
+    for (int i = 0; i < 6; ++i)
+    {
+        if (dot(planes[i].xyz, center) + planes[i].w < -radius * length(planes[i].xyz))
+            return true;
+    }
+    return false;
+}
+
+// In the space of the meshlet bounds, where the cone was baked. Mirroring instances flip the
+// winding on screen, they are never taken as back facing
+bool IsBackFacing(Meshlet meshlet, mat4 worldMatrix)
+{
+    if (meshlet.coneCutoff >= 1.0 || determinant(mat3(worldMatrix)) <= 0.0)
+        return false;
+
+    vec3 eye = (inverse(worldMatrix) * vec4(uCamPosition, 1.0)).xyz;
+    vec3 toCenter = meshlet.center - eye;
+    return dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * length(toCenter) + meshlet.radius;
+}
+
+void main()
+{
+    MeshletJob job = uJobs[gl_WorkGroupID.x];
+    uint meshletIdx = gl_LocalInvocationID.x;
+    if (meshletIdx >= job.meshletCount)
+        return;
+
+    uint commandIdx = job.firstCommand + meshletIdx;
+    Meshlet meshlet = uMeshlets[job.firstMeshlet + meshletIdx];
+    mat4 worldMatrix = uInstances[job.instanceIdx].worldMatrix;
+
+    vec3 center = (worldMatrix * vec4(meshlet.center, 1.0)).xyz;
+    float scale = max(max(length(worldMatrix[0].xyz), length(worldMatrix[1].xyz)), length(worldMatrix[2].xyz));
+    float radius = meshlet.radius * scale;
+
+    bool visible = false;
+    if (uPhase == 0u)
+    {
+        bool culled = IsOutsideFrustum(center, radius) || IsBackFacing(meshlet, worldMatrix);
+        bool occluded = !culled && IsOccluded(center - radius, center + radius);
+        uRejected[commandIdx] = occluded ? 1u : 0u;
+        visible = !culled && !occluded;
+    }
+    else if (uRejected[commandIdx] != 0u)
+    {
+        visible = !IsOccluded(center - radius, center + radius);
+    }
+
+    DrawElementsIndirectCommand command;
+    command.count = meshlet.triangleCount * 3u;
+    command.instanceCount = visible ? 1u : 0u;
+    command.firstIndex = job.firstIndex + meshlet.firstIndex;
+    command.baseVertex = job.baseVertex;
+    command.baseInstance = job.instanceIdx;
+
+    uCommands[uPhase * uCommandCount + commandIdx] = command;
+}
+
+#endif
+#endif
\ No newline at end of file
@@ -5,26 +5,16 @@
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
+layout(location = 5) in uint aInstanceIndex; // baseInstance + gl_InstanceID
 
-struct Light
+struct Instance
 {
-    uint type;
-    vec3 color;
-    vec3 direction;
-    vec3 position;
+    mat4 worldMatrix;
 };
 
-layout(binding = 0, std140) uniform GlobalsParams
+layout(binding = 3, std430) readonly buffer Instances
 {
-    vec3 uCamPosition;
-    uint uLightCount;
-    Light uLight[16];
-};
-
-layout(binding = 1, std140) uniform LocalParams
-{
-    mat4 uWorldMatrix;
-    mat4 uWorldViewProjectionMatrix;
+    Instance uInstances[];
 };
 
 out vec2 vTexCoord;
@@ -34,30 +24,18 @@ out vec3 vViewDir;
 
 void main()
 {
+    mat4 worldMatrix = uInstances[aInstanceIndex].worldMatrix;
+
     vTexCoord = aTexCoord;
-    vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-    vNormal =  vec3(uWorldMatrix * vec4(aNormal, 0.0));
+    vPosition = vec3(worldMatrix * vec4(aPosition, 1.0));
+    // The instance matrix carries the uniform dequantization scale, only the direction is kept
+    vNormal = normalize(vec3(worldMatrix * vec4(aNormal, 0.0)));
     vViewDir = uCamPosition - vPosition;
-    gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+    gl_Position = uViewProjectionMatrix * vec4(vPosition, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-struct Light
-{
-    uint type;
-    vec3 color;
-    vec3 direction;
-    vec3 position;
-};
-
-layout(binding = 0, std140) uniform GlobalsParams
-{
-    vec3 uCamPosition;
-    uint uLightCount;
-    Light uLight[16];
-};
-
 in vec2 vTexCoord;
 in vec3 vPosition;
 in vec3 vNormal;
@@ -65,6 +43,22 @@ in vec3 vViewDir;
 
 
 uniform sampler2D uTexture;
+
+#ifdef COMPACT_GBUFFER
+
+// Position and view direction are rebuilt from the depth buffer by the lighting
+// passes, the normal is stored octahedral encoded (see OctEncode in common.glsl)
+layout(location = 0) out vec4 oAlbedo;
+layout(location = 1) out vec2 oNormals;
+
+void main()
+{
+    oAlbedo = texture(uTexture, vTexCoord);
+    oNormals = OctEncode(normalize(vNormal)) * 0.5 + 0.5;
+}
+
+#else
+
 layout(location = 0) out vec4 oAlbedo;
 layout(location = 1) out vec4 oNormals;
 layout(location = 2) out vec4 oPosition;
@@ -82,11 +76,13 @@ float linearizeDepth(float depth)
 void main()
 {
     oAlbedo = texture(uTexture, vTexCoord);
-    oNormals = vec4(vNormal, 1.0);
+    oNormals = vec4(normalize(vNormal), 1.0);
     oPosition = vec4(vPosition, 1.0);
     oViewDir = vec4(vViewDir, 1.0);
     oDepth = vec4(vec3(1 - (linearizeDepth(gl_FragCoord.z) / far)), 1.0f);
 }
 
+#endif
+
 #endif
 #endif
\ No newline at end of file
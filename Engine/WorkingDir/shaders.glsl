@@ -3,19 +3,24 @@
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
 layout(location = 0) in vec3 aPosition;
+layout(location = 5) in uint aInstanceIndex; // baseInstance + gl_InstanceID
 
-layout(binding = 1, std140) uniform LocalParams
+struct Instance
 {
-    mat4 uWorldMatrix;
-    mat4 uWorldViewProjectionMatrix;
+    mat4 worldMatrix;
+};
+
+layout(binding = 3, std430) readonly buffer Instances
+{
+    Instance uInstances[];
 };
 
 out vec3 vPosition;
 
 void main()
 {
-    vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-    gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+    vPosition = vec3(uInstances[aInstanceIndex].worldMatrix * vec4(aPosition, 1.0));
+    gl_Position = uViewProjectionMatrix * vec4(vPosition, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////